@@ -0,0 +1,129 @@
+#include "BatchCoalescer.h"
+#include <algorithm>
+#include <iterator>
+
+BatchCoalescer::BatchCoalescer(SegmentationClient& client, size_t max_batch_size,
+                               std::chrono::milliseconds max_wait)
+    : m_client(client),
+      m_maxBatchSize(max_batch_size == 0 ? 1 : max_batch_size),
+      m_maxWait(max_wait),
+      m_stopping(false),
+      m_batchesSent(0),
+      m_framesSent(0),
+      m_framesExpired(0) {
+    m_thread = std::thread(&BatchCoalescer::run, this);
+}
+
+BatchCoalescer::~BatchCoalescer() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+std::future<cv::Mat> BatchCoalescer::submit(const cv::Mat& image, SegmentationClient::Deadline deadline) {
+    auto promise = std::make_shared<std::promise<cv::Mat>>();
+    std::future<cv::Mat> result = promise->get_future();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back({image, promise, std::chrono::steady_clock::now(), deadline});
+    }
+    m_condition.notify_one();
+
+    return result;
+}
+
+void BatchCoalescer::setMaxBatchSize(size_t max_batch_size) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_maxBatchSize = max_batch_size == 0 ? 1 : max_batch_size;
+    }
+    m_condition.notify_one();
+}
+
+size_t BatchCoalescer::maxBatchSize() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_maxBatchSize;
+}
+
+void BatchCoalescer::setMaxWait(std::chrono::milliseconds max_wait) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_maxWait = max_wait;
+    }
+    m_condition.notify_one();
+}
+
+void BatchCoalescer::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true) {
+        m_condition.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+        if (m_queue.empty()) {
+            // Stopping with nothing left to send
+            return;
+        }
+
+        // Give the batch until its oldest frame has waited max_wait to fill up
+        while (!m_stopping && m_queue.size() < m_maxBatchSize) {
+            auto deadline = m_queue.front().queuedAt + m_maxWait;
+            if (m_condition.wait_until(lock, deadline) == std::cv_status::timeout) {
+                break;
+            }
+        }
+
+        size_t count = std::min(m_queue.size(), m_maxBatchSize);
+        std::vector<PendingFrame> batch(std::make_move_iterator(m_queue.begin()),
+                                        std::make_move_iterator(m_queue.begin() + count));
+        m_queue.erase(m_queue.begin(), m_queue.begin() + count);
+
+        // Sending may block on the request engine's queue; don't hold up submit()
+        lock.unlock();
+        sendBatch(std::move(batch));
+        lock.lock();
+    }
+}
+
+void BatchCoalescer::sendBatch(std::vector<PendingFrame> batch) {
+    std::vector<cv::Mat> images;
+    auto promises = std::make_shared<std::vector<std::shared_ptr<std::promise<cv::Mat>>>>();
+    images.reserve(batch.size());
+    promises->reserve(batch.size());
+
+    // The batch is wanted as long as any of its frames is
+    auto now = std::chrono::steady_clock::now();
+    SegmentationClient::Deadline deadline;
+    bool unbounded = false;
+    for (PendingFrame& frame : batch) {
+        if (frame.deadline.time_since_epoch().count() == 0) {
+            unbounded = true;
+        } else if (frame.deadline <= now) {
+            m_framesExpired++;
+            frame.promise->set_value(cv::Mat());
+            continue;
+        }
+        deadline = std::max(deadline, frame.deadline);
+        images.push_back(frame.image);
+        promises->push_back(std::move(frame.promise));
+    }
+    if (images.empty()) {
+        return;
+    }
+    if (unbounded) {
+        deadline = SegmentationClient::Deadline();
+    }
+
+    m_batchesSent++;
+    m_framesSent += images.size();
+
+    m_client.segmentImagesAsync(images, [promises](std::vector<cv::Mat> masks) {
+        for (size_t i = 0; i < promises->size(); i++) {
+            (*promises)[i]->set_value(i < masks.size() ? std::move(masks[i]) : cv::Mat());
+        }
+    }, deadline);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "SegmentationClient.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Gathers single frames, from any number of pipelines, into batch requests.
+// A batch goes out once it holds max_batch_size frames or its oldest frame
+// has waited max_wait, whichever comes first. A larger batch or a longer
+// wait gives the server more frames per request in exchange for a few
+// milliseconds of latency.
+//
+// A batch carries the latest deadline of its frames; frames whose own
+// deadline has passed by the time their batch goes out are dropped.
+class BatchCoalescer {
+public:
+    BatchCoalescer(SegmentationClient& client, size_t max_batch_size = 4,
+                   std::chrono::milliseconds max_wait = std::chrono::milliseconds(10));
+
+    // Sends whatever is still queued, then stops
+    ~BatchCoalescer();
+
+    BatchCoalescer(const BatchCoalescer&) = delete;
+    BatchCoalescer& operator=(const BatchCoalescer&) = delete;
+
+    // Queue a frame for the next batch; the future resolves with its mask
+    // (empty if the deadline passed first)
+    std::future<cv::Mat> submit(const cv::Mat& image,
+                                SegmentationClient::Deadline deadline = SegmentationClient::Deadline());
+
+    // Limits can be changed while running
+    void setMaxBatchSize(size_t max_batch_size);
+    void setMaxWait(std::chrono::milliseconds max_wait);
+    size_t maxBatchSize() const;
+
+    // Batches and frames sent so far (frames / batches = average batch size)
+    size_t batchesSent() const { return m_batchesSent; }
+    size_t framesSent() const { return m_framesSent; }
+
+    // Frames dropped because their deadline passed while waiting for a batch
+    size_t framesExpired() const { return m_framesExpired; }
+
+private:
+    struct PendingFrame {
+        cv::Mat image;
+        std::shared_ptr<std::promise<cv::Mat>> promise;
+        std::chrono::steady_clock::time_point queuedAt;
+        SegmentationClient::Deadline deadline;
+    };
+
+    SegmentationClient& m_client;
+
+    size_t m_maxBatchSize;
+    std::chrono::milliseconds m_maxWait;
+
+    std::deque<PendingFrame> m_queue;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopping;
+
+    std::atomic<size_t> m_batchesSent;
+    std::atomic<size_t> m_framesSent;
+    std::atomic<size_t> m_framesExpired;
+
+    std::thread m_thread;
+
+    void run();
+    void sendBatch(std::vector<PendingFrame> batch);
+};
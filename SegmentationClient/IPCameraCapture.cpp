@@ -1,12 +1,31 @@
 #include "IPCameraCapture.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+
+namespace {
+
+// Longer gaps between frames (a stall or a reconnect) restart the timing
+// instead of counting as an interval
+const double kMaxIntervalMs = 1000.0;
+
+// Weight of a new interval in the fps and jitter averages (as in RFC 3550)
+const double kSmoothing = 1.0 / 16.0;
+
+} // namespace
 
 IPCameraCapture::IPCameraCapture(const std::string& cameraUrl)
     : m_cameraUrl(cameraUrl),
       m_isRunning(false),
-      m_newFrameAvailable(false),
+      m_sequence(0),
+      m_framesSkipped(0),
+      m_lastReturned(0),
       m_width(600),
-      m_height(350) {
+      m_height(350),
+      m_targetFps(0.0),
+      m_intervalMs(0.0) {
 }
 
 IPCameraCapture::~IPCameraCapture() {
@@ -60,7 +79,6 @@ void IPCameraCapture::stop() {
     // Notify any waiting threads
     {
         std::lock_guard<std::mutex> lock(m_frameMutex);
-        m_newFrameAvailable = true;
     }
     m_frameCondition.notify_all();
 }
@@ -69,22 +87,29 @@ bool IPCameraCapture::isRunning() const {
     return m_isRunning;
 }
 
-cv::Mat IPCameraCapture::getLatestFrame() {
+FramePtr IPCameraCapture::getLatestFrame() {
     std::unique_lock<std::mutex> lock(m_frameMutex);
     
     // Wait until a new frame is available
-    m_frameCondition.wait(lock, [this] { return m_newFrameAvailable || !m_isRunning; });
+    FramePtr frame;
+    m_frameCondition.wait(lock, [this, &frame] {
+        frame = m_latestFrame;
+        return (frame && frame->sequence > m_lastReturned) || !m_isRunning;
+    });
     
-    // If stopped, return an empty frame
+    // If stopped, return no frame
     if (!m_isRunning) {
-        return cv::Mat();
+        return nullptr;
     }
     
-    // Reset the flag
-    m_newFrameAvailable = false;
-    
-    // Return a copy of the latest frame
-    return m_latestFrame.clone();
+    // A shared handle, no copy
+    m_lastReturned = frame->sequence;
+    return frame;
+}
+
+FramePtr IPCameraCapture::latestFrame() const {
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    return m_latestFrame;
 }
 
 void IPCameraCapture::setFrameCallback(FrameCallback callback) {
@@ -103,13 +128,117 @@ void IPCameraCapture::setResolution(int width, int height) {
     }
 }
 
+void IPCameraCapture::setTargetFps(double fps) {
+    m_targetFps = std::max(fps, 0.0);
+}
+
+IPCameraCapture::CaptureStats IPCameraCapture::captureStats() const {
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    return m_stats;
+}
+
+std::string IPCameraCapture::captureSummary() const {
+    CaptureStats s = captureStats();
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    out << "Camera: source " << s.sourceFps << " fps (jitter " << s.jitterMs << " ms), "
+        << s.framesRead << " frames read, " << s.framesDelivered << " delivered, "
+        << s.framesDecimated << " decimated";
+    if (m_targetFps > 0.0) {
+        out << " to " << m_targetFps.load() << " fps";
+    }
+    out << ", " << m_framesSkipped << " skipped with all buffers in use";
+    return out.str();
+}
+
+bool IPCameraCapture::pace(CapturedFrame& frame) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double streamMs = m_capture.get(cv::CAP_PROP_POS_MSEC);
+    frame.capturedAt = now;
+    
+    {
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        m_stats.framesRead++;
+        
+        if (m_pacing.started) {
+            double arrivalMs = std::chrono::duration<double, std::milli>(now - m_pacing.lastArrival).count();
+            
+            // Stream timestamps are exact, but some sources have none and
+            // they restart with the stream
+            double streamInterval = streamMs - m_pacing.lastStreamMs;
+            bool streamClock = streamInterval > 0.0 && streamInterval < kMaxIntervalMs;
+            double interval = streamClock ? streamInterval : arrivalMs;
+            m_pacing.mediaMs += interval;
+            
+            if (interval < kMaxIntervalMs) {
+                m_intervalMs = m_intervalMs == 0.0 ? interval : m_intervalMs + kSmoothing * (interval - m_intervalMs);
+                m_stats.sourceFps = 1000.0 / m_intervalMs;
+                
+                // How far arrivals stray from the source's own spacing
+                double expected = streamClock ? interval : m_intervalMs;
+                m_stats.jitterMs += kSmoothing * (std::abs(arrivalMs - expected) - m_stats.jitterMs);
+            }
+        } else {
+            // First frame after (re)connecting goes out right away
+            m_pacing.started = true;
+            m_pacing.nextDueMs = std::min(m_pacing.nextDueMs, m_pacing.mediaMs);
+        }
+    }
+    m_pacing.lastStreamMs = streamMs;
+    m_pacing.lastArrival = now;
+    frame.timestampMs = m_pacing.mediaMs;
+    
+    // Decimate by source time: deliver the frame nearest each due time.
+    // Sleeping instead would only leave frames to go stale in the decoder.
+    double targetFps = m_targetFps;
+    bool deliver = true;
+    if (targetFps > 0.0) {
+        double periodMs = 1000.0 / targetFps;
+        deliver = m_pacing.mediaMs + m_intervalMs / 2 >= m_pacing.nextDueMs;
+        if (deliver) {
+            // Catch up by at most one frame after a gap
+            m_pacing.nextDueMs = std::max(m_pacing.nextDueMs + periodMs, m_pacing.mediaMs);
+        }
+    }
+    
+    if (!deliver) {
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        m_stats.framesDecimated++;
+    }
+    return deliver;
+}
+
+std::shared_ptr<CapturedFrame> IPCameraCapture::freeBuffer() {
+    FramePtr latest = latestFrame();
+    for (const auto& buffer : m_buffers) {
+        // Held only by the pool: not published and no handle out
+        if (buffer != latest && buffer.use_count() == 1) {
+            // Pairs with the readers' release of their handles, so their
+            // last reads of the pixels happen before they are overwritten
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return buffer;
+        }
+    }
+    if (m_buffers.size() < kMaxBuffers) {
+        m_buffers.push_back(std::make_shared<CapturedFrame>());
+        return m_buffers.back();
+    }
+    return nullptr;
+}
+
 void IPCameraCapture::captureLoop() {
-    cv::Mat frame;
+    // Frames land here while readers hold every buffer
+    CapturedFrame scratch;
     
+    // read() blocks until the source delivers the next frame, which paces
+    // this loop at the camera's own rate
     while (m_isRunning) {
-        // Capture a new frame
-        if (!m_capture.read(frame)) {
+        // Capture a new frame, straight into a buffer readers are done with
+        std::shared_ptr<CapturedFrame> buffer = freeBuffer();
+        CapturedFrame& frame = buffer ? *buffer : scratch;
+        if (!m_capture.read(frame.image)) {
             std::cerr << "Error: Failed to read frame from camera." << std::endl;
+            m_pacing.started = false;
             
             // Try to reconnect
             m_capture.release();
@@ -126,28 +255,39 @@ void IPCameraCapture::captureLoop() {
             continue;
         }
         
+        if (frame.image.empty() || !pace(frame)) {
+            continue;
+        }
+        
+        if (!buffer) {
+            m_framesSkipped++;
+            continue;
+        }
+        
         // Process the new frame
-        if (!frame.empty()) {
-            // Store the frame
-            {
-                std::lock_guard<std::mutex> lock(m_frameMutex);
-                m_latestFrame = frame.clone();
-                m_newFrameAvailable = true;
-            }
-            
-            // Notify waiting threads
-            m_frameCondition.notify_all();
-            
-            // Call the frame callback if set
-            {
-                std::lock_guard<std::mutex> lock(m_callbackMutex);
-                if (m_frameCallback) {
-                    m_frameCallback(frame);
-                }
-            }
+        buffer->sequence = ++m_sequence;
+        FramePtr published = buffer;
+        buffer.reset();
+        {
+            std::lock_guard<std::mutex> lock(m_statsMutex);
+            m_stats.framesDelivered++;
+        }
+        
+        // Publish the frame (pointer swap, no copy)
+        {
+            std::lock_guard<std::mutex> lock(m_frameMutex);
+            m_latestFrame = published;
         }
         
-        // Small delay to avoid hogging CPU
-        std::this_thread::sleep_for(std::chrono::milliseconds(30)); // ~30 fps
+        // Notify waiting threads
+        m_frameCondition.notify_all();
+        
+        // Call the frame callback if set
+        {
+            std::lock_guard<std::mutex> lock(m_callbackMutex);
+            if (m_frameCallback) {
+                m_frameCallback(published);
+            }
+        }
     }
 }
\ No newline at end of file
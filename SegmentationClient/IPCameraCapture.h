@@ -5,13 +5,30 @@
 #include <functional>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <memory>
 #include <mutex>
 #include <condition_variable>
+#include <vector>
+
+// A captured frame. Handed out as shared, read-only handles: the pixels are
+// never copied between the capture thread and its readers, and the buffer
+// is only reused for a later frame once no handle refers to it anymore.
+// A cv::Mat header taken from image must not outlive the handle, or it
+// sees the next frame's pixels; clone() the image to keep it longer.
+struct CapturedFrame {
+    cv::Mat image;
+    std::chrono::steady_clock::time_point capturedAt;
+    uint64_t sequence = 0;
+    double timestampMs = 0.0;   // source time, from the stream when it has one
+};
+
+using FramePtr = std::shared_ptr<const CapturedFrame>;
 
 class IPCameraCapture {
 public:
-    // Callback type for new frame processing
-    using FrameCallback = std::function<void(const cv::Mat&)>;
+    // Callback type for new frame processing, invoked on the capture thread
+    using FrameCallback = std::function<void(const FramePtr&)>;
     
     IPCameraCapture(const std::string& cameraUrl);
     ~IPCameraCapture();
@@ -25,36 +42,89 @@ public:
     // Check if capture is running
     bool isRunning() const;
     
-    // Get the latest frame (blocking if no frame is available)
-    cv::Mat getLatestFrame();
+    // Wait for a frame newer than the last one returned (null once stopped)
+    FramePtr getLatestFrame();
+    
+    // The most recent frame without waiting (null before the first one)
+    FramePtr latestFrame() const;
     
     // Set callback to be called when a new frame is captured
     void setFrameCallback(FrameCallback callback);
     
     // Set desired frame resolution
     void setResolution(int width, int height);
-
+    
+    // Deliver at most fps frames per second (0: every frame the source
+    // sends). Surplus frames are still read, so none go stale in the
+    // decoder's buffer, but they are dropped rather than handed out.
+    void setTargetFps(double fps);
+    
+    // Frames read into a throwaway buffer because readers held on to every
+    // pooled one
+    size_t framesSkipped() const { return m_framesSkipped; }
+    
+    struct CaptureStats {
+        double sourceFps = 0.0;     // measured from frame timestamps
+        double jitterMs = 0.0;      // mean deviation of arrivals from them
+        size_t framesRead = 0;
+        size_t framesDelivered = 0;
+        size_t framesDecimated = 0; // dropped to meet the target fps
+    };
+    CaptureStats captureStats() const;
+    std::string captureSummary() const;
+    
 private:
+    // Pooled frame buffers beyond which captured frames are skipped
+    static const size_t kMaxBuffers = 8;
+    
     std::string m_cameraUrl;
     cv::VideoCapture m_capture;
     
     std::atomic<bool> m_isRunning;
     std::thread m_captureThread;
     
-    // Frame storage
-    cv::Mat m_latestFrame;
-    std::mutex m_frameMutex;
+    // Frame buffers, owned by the capture thread; the latest one is
+    // published by a pointer swap under m_frameMutex
+    std::vector<std::shared_ptr<CapturedFrame>> m_buffers;
+    FramePtr m_latestFrame;
+    uint64_t m_sequence;
+    std::atomic<size_t> m_framesSkipped;
+    
+    // Guards m_latestFrame and wakes getLatestFrame() callers
+    mutable std::mutex m_frameMutex;
     std::condition_variable m_frameCondition;
-    bool m_newFrameAvailable;
+    uint64_t m_lastReturned;
     
     // Resolution settings
     int m_width;
     int m_height;
     
+    // Pacing, owned by the capture thread except where m_statsMutex is
+    // noted. Frame times come from the stream's timestamps when they advance,
+    // from the arrival time otherwise.
+    struct Pacing {
+        bool started = false;
+        double lastStreamMs = 0.0;
+        std::chrono::steady_clock::time_point lastArrival;
+        double mediaMs = 0.0;        // source time since the first frame
+        double nextDueMs = 0.0;      // when the next frame is to be delivered
+    } m_pacing;
+    std::atomic<double> m_targetFps;
+    mutable std::mutex m_statsMutex;
+    double m_intervalMs;             // smoothed frame interval (m_statsMutex)
+    CaptureStats m_stats;            // m_statsMutex
+    
     // Callback for new frames
     FrameCallback m_frameCallback;
     std::mutex m_callbackMutex;
     
     // Thread function
     void captureLoop();
-};
\ No newline at end of file
+    
+    // A buffer no reader refers to, or null if all are taken
+    std::shared_ptr<CapturedFrame> freeBuffer();
+    
+    // Timestamps a frame just read and updates the fps and jitter
+    // estimates; false if it is to be dropped to meet the target fps
+    bool pace(CapturedFrame& frame);
+};
@@ -0,0 +1,166 @@
+#include "MaskBufferPool.h"
+#include <new>
+#include <sstream>
+
+namespace {
+
+// Recycled cv::UMatData headers kept at most
+const size_t kMaxIdleHeaders = 256;
+
+} // namespace
+
+MaskBufferPool::MaskBufferPool(size_t max_idle_bytes)
+    : m_maxIdleBytes(max_idle_bytes) {
+}
+
+MaskBufferPool::~MaskBufferPool() {
+    // Buffers still in use are freed by whoever releases them last; only a
+    // pool that outlives its matrices (see shared()) is safe to destroy
+    for (auto& entry : m_free) {
+        for (uchar* buffer : entry.second) {
+            freeAligned(buffer);
+        }
+    }
+    for (void* header : m_freeHeaders) {
+        ::operator delete(header);
+    }
+}
+
+MaskBufferPool& MaskBufferPool::shared() {
+    static MaskBufferPool* pool = new MaskBufferPool();
+    return *pool;
+}
+
+void MaskBufferPool::attach(cv::Mat& mat) {
+    mat.allocator = this;
+}
+
+cv::Mat MaskBufferPool::create(int rows, int cols, int type) {
+    cv::Mat mat;
+    mat.allocator = this;
+    mat.create(rows, cols, type);
+    return mat;
+}
+
+void MaskBufferPool::setMaxIdleBytes(size_t max_idle_bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_maxIdleBytes = max_idle_bytes;
+}
+
+MaskBufferPool::Stats MaskBufferPool::stats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+std::string MaskBufferPool::summary() const {
+    Stats current = stats();
+    std::ostringstream out;
+    out << "Mask buffers: " << current.allocated << " allocated, " << current.reused << " reused, "
+        << current.live << " in use, " << current.idleBytes / 1024 << " KB idle";
+    return out.str();
+}
+
+cv::UMatData* MaskBufferPool::allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                                       AccessFlags /*flags*/, cv::UMatUsageFlags /*usage_flags*/) const {
+    // Same layout rules as OpenCV's default allocator: dense rows unless
+    // the caller supplies both data and steps
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--) {
+        if (step) {
+            if (data && step[i] != CV_AUTOSTEP) {
+                CV_Assert(total <= step[i]);
+                total = step[i];
+            } else {
+                step[i] = total;
+            }
+        }
+        total *= sizes[i];
+    }
+
+    void* header = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_freeHeaders.empty()) {
+            header = m_freeHeaders.back();
+            m_freeHeaders.pop_back();
+        }
+    }
+    if (!header) {
+        header = ::operator new(sizeof(cv::UMatData));
+    }
+
+    cv::UMatData* u = new (header) cv::UMatData(this);
+    u->data = u->origdata = data ? static_cast<uchar*>(data) : takeBuffer(total);
+    u->size = total;
+    if (data) {
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+    }
+    return u;
+}
+
+bool MaskBufferPool::allocate(cv::UMatData* data, AccessFlags /*access_flags*/,
+                              cv::UMatUsageFlags /*usage_flags*/) const {
+    // Host memory only: nothing to map
+    return data != nullptr;
+}
+
+void MaskBufferPool::deallocate(cv::UMatData* u) const {
+    if (!u) {
+        return;
+    }
+
+    CV_Assert(u->urefcount == 0);
+    CV_Assert(u->refcount == 0);
+    if (!(u->flags & cv::UMatData::USER_ALLOCATED)) {
+        returnBuffer(u->origdata, u->size);
+        u->origdata = nullptr;
+    }
+
+    u->~UMatData();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_freeHeaders.size() < kMaxIdleHeaders) {
+        m_freeHeaders.push_back(u);
+    } else {
+        ::operator delete(static_cast<void*>(u));
+    }
+}
+
+uchar* MaskBufferPool::takeBuffer(size_t size) const {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.live++;
+        auto it = m_free.find(size);
+        if (it != m_free.end() && !it->second.empty()) {
+            uchar* buffer = it->second.back();
+            it->second.pop_back();
+            m_stats.reused++;
+            m_stats.idleBytes -= size;
+            return buffer;
+        }
+        m_stats.allocated++;
+    }
+
+    // Outside the lock: a fresh buffer can take a while
+    return allocateAligned(size);
+}
+
+void MaskBufferPool::returnBuffer(uchar* buffer, size_t size) const {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.live--;
+        if (m_stats.idleBytes + size <= m_maxIdleBytes) {
+            m_free[size].push_back(buffer);
+            m_stats.idleBytes += size;
+            return;
+        }
+    }
+    freeAligned(buffer);
+}
+
+uchar* MaskBufferPool::allocateAligned(size_t size) {
+    return static_cast<uchar*>(::operator new(size > 0 ? size : 1, std::align_val_t(kAlignment)));
+}
+
+void MaskBufferPool::freeAligned(uchar* buffer) {
+    ::operator delete(buffer, std::align_val_t(kAlignment));
+}
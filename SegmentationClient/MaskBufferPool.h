@@ -0,0 +1,85 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Recycles the pixel buffers of masks and frames. With a fixed camera
+// resolution the same few buffer sizes come up over and over, so once the
+// pool is warm, decoding a mask reuses memory instead of allocating it.
+//
+// The pool is an OpenCV allocator: a cv::Mat attached to it draws its data
+// from the pool whenever it is (re)allocated, e.g. by create(), imdecode
+// with a dst argument or cvtColor into it. The buffer returns to the pool
+// when the last cv::Mat referring to it is released, so pooled masks are
+// ordinary cv::Mat handles for the code they are passed on to.
+//
+// Buffers are 64-byte aligned (one cache line, and enough for AVX-512
+// loads). Idle buffers beyond max_idle_bytes are freed.
+class MaskBufferPool : public cv::MatAllocator {
+public:
+    struct Stats {
+        size_t allocated = 0;   // buffers taken from the heap
+        size_t reused = 0;      // buffers handed out again from the pool
+        size_t live = 0;        // buffers currently in use
+        size_t idleBytes = 0;   // memory kept for reuse
+    };
+
+    explicit MaskBufferPool(size_t max_idle_bytes = 64 << 20);
+    ~MaskBufferPool() override;
+
+    MaskBufferPool(const MaskBufferPool&) = delete;
+    MaskBufferPool& operator=(const MaskBufferPool&) = delete;
+
+    // Process-wide pool. It is never destroyed, so masks handed out by a
+    // client may outlive the client.
+    static MaskBufferPool& shared();
+
+    // Make mat draw from the pool on its next allocation. Data mat already
+    // holds stays with its own allocator until released.
+    void attach(cv::Mat& mat);
+
+    // A pooled rows x cols matrix (contents undefined)
+    cv::Mat create(int rows, int cols, int type);
+
+    void setMaxIdleBytes(size_t max_idle_bytes);
+
+    Stats stats() const;
+    std::string summary() const;
+
+    // cv::MatAllocator
+#if CV_VERSION_MAJOR >= 4
+    using AccessFlags = cv::AccessFlag;
+#else
+    using AccessFlags = int;
+#endif
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                           AccessFlags flags, cv::UMatUsageFlags usage_flags) const override;
+    bool allocate(cv::UMatData* data, AccessFlags access_flags, cv::UMatUsageFlags usage_flags) const override;
+    void deallocate(cv::UMatData* data) const override;
+
+private:
+    static const size_t kAlignment = 64;
+
+    // Buffers of one byte size waiting for reuse
+    using FreeList = std::vector<uchar*>;
+
+    uchar* takeBuffer(size_t size) const;
+    void returnBuffer(uchar* buffer, size_t size) const;
+    static uchar* allocateAligned(size_t size);
+    static void freeAligned(uchar* buffer);
+
+    // allocate/deallocate are const in cv::MatAllocator
+    mutable std::mutex m_mutex;
+    mutable std::unordered_map<size_t, FreeList> m_free;
+
+    // Headers (cv::UMatData) are recycled too: raw storage, constructed on
+    // allocation and destroyed on deallocation
+    mutable std::vector<void*> m_freeHeaders;
+
+    size_t m_maxIdleBytes;
+    mutable Stats m_stats;
+};
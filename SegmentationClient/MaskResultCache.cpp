@@ -0,0 +1,126 @@
+#include "MaskResultCache.h"
+#include <algorithm>
+#include <sstream>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+MaskResultCache::MaskResultCache(int max_distance, std::chrono::milliseconds ttl, size_t capacity)
+    : m_maxDistance(std::min(std::max(max_distance, 0), 64)),
+      m_ttl(ttl),
+      m_capacity(std::max<size_t>(capacity, 1)),
+      m_missLatencyMs(0.0) {
+}
+
+uint64_t MaskResultCache::hash(const cv::Mat& image) {
+    // 9x8 thumbnail in stack buffers; OpenCV fills preallocated outputs in place
+    alignas(16) uchar gray[80] = {};
+    uchar color[8 * 9 * 4];
+    cv::Mat thumbnail(8, 9, CV_8UC1, gray);
+    if (image.channels() == 1) {
+        cv::resize(image, thumbnail, thumbnail.size(), 0, 0, cv::INTER_AREA);
+    } else {
+        // Averaging before the colour conversion touches each pixel once
+        cv::Mat small(8, 9, CV_MAKETYPE(CV_8U, image.channels()), color);
+        cv::resize(image, small, small.size(), 0, 0, cv::INTER_AREA);
+        cv::cvtColor(small, thumbnail, image.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+    }
+
+    uint64_t bits = 0;
+#ifdef __SSE2__
+    // Two rows per step: a byte is brighter than its right neighbour exactly
+    // when the saturating difference is non-zero
+    const __m128i zero = _mm_setzero_si128();
+    for (int y = 0; y < 8; y += 2) {
+        const uchar* top = gray + y * 9;
+        const uchar* bottom = top + 9;
+        __m128i left = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(top)),
+                                          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(bottom)));
+        __m128i right = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(top + 1)),
+                                           _mm_loadl_epi64(reinterpret_cast<const __m128i*>(bottom + 1)));
+        __m128i notBrighter = _mm_cmpeq_epi8(_mm_subs_epu8(left, right), zero);
+        uint64_t rows = ~static_cast<uint32_t>(_mm_movemask_epi8(notBrighter)) & 0xFFFFu;
+        bits |= rows << (y * 8);
+    }
+#else
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            if (gray[y * 9 + x] > gray[y * 9 + x + 1]) {
+                bits |= uint64_t(1) << (y * 8 + x);
+            }
+        }
+    }
+#endif
+    return bits;
+}
+
+bool MaskResultCache::lookup(uint64_t key, cv::Size frame_size, cv::Mat& mask) {
+    Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.lookups++;
+
+    // The closest frame of the same size within the distance limit
+    const Entry* best = nullptr;
+    int bestDistance = m_maxDistance + 1;
+    for (const Entry& entry : m_entries) {
+        int distance = __builtin_popcountll(entry.key ^ key);
+        if (distance < bestDistance && entry.frameSize == frame_size) {
+            best = &entry;
+            bestDistance = distance;
+        }
+    }
+
+    if (!best) {
+        return false;
+    }
+    if (now - best->storedAt > m_ttl) {
+        m_stats.expired++;
+        return false;
+    }
+
+    m_stats.hits++;
+    m_stats.savedMs += m_missLatencyMs;
+    mask = best->mask;
+    return true;
+}
+
+void MaskResultCache::store(uint64_t key, cv::Size frame_size, const cv::Mat& mask, double latency_ms) {
+    Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_missLatencyMs = m_missLatencyMs == 0.0 ? latency_ms : 0.9 * m_missLatencyMs + 0.1 * latency_ms;
+
+    // Replace the entry of the same frame, else the oldest one
+    auto slot = std::find_if(m_entries.begin(), m_entries.end(), [&](const Entry& entry) {
+        return entry.key == key && entry.frameSize == frame_size;
+    });
+    if (slot == m_entries.end() && m_entries.size() >= m_capacity) {
+        slot = std::min_element(m_entries.begin(), m_entries.end(), [](const Entry& a, const Entry& b) {
+            return a.storedAt < b.storedAt;
+        });
+    }
+
+    Entry entry{key, frame_size, mask, now};
+    if (slot == m_entries.end()) {
+        m_entries.push_back(std::move(entry));
+    } else {
+        *slot = std::move(entry);
+    }
+}
+
+MaskResultCache::Stats MaskResultCache::stats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+std::string MaskResultCache::summary() const {
+    Stats current = stats();
+    std::ostringstream out;
+    out << "Result cache: " << current.hits << "/" << current.lookups << " hits";
+    if (current.lookups > 0) {
+        out << " (" << 100 * current.hits / current.lookups << "%)";
+    }
+    out << ", " << current.expired << " near matches expired, ~"
+        << static_cast<long long>(current.savedMs) << " ms of round trips saved";
+    return out.str();
+}
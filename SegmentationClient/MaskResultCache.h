@@ -0,0 +1,69 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Recent masks keyed by a perceptual hash of their frames, so that a camera
+// watching an unchanged scene doesn't pay a server round trip per frame.
+//
+// The key is a 64-bit difference hash (dHash): the grayscale frame is area-
+// averaged down to 9x8 and each bit says whether a pixel is brighter than
+// its right neighbour. Sensor noise and compression artefacts leave it
+// unchanged or flip a few bits; anything that moves in the scene flips many.
+// A lookup hits the closest entry of the same frame size within
+// max_distance bits (Hamming distance), as long as its mask is younger than
+// the TTL. Entries are not refreshed by hits, so the TTL bounds how stale a
+// returned mask can be. Thread-safe.
+class MaskResultCache {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats {
+        size_t lookups = 0;
+        size_t hits = 0;
+        size_t expired = 0;      // a close entry existed but was too old
+        double savedMs = 0.0;    // round trips avoided, at the average miss latency
+    };
+
+    explicit MaskResultCache(int max_distance = 4,
+                             std::chrono::milliseconds ttl = std::chrono::milliseconds(1000),
+                             size_t capacity = 8);
+
+    // 64-bit dHash of a grayscale or BGR frame
+    static uint64_t hash(const cv::Mat& image);
+
+    // True with the cached answer for a near-identical frame in mask (empty
+    // if the server found nothing). The mask is shared with the cache and
+    // must not be written to.
+    bool lookup(uint64_t key, cv::Size frame_size, cv::Mat& mask);
+
+    // Remember the server's answer for a frame (an empty mask when nothing
+    // was found) and how long it took to get
+    void store(uint64_t key, cv::Size frame_size, const cv::Mat& mask, double latency_ms);
+
+    Stats stats() const;
+    std::string summary() const;
+
+private:
+    struct Entry {
+        uint64_t key;
+        cv::Size frameSize;
+        cv::Mat mask;
+        Clock::time_point storedAt;
+    };
+
+    int m_maxDistance;
+    Clock::duration m_ttl;
+    size_t m_capacity;
+
+    mutable std::mutex m_mutex;
+    std::vector<Entry> m_entries;
+
+    // Moving average of the latency of requests the cache didn't answer
+    double m_missLatencyMs;
+    Stats m_stats;
+};
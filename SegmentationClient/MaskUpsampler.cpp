@@ -0,0 +1,64 @@
+#include "MaskUpsampler.h"
+#include <algorithm>
+
+GuidedMaskUpsampler::GuidedMaskUpsampler(int radius, double eps)
+    : m_radius(radius), m_eps(eps) {
+}
+
+cv::Mat GuidedMaskUpsampler::upsample(const cv::Mat& mask, const cv::Mat& guide) const {
+    if (mask.empty() || guide.empty()) {
+        return cv::Mat();
+    }
+
+    // Work on [0, 1] floats; the mask as a soft 0/1 input
+    cv::Mat guideFull;
+    guide.convertTo(guideFull, CV_32F, 1.0 / 255.0);
+    cv::Mat p;
+    cv::threshold(mask, p, 0, 1, cv::THRESH_BINARY);
+    p.convertTo(p, CV_32F);
+
+    // Fit the coefficients at the mask's resolution
+    cv::Mat guideLow;
+    if (guide.size() != mask.size()) {
+        cv::resize(guideFull, guideLow, mask.size(), 0, 0, cv::INTER_AREA);
+    } else {
+        guideLow = guideFull;
+    }
+
+    double scale = static_cast<double>(guide.cols) / mask.cols;
+    int radius = std::max(1, static_cast<int>(m_radius / scale + 0.5));
+    cv::Size window(2 * radius + 1, 2 * radius + 1);
+
+    auto boxMean = [&window](const cv::Mat& src) {
+        cv::Mat dst;
+        cv::boxFilter(src, dst, CV_32F, window, cv::Point(-1, -1), true, cv::BORDER_REFLECT);
+        return dst;
+    };
+
+    cv::Mat meanI = boxMean(guideLow);
+    cv::Mat meanP = boxMean(p);
+    cv::Mat corrIP = boxMean(guideLow.mul(p));
+    cv::Mat corrII = boxMean(guideLow.mul(guideLow));
+
+    cv::Mat varI = corrII - meanI.mul(meanI);
+    cv::Mat covIP = corrIP - meanI.mul(meanP);
+
+    // q = a * I + b, locally linear in the guide
+    cv::Mat a = covIP / (varI + m_eps);
+    cv::Mat b = meanP - a.mul(meanI);
+
+    cv::Mat meanA = boxMean(a);
+    cv::Mat meanB = boxMean(b);
+
+    // Apply the smoothed coefficients to the full-resolution frame
+    if (guide.size() != mask.size()) {
+        cv::resize(meanA, meanA, guide.size(), 0, 0, cv::INTER_LINEAR);
+        cv::resize(meanB, meanB, guide.size(), 0, 0, cv::INTER_LINEAR);
+    }
+    cv::Mat q = meanA.mul(guideFull) + meanB;
+
+    cv::Mat result;
+    cv::threshold(q, result, 0.5, 255, cv::THRESH_BINARY);
+    result.convertTo(result, CV_8U);
+    return result;
+}
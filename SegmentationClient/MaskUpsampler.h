@@ -0,0 +1,26 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+// Brings a low-resolution mask back to frame resolution along the edges of
+// the full-resolution grayscale frame, instead of the blocky steps of a
+// nearest-neighbour resize.
+//
+// This is the fast guided filter (He & Sun, 2015): the filter's linear
+// coefficients are fitted at the mask's resolution against a downscaled
+// copy of the frame, upsampled bilinearly, and applied to the full frame.
+// The result is thresholded back to a 0/255 mask.
+class GuidedMaskUpsampler {
+public:
+    // radius: filter window radius in full-resolution pixels
+    // eps: regularisation on [0, 1] intensities; smaller follows weaker edges
+    explicit GuidedMaskUpsampler(int radius = 8, double eps = 1e-3);
+
+    // mask: CV_8UC1 (non-zero = foreground) at any resolution
+    // guide: CV_8UC1 frame at the target resolution
+    cv::Mat upsample(const cv::Mat& mask, const cv::Mat& guide) const;
+
+private:
+    int m_radius;
+    double m_eps;
+};
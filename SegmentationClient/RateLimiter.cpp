@@ -0,0 +1,107 @@
+#include "RateLimiter.h"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+TokenBucket::TokenBucket(double rate, double burst)
+    : m_rate(rate),
+      m_burst(std::max(burst, 1.0)),
+      m_tokens(m_burst),
+      m_last(std::chrono::steady_clock::now()) {
+}
+
+bool TokenBucket::available(double cost, std::chrono::steady_clock::time_point now) {
+    if (unlimited()) {
+        return true;
+    }
+    std::chrono::duration<double> elapsed = now - m_last;
+    m_last = now;
+    m_tokens = std::min(m_burst, m_tokens + elapsed.count() * m_rate);
+    return m_tokens >= cost;
+}
+
+void TokenBucket::take(double cost) {
+    if (!unlimited()) {
+        m_tokens -= cost;
+    }
+}
+
+RateLimiter::RateLimiter(std::string name, RateLimiter* parent)
+    : m_name(std::move(name)),
+      m_parent(parent),
+      m_created(Clock::now()) {
+}
+
+RateLimiter& RateLimiter::global() {
+    static RateLimiter* limiter = new RateLimiter("All cameras");
+    return *limiter;
+}
+
+void RateLimiter::setLimits(double requests_per_second, double upload_bytes_per_second, double burst_seconds) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    burst_seconds = std::max(burst_seconds, 0.0);
+    m_requests = TokenBucket(requests_per_second, requests_per_second * burst_seconds);
+    m_bytes = TokenBucket(upload_bytes_per_second, upload_bytes_per_second * burst_seconds);
+}
+
+bool RateLimiter::admit() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return admitLocked(Clock::now());
+}
+
+bool RateLimiter::admitLocked(Clock::time_point now) {
+    // Any byte debt holds frames back until it is paid off
+    if (!m_requests.available(1.0, now) || !m_bytes.available(0.0, now)) {
+        m_stats.limited++;
+        return false;
+    }
+    if (m_parent) {
+        std::lock_guard<std::mutex> lock(m_parent->m_mutex);
+        if (!m_parent->admitLocked(now)) {
+            return false;
+        }
+    }
+    m_requests.take(1.0);
+    m_stats.admitted++;
+    return true;
+}
+
+void RateLimiter::charge(size_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bytes.take(static_cast<double>(bytes));
+    }
+    if (m_parent) {
+        m_parent->charge(bytes);
+    }
+}
+
+void RateLimiter::record(size_t sent, size_t received) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.bytesSent += sent;
+        m_stats.bytesReceived += received;
+    }
+    if (m_parent) {
+        m_parent->record(sent, received);
+    }
+}
+
+RateLimiter::Stats RateLimiter::stats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats stats = m_stats;
+    stats.seconds = std::chrono::duration<double>(Clock::now() - m_created).count();
+    return stats;
+}
+
+std::string RateLimiter::summary() const {
+    Stats s = stats();
+    double seconds = std::max(s.seconds, 1e-3);
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    out << m_name << ": " << s.admitted << " requests (" << s.admitted / seconds << "/s), "
+        << s.limited << " rate limited, " << s.bytesSent / 1024 << " KB sent ("
+        << s.bytesSent / 1024.0 / seconds << " KB/s), " << s.bytesReceived / 1024 << " KB received ("
+        << s.bytesReceived / 1024.0 / seconds << " KB/s)";
+    return out.str();
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+// Token bucket: fills at rate tokens per second up to burst tokens
+class TokenBucket {
+public:
+    // rate <= 0 means unlimited
+    explicit TokenBucket(double rate = 0.0, double burst = 0.0);
+
+    bool unlimited() const { return m_rate <= 0.0; }
+
+    // Whether cost tokens are there now (after refilling)
+    bool available(double cost, std::chrono::steady_clock::time_point now);
+
+    // Take tokens; the balance may go negative (debt repaid by refilling)
+    void take(double cost);
+
+private:
+    double m_rate;
+    double m_burst;
+    double m_tokens;
+    std::chrono::steady_clock::time_point m_last;
+};
+
+// Request and upload bandwidth budget of one camera, optionally nested in a
+// budget shared by all cameras of the process (global()).
+//
+// A frame is admitted when both its camera and the global budget have a
+// request token and no upload byte debt; otherwise it is dropped, since a
+// live pipeline is better served by a fresh frame later than by a queue.
+// The upload size is only known after encoding, so bytes are charged
+// afterwards and may overdraw the byte bucket; the next frames then wait
+// until the debt is paid off, which holds the average to the rate.
+//
+// Bytes sent and received on the wire are counted per camera and globally.
+//
+// Thread-safe. Locks are taken camera first, then global.
+class RateLimiter {
+public:
+    struct Stats {
+        size_t admitted = 0;
+        size_t limited = 0;         // frames refused by this budget
+        size_t bytesSent = 0;
+        size_t bytesReceived = 0;
+        double seconds = 0.0;       // since creation, for averages
+    };
+
+    explicit RateLimiter(std::string name, RateLimiter* parent = nullptr);
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    // Process-wide budget all clients are nested in (unlimited by default).
+    // It is never destroyed.
+    static RateLimiter& global();
+
+    // Requests and upload bytes per second (<= 0: unlimited), each with a
+    // burst of burst_seconds at that rate
+    void setLimits(double requests_per_second, double upload_bytes_per_second, double burst_seconds = 1.0);
+
+    // Take a request token for a frame, from this budget and its parent;
+    // false if either is exhausted (nothing is taken then)
+    bool admit();
+
+    // Charge the upload bytes of an admitted request
+    void charge(size_t bytes);
+
+    // Count bytes that went over the wire
+    void record(size_t sent, size_t received);
+
+    Stats stats() const;
+    std::string summary() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    const std::string m_name;
+    RateLimiter* const m_parent;
+    const Clock::time_point m_created;
+
+    mutable std::mutex m_mutex;
+    TokenBucket m_requests;
+    TokenBucket m_bytes;
+    Stats m_stats;
+
+    // Checks this budget and its ancestors, with m_mutex held
+    bool admitLocked(Clock::time_point now);
+};
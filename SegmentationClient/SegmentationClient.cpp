@@ -1,64 +1,934 @@
 
 #include "SegmentationClient.h"
+#include "Base64.h"
 #include <sstream>
 #include <iomanip>
 #include <iostream>
-#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <mutex>
 
-SegmentationClient::SegmentationClient(const std::string& server_url)
-    : m_serverUrl(server_url) {
+namespace {
+
+std::vector<std::unique_ptr<UploadEncoder>> makeEncoders(UploadEncoder* encoder) {
+    std::vector<std::unique_ptr<UploadEncoder>> encoders;
+    encoders.emplace_back(encoder);
+    return encoders;
+}
+
+bool succeeded(const HttpResponse& response) {
+    return response.error.empty() && response.status_code == 200;
+}
+
+size_t requestBytes(const HttpRequest& request) {
+    size_t bytes = request.body.size();
+    for (const MultipartPart& part : request.parts) {
+        bytes += part.data.size();
+    }
+    return bytes;
+}
+
+} // namespace
+
+struct SegmentationClient::HedgedCall {
+    struct Attempt {
+        size_t endpoint;
+        AsyncRequestEngine::RequestId id;   // 0 until submit() returns
+        bool done;
+        bool cancelPending;                 // lost before it had an id
+    };
+    
+    std::mutex mutex;
+    HttpRequest request;  // kept for the duplicate
+    AsyncRequestEngine::Callback callback;
+    std::vector<Attempt> attempts;
+    bool settled = false;
+};
+
+SegmentationClient::SegmentationClient(const std::string& server_url, size_t max_sessions,
+                                       size_t max_in_flight)
+    : m_httpVersion(HttpVersion::Http1_1),
+      m_responseFormat(ResponseFormat::Json),
+      m_sessions(max_sessions),
+      m_hedgeQuantile(0.0),
+      m_hedgesSent(0),
+      m_hedgesWon(0),
+      m_codecs(new UploadCodecTuner(makeEncoders(new PngUploadEncoder(9)))),
+      m_uploadScale(1.0),
+      m_rateLimiter("This camera", &RateLimiter::global()),
+      m_droppedBeforeEncoding(0),
+      m_droppedBeforeSending(0),
+      m_droppedInFlight(0),
+      m_droppedOverLimit(0),
+      m_droppedRateLimited(0),
+      m_maskPool(MaskBufferPool::shared()),
+      m_engine(max_in_flight, max_in_flight * 2, m_sessions.share()) {
+    m_endpoints.addEndpoint(server_url);
+}
+
+SegmentationClient::~SegmentationClient() {
+    // Outstanding requests fail while the decode workers still take their
+    // responses; a hedge a worker starts from here on fails at once
+    m_engine.stop();
+}
+
+cv::Mat SegmentationClient::segmentImage(const cv::Mat& image, Deadline deadline) {
+    // A stale frame is not worth encoding
+    if (expired(deadline, 1)) {
+        return cv::Mat();
+    }
+    
+    uint64_t cacheKey = 0;
+    cv::Mat cached;
+    if (lookupResult(image, cacheKey, cached)) {
+        return cached;
+    }
+    
+    if (rateLimited(1)) {
+        return cv::Mat();
+    }
+    
+    uint32_t deltaFrame = 0;
+    HttpRequest request = buildRequest({image}, deadline, &deltaFrame);
+    if (request.parts.empty()) {
+        return cv::Mat();
+    }
+    HttpResponse response = send(std::move(request));
+    finishDelta(deltaFrame, response);
+    cv::Mat mask = parseResponse(response);
+    storeResult(cacheKey, image.size(), response, mask);
+    return mask;
+}
+
+std::future<cv::Mat> SegmentationClient::segmentImageAsync(const cv::Mat& image, Deadline deadline) {
+    // Create a promise to deliver the result
+    std::shared_ptr<std::promise<cv::Mat>> resultPromise = 
+        std::make_shared<std::promise<cv::Mat>>();
+    
+    // Get a future from the promise
+    std::future<cv::Mat> resultFuture = resultPromise->get_future();
+    
+    if (expired(deadline, 1)) {
+        resultPromise->set_value(cv::Mat());
+        return resultFuture;
+    }
+    
+    uint64_t cacheKey = 0;
+    cv::Mat cached;
+    if (lookupResult(image, cacheKey, cached)) {
+        resultPromise->set_value(cached);
+        return resultFuture;
+    }
+    
+    if (rateLimited(1)) {
+        resultPromise->set_value(cv::Mat());
+        return resultFuture;
+    }
+    
+    // Encode on the caller's thread and decode on a worker, so the request
+    // engine's I/O thread only moves bytes
+    uint32_t deltaFrame = 0;
+    HttpRequest request = buildRequest({image}, deadline, &deltaFrame);
+    if (request.parts.empty()) {
+        resultPromise->set_value(cv::Mat());
+        return resultFuture;
+    }
+    cv::Size frameSize = image.size();
+    dispatch(std::move(request), [this, resultPromise, deltaFrame, cacheKey, frameSize](HttpResponse&& response) {
+        m_decoders.post([this, resultPromise, deltaFrame, cacheKey, frameSize, response = std::move(response)] {
+            finishDelta(deltaFrame, response);
+            try {
+                cv::Mat mask = parseResponse(response);
+                storeResult(cacheKey, frameSize, response, mask);
+                resultPromise->set_value(mask);
+            } catch (const std::exception& e) {
+                resultPromise->set_exception(std::current_exception());
+            }
+        });
+    });
+    
+    return resultFuture;
+}
+
+std::vector<cv::Mat> SegmentationClient::segmentImages(const std::vector<cv::Mat>& images,
+                                                       Deadline deadline) {
+    if (images.empty()) {
+        return {};
+    }
+    if (expired(deadline, images.size()) || rateLimited(images.size())) {
+        return std::vector<cv::Mat>(images.size());
+    }
+    
+    HttpRequest request = buildRequest(images, deadline);
+    if (request.parts.empty()) {
+        return std::vector<cv::Mat>(images.size());
+    }
+    return parseBatchResponse(send(std::move(request)), images.size());
+}
+
+void SegmentationClient::segmentImagesAsync(const std::vector<cv::Mat>& images, BatchCallback callback,
+                                            Deadline deadline) {
+    if (images.empty()) {
+        callback({});
+        return;
+    }
+    if (expired(deadline, images.size()) || rateLimited(images.size())) {
+        callback(std::vector<cv::Mat>(images.size()));
+        return;
+    }
+    
+    HttpRequest request = buildRequest(images, deadline);
+    if (request.parts.empty()) {
+        callback(std::vector<cv::Mat>(images.size()));
+        return;
+    }
+    size_t count = images.size();
+    dispatch(std::move(request), [this, count, callback](HttpResponse&& response) {
+        m_decoders.post([this, count, callback, response = std::move(response)] {
+            callback(parseBatchResponse(response, count));
+        });
+    });
+}
+
+void SegmentationClient::setTimeouts(long connect_timeout_ms, long low_speed_bytes, long low_speed_seconds) {
+    m_timeouts.connect_ms = connect_timeout_ms;
+    m_timeouts.low_speed_bytes = low_speed_bytes;
+    m_timeouts.low_speed_seconds = low_speed_seconds;
+}
+
+SegmentationClient::DropCounters SegmentationClient::dropCounters() const {
+    DropCounters counters;
+    counters.beforeEncoding = m_droppedBeforeEncoding;
+    counters.beforeSending = m_droppedBeforeSending;
+    counters.inFlight = m_droppedInFlight;
+    counters.overLimit = m_droppedOverLimit;
+    counters.rateLimited = m_droppedRateLimited;
+    return counters;
+}
+
+void SegmentationClient::enableHttp2(long max_streams) {
+    m_httpVersion = HttpVersion::Http2;
+    m_engine.setMaxStreamsPerConnection(max_streams);
+}
+
+void SegmentationClient::setResponseFormat(ResponseFormat format) {
+    m_responseFormat = format;
+}
+
+void SegmentationClient::setUploadEncoders(std::vector<std::unique_ptr<UploadEncoder>> encoders,
+                                           size_t explore_interval) {
+    if (encoders.empty()) {
+        return;
+    }
+    m_codecs.reset(new UploadCodecTuner(std::move(encoders), explore_interval));
+}
+
+std::string SegmentationClient::uploadCodecSummary() const {
+    return m_codecs->summary();
+}
+
+void SegmentationClient::setUnixSocketPath(const std::string& path) {
+    m_unixSocketPath = path;
+}
+
+void SegmentationClient::addEndpoint(const std::string& url, double weight) {
+    m_endpoints.addEndpoint(url, weight);
+}
+
+void SegmentationClient::enableHedging(double quantile) {
+    m_hedgeQuantile = std::min(std::max(quantile, 0.0), 1.0);
+}
+
+std::string SegmentationClient::endpointSummary() const {
+    std::ostringstream out;
+    out << m_endpoints.summary() << "\nHedged " << m_hedgesSent << " requests, "
+        << m_hedgesWon << " answered first by the duplicate";
+    return out.str();
+}
+
+void SegmentationClient::enableAdaptiveConcurrency(size_t min_limit, size_t max_limit) {
+    if (max_limit == 0) {
+        max_limit = m_engine.maxInFlight();
+    }
+    // Start low and let the latency show how far the server goes
+    m_endpoints.enableAdaptiveConcurrency(std::min<size_t>(4, max_limit), min_limit, max_limit);
+}
+
+std::vector<EndpointPool::ConcurrencyStats> SegmentationClient::concurrencyStats() const {
+    return m_endpoints.concurrencyStats();
+}
+
+void SegmentationClient::setUploadScale(double scale) {
+    m_uploadScale = std::min(std::max(scale, 0.05), 1.0);
+}
+
+void SegmentationClient::enableDeltaUploads(int tile_size, size_t keyframe_interval, int change_threshold) {
+    m_deltas.reset(new tile_delta::TileDeltaEncoder(tile_size, keyframe_interval, change_threshold));
+}
+
+std::string SegmentationClient::deltaUploadSummary() const {
+    if (!m_deltas) {
+        return "Delta uploads disabled";
+    }
+    return m_deltas->summary();
+}
+
+void SegmentationClient::enableResultCache(int max_distance, std::chrono::milliseconds ttl, size_t capacity) {
+    m_resultCache.reset(new MaskResultCache(max_distance, ttl, capacity));
+}
+
+std::string SegmentationClient::resultCacheSummary() const {
+    if (!m_resultCache) {
+        return "Result cache disabled";
+    }
+    return m_resultCache->summary();
+}
+
+std::string SegmentationClient::transferCodingSummary() const {
+    return m_coding.summary();
+}
+
+void SegmentationClient::setRateLimits(double requests_per_second, double upload_bytes_per_second) {
+    m_rateLimiter.setLimits(requests_per_second, upload_bytes_per_second);
+}
+
+void SegmentationClient::setGlobalRateLimits(double requests_per_second, double upload_bytes_per_second) {
+    RateLimiter::global().setLimits(requests_per_second, upload_bytes_per_second);
+}
+
+RateLimiter::Stats SegmentationClient::trafficStats() const {
+    return m_rateLimiter.stats();
+}
+
+std::string SegmentationClient::trafficSummary() const {
+    return m_rateLimiter.summary() + "\n" + RateLimiter::global().summary();
+}
+
+SegmentationClient::WarmUpReport SegmentationClient::warmUp(cv::Size frame_size, std::chrono::milliseconds timeout) {
+    WarmUpReport report;
+    auto start = std::chrono::steady_clock::now();
+    Deadline deadline = start + timeout;
+    
+    // Textured rather than blank, so the server runs its whole pipeline
+    cv::Mat frame(frame_size, CV_8UC1);
+    for (int y = 0; y < frame.rows; y++) {
+        uchar* row = frame.ptr<uchar>(y);
+        for (int x = 0; x < frame.cols; x++) {
+            row[x] = static_cast<uchar>((x * 7 + y * 13) ^ (x * y));
+        }
+    }
+    
+    if (isStreaming()) {
+        auto answered = std::make_shared<std::promise<bool>>();
+        std::future<bool> answer = answered->get_future();
+        if (m_localStream) {
+            ShmSession::Slot slot;
+            cv::Size size = uploadSize(frame);
+            if (m_localStream->acquireSlot(slot, deadline)) {
+                if (static_cast<size_t>(size.area()) > slot.capacity) {
+                    m_localStream->releaseSlot(slot);
+                } else {
+                    cv::Mat upload(size, CV_8UC1, slot.frame);
+                    convertForUpload(frame, upload);
+                    report.streamSequence = m_localStream->submit(slot, size.width, size.height, 0,
+                        [answered](const ShmResult& result) {
+                            answered->set_value(result.error.empty());
+                        });
+                }
+            }
+        } else {
+            EncodedFrame encoded = encodeFrame(frame);
+            report.streamSequence = encoded.data.empty() ? 0 : m_stream->sendFrame(encoded.data.data(), encoded.data.size(), 0,
+                [answered](StreamMessage&& message) {
+                    answered->set_value(message.type == StreamMessageType::Result);
+                }, deadline);
+        }
+        if (report.streamSequence != 0 && answer.wait_until(deadline) == std::future_status::ready &&
+            answer.get()) {
+            report.endpoints = 1;
+        }
+    } else {
+        // Every endpoint at once, bypassing the pool: a cold start's latency
+        // must not count against the endpoint
+        std::vector<std::string> urls;
+        std::vector<std::future<HttpResponse>> answers;
+        for (size_t i = 0; i < m_endpoints.size(); i++) {
+            HttpRequest request = buildRequest({frame}, deadline);
+            if (request.parts.empty()) {
+                break;
+            }
+            request.url = m_endpoints.url(i);
+            // Loading a model sends nothing for a while
+            request.timeouts.low_speed_bytes = 0;
+            m_coding.prepare(request);
+            urls.push_back(request.url);
+            answers.push_back(m_engine.submit(std::move(request)));
+        }
+        for (size_t i = 0; i < answers.size(); i++) {
+            HttpResponse response = answers[i].get();
+            m_coding.record(urls[i], response);
+            m_rateLimiter.record(response.upload_bytes, response.download_bytes);
+            if (succeeded(response)) {
+                m_codecs->recordUpload(originOf(urls[i]), response.upload_bytes, response.upload_seconds);
+                report.endpoints++;
+            } else {
+                std::cerr << "Warm-up of " << urls[i] << " failed: "
+                          << (response.error.empty() ? "HTTP " + std::to_string(response.status_code) : response.error)
+                          << std::endl;
+            }
+        }
+    }
+    
+    report.ready = report.endpoints > 0;
+    report.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+bool SegmentationClient::openStream(const std::string& host, int port, size_t max_in_flight) {
+    closeStream();
+    m_stream.reset(new StreamingSession(max_in_flight));
+    if (!m_stream->connect(host, port)) {
+        m_stream.reset();
+        return false;
+    }
+    return true;
+}
+
+bool SegmentationClient::openLocalStream(const std::string& socket_path, size_t slots) {
+    closeStream();
+    m_localStream.reset(new ShmSession(slots));
+    if (!m_localStream->connect(socket_path)) {
+        m_localStream.reset();
+        return false;
+    }
+    return true;
+}
+
+void SegmentationClient::closeStream() {
+    m_stream.reset();
+    m_localStream.reset();
+}
+
+bool SegmentationClient::isStreaming() const {
+    return (m_stream && m_stream->isConnected()) || (m_localStream && m_localStream->isConnected());
+}
+
+uint32_t SegmentationClient::streamFrame(const cv::Mat& image, uint64_t timestamp_us, StreamCallback callback,
+                                         Deadline deadline) {
+    if (!isStreaming() || expired(deadline, 1) || rateLimited(1)) {
+        return 0;
+    }
+    
+    if (m_localStream) {
+        ShmSession::Slot slot;
+        if (!m_localStream->acquireSlot(slot, deadline)) {
+            countUnsent(deadline);
+            return 0;
+        }
+        
+        // Convert and scale straight into shared memory, no encoding
+        cv::Size size = uploadSize(image);
+        if (static_cast<size_t>(size.area()) > slot.capacity) {
+            std::cerr << "Frame too large for the local transport" << std::endl;
+            m_localStream->releaseSlot(slot);
+            return 0;
+        }
+        cv::Mat frame(size, CV_8UC1, slot.frame);
+        convertForUpload(image, frame);
+        
+        uint32_t sequence = m_localStream->submit(slot, size.width, size.height, timestamp_us,
+            [this, callback, size](const ShmResult& result) {
+                m_rateLimiter.record(size.area(), result.size);
+                if (result.expired) {
+                    m_droppedInFlight++;
+                    callback(result.sequence, cv::Mat());
+                    return;
+                }
+                if (!result.error.empty()) {
+                    std::cerr << "Local frame " << result.sequence << " failed: " << result.error << std::endl;
+                    callback(result.sequence, cv::Mat());
+                    return;
+                }
+                callback(result.sequence, decodeBinaryMask(result.data, result.size));
+            }, deadline);
+        if (sequence != 0) {
+            m_rateLimiter.charge(size.area());
+        }
+        return sequence;
+    }
+    
+    EncodedFrame encoded = encodeFrame(image);
+    if (encoded.data.empty()) {
+        return 0;
+    }
+    size_t sent = encoded.data.size();
+    uint32_t sequence = m_stream->sendFrame(encoded.data.data(), encoded.data.size(), timestamp_us,
+        [this, callback, sent](StreamMessage&& message) {
+            m_rateLimiter.record(sent, message.expired ? 0 : message.payload.size());
+            if (message.expired) {
+                m_droppedInFlight++;
+                callback(message.sequence, cv::Mat());
+                return;
+            }
+            if (message.type != StreamMessageType::Result) {
+                std::cerr << "Stream frame " << message.sequence << " failed: "
+                          << std::string(message.payload.begin(), message.payload.end()) << std::endl;
+                callback(message.sequence, cv::Mat());
+                return;
+            }
+            callback(message.sequence, decodeBinaryMask(message.payload.data(), message.payload.size()));
+        }, deadline);
+    if (sequence == 0) {
+        countUnsent(deadline);
+        return 0;
+    }
+    m_rateLimiter.charge(sent);
+    return sequence;
+}
+
+HttpResponse SegmentationClient::send(HttpRequest request) {
+    if (m_hedgeQuantile > 0.0) {
+        // Hedging needs the engine's timers and cancellation
+        auto promise = std::make_shared<std::promise<HttpResponse>>();
+        std::future<HttpResponse> future = promise->get_future();
+        dispatch(std::move(request), [promise](HttpResponse&& response) {
+            promise->set_value(std::move(response));
+        });
+        return future.get();
+    }
+    
+    size_t endpoint = m_endpoints.acquire();
+    if (endpoint == EndpointPool::npos) {
+        m_droppedOverLimit++;
+        HttpResponse response;
+        response.error = "Concurrency limit reached";
+        return response;
+    }
+    request.url = m_endpoints.url(endpoint);
+    m_coding.prepare(request);
+    m_rateLimiter.charge(requestBytes(request));
+    
+    // Send over a pooled keep-alive session
+    HttpResponse response;
+    {
+        auto session = m_sessions.acquire();
+        response = session->post(request);
+    }
+    
+    releaseEndpoint(endpoint, response);
+    return response;
+}
+
+void SegmentationClient::dispatch(HttpRequest request, AsyncRequestEngine::Callback callback) {
+    auto call = std::make_shared<HedgedCall>();
+    call->callback = std::move(callback);
+    
+    bool hedged = m_hedgeQuantile > 0.0 && m_endpoints.size() > 1;
+    if (hedged) {
+        call->request = request;
+    }
+    
+    if (!startAttempt(call, std::move(request), EndpointPool::npos)) {
+        m_droppedOverLimit++;
+        HttpResponse response;
+        response.error = "Concurrency limit reached";
+        call->callback(std::move(response));
+        return;
+    }
+    
+    // No hedge until the endpoint has a latency profile
+    double delayMs = hedged ? m_endpoints.latencyQuantile(call->attempts[0].endpoint, m_hedgeQuantile) : 0.0;
+    if (delayMs > 0.0) {
+        // The duplicate is re-encoded for its endpoint, which is no work
+        // for the I/O thread the timer fires on
+        m_engine.schedule(std::chrono::milliseconds(static_cast<long>(std::ceil(delayMs))),
+                          [this, call] { m_decoders.post([this, call] { hedge(call); }); });
+    }
+}
+
+bool SegmentationClient::startAttempt(const std::shared_ptr<HedgedCall>& call, HttpRequest request,
+                                      size_t exclude) {
+    size_t endpoint = m_endpoints.acquire(exclude);
+    if (endpoint == EndpointPool::npos) {
+        return false;
+    }
+    request.url = m_endpoints.url(endpoint);
+    m_coding.prepare(request);
+    
+    // Every copy that goes out uses upload budget, hedges included
+    m_rateLimiter.charge(requestBytes(request));
+    
+    size_t attempt = 0;
+    {
+        std::lock_guard<std::mutex> lock(call->mutex);
+        attempt = call->attempts.size();
+        call->attempts.push_back({endpoint, 0, false, false});
+    }
+    
+    // Not under the lock: the callback may run before submit() returns
+    AsyncRequestEngine::RequestId id = m_engine.submit(std::move(request),
+        [this, call, attempt](HttpResponse&& response) {
+            finishAttempt(call, attempt, std::move(response));
+        });
+    
+    bool cancel = false;
+    {
+        std::lock_guard<std::mutex> lock(call->mutex);
+        HedgedCall::Attempt& current = call->attempts[attempt];
+        current.id = id;
+        cancel = current.cancelPending && !current.done;
+    }
+    
+    // The other copy won while this one was being submitted
+    if (cancel) {
+        m_engine.cancel(id);
+    }
+    return true;
 }
 
-cv::Mat SegmentationClient::segmentImage(const cv::Mat& image) {
+void SegmentationClient::finishAttempt(const std::shared_ptr<HedgedCall>& call, size_t attempt,
+                                       HttpResponse&& response) {
+    bool ok = succeeded(response);
+    size_t endpoint = 0;
+    std::vector<AsyncRequestEngine::RequestId> losers;
+    AsyncRequestEngine::Callback callback;
+    {
+        std::lock_guard<std::mutex> lock(call->mutex);
+        HedgedCall::Attempt& current = call->attempts[attempt];
+        current.done = true;
+        endpoint = current.endpoint;
+        
+        // The other copy already answered
+        if (call->settled) {
+            m_rateLimiter.record(response.upload_bytes, response.download_bytes);
+            m_endpoints.cancel(endpoint);
+            return;
+        }
+        
+        // A failed copy leaves the answer to the one still running
+        bool othersRunning = false;
+        for (const HedgedCall::Attempt& other : call->attempts) {
+            othersRunning = othersRunning || !other.done;
+        }
+        if (!ok && othersRunning) {
+            releaseEndpoint(endpoint, response);
+            return;
+        }
+        
+        call->settled = true;
+        for (HedgedCall::Attempt& other : call->attempts) {
+            if (other.done) {
+                continue;
+            }
+            if (other.id == 0) {
+                // Still in submit(); startAttempt cancels it once it has an id
+                other.cancelPending = true;
+            } else {
+                losers.push_back(other.id);
+            }
+        }
+        call->request = HttpRequest();
+        callback = std::move(call->callback);
+    }
+    
+    releaseEndpoint(endpoint, response);
+    if (attempt > 0 && ok) {
+        m_hedgesWon++;
+    }
+    for (AsyncRequestEngine::RequestId id : losers) {
+        m_engine.cancel(id);
+    }
+    
+    callback(std::move(response));
+}
+
+void SegmentationClient::hedge(const std::shared_ptr<HedgedCall>& call) {
+    // Runs on a decode worker once the first copy is overdue
+    HttpRequest request;
+    size_t exclude = 0;
+    {
+        std::lock_guard<std::mutex> lock(call->mutex);
+        if (call->settled || call->attempts.size() != 1) {
+            return;
+        }
+        request = std::move(call->request);
+        exclude = call->attempts[0].endpoint;
+    }
+    
+    // With requests already queued a duplicate only adds to the backlog
+    if (m_engine.queued() > 0) {
+        return;
+    }
+    
+    if (startAttempt(call, std::move(request), exclude)) {
+        m_hedgesSent++;
+    }
+}
+
+void SegmentationClient::releaseEndpoint(size_t endpoint, const HttpResponse& response) {
+    m_rateLimiter.record(response.upload_bytes, response.download_bytes);
+    m_coding.record(m_endpoints.url(endpoint), response);
+    
+    // Every finished upload refines the tuner's throughput estimate for
+    // that server
+    if (response.error.empty()) {
+        m_codecs->recordUpload(originOf(m_endpoints.url(endpoint)), response.upload_bytes,
+                               response.upload_seconds);
+    }
+    
+    // Running into the frame's deadline says nothing about the endpoint
+    if (response.expired != DeadlineExpiry::None) {
+        m_endpoints.cancel(endpoint);
+        return;
+    }
+    m_endpoints.release(endpoint, response.total_seconds * 1000.0, succeeded(response));
+}
+
+bool SegmentationClient::rateLimited(size_t frames) {
+    if (m_rateLimiter.admit()) {
+        return false;
+    }
+    m_droppedRateLimited += frames;
+    return true;
+}
+
+void SegmentationClient::countUnsent(Deadline deadline) {
+    // Waited for the stream's window or a ring slot until the deadline
+    if (deadline.time_since_epoch().count() != 0 && std::chrono::steady_clock::now() >= deadline) {
+        m_droppedBeforeSending++;
+    }
+}
+
+bool SegmentationClient::expired(Deadline deadline, size_t frames) {
+    if (deadline.time_since_epoch().count() == 0 || std::chrono::steady_clock::now() < deadline) {
+        return false;
+    }
+    m_droppedBeforeEncoding += frames;
+    return true;
+}
+
+cv::Size SegmentationClient::uploadSize(const cv::Mat& image) const {
+    if (m_uploadScale >= 1.0) {
+        return image.size();
+    }
+    return cv::Size(std::max(1L, std::lround(image.cols * m_uploadScale)),
+                    std::max(1L, std::lround(image.rows * m_uploadScale)));
+}
+
+void SegmentationClient::convertForUpload(const cv::Mat& image, cv::Mat& out) {
+    // out may already be allocated at uploadSize(image), e.g. over shared
+    // memory; OpenCV then writes into it in place
+    if (m_uploadScale >= 1.0) {
+        if (image.channels() > 1) {
+            cv::cvtColor(image, out, cv::COLOR_BGR2GRAY);
+        } else if (out.empty()) {
+            out = image;
+        } else {
+            image.copyTo(out);
+        }
+        return;
+    }
+    
     // Make sure image is grayscale
     cv::Mat grayImage;
     if (image.channels() > 1) {
         cv::cvtColor(image, grayImage, cv::COLOR_BGR2GRAY);
     } else {
-        grayImage = image.clone();
+        grayImage = image;
     }
     
-    // Encode the image to PNG
-    std::vector<uchar> imageBuffer = encodeImageToPNG(grayImage);
+    // Reduced-resolution upload: area averaging keeps thin structures visible
+    cv::resize(grayImage, out, uploadSize(image), 0, 0, cv::INTER_AREA);
+}
+
+SegmentationClient::EncodedFrame SegmentationClient::encodeFrame(const cv::Mat& image) {
+    cv::Mat grayImage;
+    convertForUpload(image, grayImage);
+    
+    // Encode with the encoder the tuner currently expects to be fastest.
+    // With several servers the one it goes to is only picked later.
+    std::string origin = m_endpoints.size() == 1 ? originOf(m_endpoints.url(0)) : std::string();
+    EncodedFrame encoded;
+    for (size_t attempt = 0; attempt < m_codecs->encoderCount(); attempt++) {
+        size_t codec = m_codecs->choose(origin);
+        UploadEncoder& encoder = m_codecs->encoder(codec);
+        
+        auto start = std::chrono::steady_clock::now();
+        if (encoder.encode(grayImage, encoded.data)) {
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            m_codecs->recordEncode(codec, elapsed.count(), encoded.data.size());
+            encoded.contentType = encoder.contentType();
+            encoded.filename = encoder.filename();
+            return encoded;
+        }
+        
+        std::cerr << "Failed to encode frame as " << encoder.name() << std::endl;
+        m_codecs->recordFailure(codec);
+    }
     
-    // Create a temporary file
-    std::string tempFilename = "temp_image.png";
-    std::ofstream outFile(tempFilename, std::ios::binary);
-    outFile.write(reinterpret_cast<const char*>(imageBuffer.data()), imageBuffer.size());
-    outFile.close();
+    encoded.data.clear();
+    return encoded;
+}
+
+bool SegmentationClient::lookupResult(const cv::Mat& image, uint64_t& key, cv::Mat& mask) {
+    if (!m_resultCache) {
+        return false;
+    }
     
-    // Send the image to the server using HTTP client
-    cpr::Response response;
+    key = MaskResultCache::hash(image);
+    cv::Mat cached;
+    if (!m_resultCache->lookup(key, image.size(), cached)) {
+        return false;
+    }
     
-    try {
-        cpr::Multipart multipart{{"image", cpr::File{tempFilename}}};
-        response = cpr::Post(cpr::Url{m_serverUrl}, multipart);
+    // Callers may draw into their mask, the cache's copy stays untouched
+    mask = copyMask(cached);
+    return true;
+}
+
+void SegmentationClient::storeResult(uint64_t key, cv::Size frame_size, const HttpResponse& response,
+                                     const cv::Mat& mask) {
+    // Failed requests say nothing about the frame; an empty room does
+    if (!m_resultCache || !succeeded(response)) {
+        return;
     }
-    catch (const std::exception& e) {
-        std::cerr << "HTTP Error: " << e.what() << std::endl;
-        std::remove(tempFilename.c_str());
+    m_resultCache->store(key, frame_size, copyMask(mask), response.total_seconds * 1000.0);
+}
+
+cv::Mat SegmentationClient::copyMask(const cv::Mat& mask) {
+    if (mask.empty()) {
         return cv::Mat();
     }
+    cv::Mat copy = m_maskPool.create(mask.rows, mask.cols, mask.type());
+    mask.copyTo(copy);
+    return copy;
+}
+
+bool SegmentationClient::encodeDelta(const cv::Mat& image, EncodedFrame& encoded, uint32_t& frame_id) {
+    cv::Mat grayImage;
+    convertForUpload(image, grayImage);
+    if (grayImage.type() != CV_8UC1) {
+        return false;
+    }
+    
+    frame_id = m_deltas->encode(grayImage.data, grayImage.cols, grayImage.rows, grayImage.step, encoded.data);
+    encoded.contentType = tile_delta::kContentType;
+    encoded.filename = "frame.tdelta";
+    return true;
+}
+
+void SegmentationClient::finishDelta(uint32_t frame_id, const HttpResponse& response) {
+    if (frame_id == 0) {
+        return;
+    }
+    
+    // Only a frame the server answered can be the next reference. A server
+    // that lost the reference gets a keyframe next; this frame is dropped.
+    if (succeeded(response)) {
+        m_deltas->acknowledge(frame_id);
+    } else {
+        m_deltas->reject(frame_id, response.status_code == tile_delta::kMissingBaseStatus);
+    }
+}
+
+HttpRequest SegmentationClient::buildRequest(const std::vector<cv::Mat>& images, Deadline deadline,
+                                             uint32_t* delta_frame) {
+    // The URL is filled in by whichever endpoint the request goes to
+    HttpRequest request;
+    request.http_version = m_httpVersion;
+    request.unix_socket_path = m_unixSocketPath;
+    request.timeouts = m_timeouts;
+    request.deadline = deadline;
     
-    // Clean up temporary file
-    std::remove(tempFilename.c_str());
+    // JSON answers are scanned and their masks base64-decoded while they
+    // arrive, instead of being collected and parsed afterwards. Sinks are
+    // recycled along with their decode buffers.
+    JsonMaskSinkPool sinks = m_sinks;
+    request.make_sink = [sinks] { return sinks.acquire(); };
+    
+    // A single frame to a single server can go up as a tile delta
+    bool delta = false;
+    if (delta_frame && m_deltas && images.size() == 1 && m_endpoints.size() == 1) {
+        EncodedFrame encoded;
+        delta = encodeDelta(images[0], encoded, *delta_frame);
+        if (delta) {
+            request.parts.push_back({"image", encoded.filename, encoded.contentType, std::move(encoded.data)});
+        }
+    }
+    
+    // One "image" part per frame, in order. Upload straight from the
+    // encoded buffers, nothing touches the disk.
+    for (size_t i = 0; i < images.size() && !delta; i++) {
+        EncodedFrame encoded = encodeFrame(images[i]);
+        if (encoded.data.empty()) {
+            // No encoder managed; callers fail the frames instead of
+            // uploading empty parts
+            request.parts.clear();
+            return request;
+        }
+        if (images.size() > 1) {
+            // image_<i> plus the encoder's extension, if it has one
+            std::string suffix = "_" + std::to_string(i);
+            size_t dot = encoded.filename.find('.');
+            if (dot == std::string::npos) {
+                encoded.filename += suffix;
+            } else {
+                encoded.filename.insert(dot, suffix);
+            }
+        }
+        request.parts.push_back({"image", encoded.filename, encoded.contentType, std::move(encoded.data)});
+    }
+    
+    if (m_responseFormat == ResponseFormat::BinaryMasks) {
+        request.headers.push_back(std::string("Accept: ") + mask_codec::kContentType +
+                                  ", application/json;q=0.5");
+    }
+    return request;
+}
+
+bool SegmentationClient::checkResponse(const HttpResponse& response, size_t frames) {
+    // Expected under overload; counted, not logged
+    if (response.expired == DeadlineExpiry::BeforeSending) {
+        m_droppedBeforeSending += frames;
+        return false;
+    }
+    if (response.expired == DeadlineExpiry::InFlight) {
+        m_droppedInFlight += frames;
+        return false;
+    }
     
-    // Check response status
-    #ifdef USE_MINIMAL_HTTP_CLIENT
     if (response.status_code != 200 || !response.error.empty()) {
         std::cerr << "HTTP Error: " << response.status_code << std::endl;
         if (!response.error.empty()) {
             std::cerr << "Error message: " << response.error << std::endl;
+        } else {
+            std::cerr << "Error message: " << response.text << std::endl;
         }
-        return cv::Mat();
+        return false;
     }
-    #else
-    if (response.status_code != 200) {
-        std::cerr << "HTTP Error: " << response.status_code << std::endl;
-        std::cerr << "Error message: " << response.text << std::endl;
+    return true;
+}
+
+cv::Mat SegmentationClient::parseResponse(const HttpResponse& response) {
+    // Check response status
+    if (!checkResponse(response, 1)) {
         return cv::Mat();
     }
-    #endif
+    
+    // Binary masks skip the JSON, base64 and PNG layers entirely
+    if (response.content_type.compare(0, std::strlen(mask_codec::kContentType),
+                                      mask_codec::kContentType) == 0) {
+        return decodeBinaryMask(reinterpret_cast<const uint8_t*>(response.text.data()),
+                                response.text.size());
+    }
+    
+    // Already decoded by the streaming scanner
+    if (response.sink) {
+        return decodeScannedMask(static_cast<const JsonMaskSink&>(*response.sink).scanner(), 0);
+    }
+    
     // After getting the HTTP response, print the raw response text
     std::cout << "Server response: " << response.text.substr(0, 100) << "..." << std::endl;
 
@@ -71,39 +941,72 @@ cv::Mat SegmentationClient::segmentImage(const cv::Mat& image) {
     return decodeBase64Mask(base64Mask);
 }
 
-std::future<cv::Mat> SegmentationClient::segmentImageAsync(const cv::Mat& image) {
-    // Create a promise to deliver the result
-    std::shared_ptr<std::promise<cv::Mat>> resultPromise = 
-        std::make_shared<std::promise<cv::Mat>>();
+std::vector<cv::Mat> SegmentationClient::parseBatchResponse(const HttpResponse& response, size_t count) {
+    std::vector<cv::Mat> masks(count);
+    if (!checkResponse(response, count)) {
+        return masks;
+    }
     
-    // Get a future from the promise
-    std::future<cv::Mat> resultFuture = resultPromise->get_future();
+    // Binary: one mask set per frame, back to back
+    if (response.content_type.compare(0, std::strlen(mask_codec::kContentType),
+                                      mask_codec::kContentType) == 0) {
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(response.text.data());
+        size_t size = response.text.size();
+        size_t offset = 0;
+        mask_codec::MaskSetReader reader;
+        for (size_t i = 0; i < count; i++) {
+            if (!reader.parse(data + offset, size - offset)) {
+                std::cerr << "Error parsing binary mask set " << i << ": " << reader.error() << std::endl;
+                break;
+            }
+            masks[i] = decodeFirstInstance(reader);
+            offset += reader.byteSize();
+        }
+        return masks;
+    }
     
-    // Create a copy of the image for the async task
-    cv::Mat imageCopy = image.clone();
+    // JSON: {"results": [{"masks": [...]}, ...]}, or a plain single-frame
+    // answer when only one frame was sent
+    if (response.sink) {
+        const JsonMaskScanner& scanner = static_cast<const JsonMaskSink&>(*response.sink).scanner();
+        if (scanner.complete() && scanner.resultCount() != count) {
+            std::cerr << "Batch response has " << scanner.resultCount() << " results for "
+                      << count << " frames" << std::endl;
+        }
+        for (size_t i = 0; i < count; i++) {
+            masks[i] = decodeScannedMask(scanner, i);
+        }
+        return masks;
+    }
     
-    // Launch the async task
-    std::thread([this, imageCopy, resultPromise]() mutable {
-        try {
-            // Process the image synchronously within this thread
-            cv::Mat result = this->segmentImage(imageCopy);
-            
-            // Set the promise value with the result
-            resultPromise->set_value(result);
-        } catch (const std::exception& e) {
-            // Set the promise exception
-            resultPromise->set_exception(std::current_exception());
+    try {
+        nlohmann::json responseJson = nlohmann::json::parse(response.text);
+        
+        if (!responseJson.contains("results")) {
+            if (count == 1) {
+                masks[0] = decodeBase64Mask(extractBase64MaskFromJson(response.text));
+            } else {
+                std::cerr << "Server did not answer the batch request with per-frame results" << std::endl;
+            }
+            return masks;
+        }
+        
+        const nlohmann::json& results = responseJson["results"];
+        if (!results.is_array() || results.size() != count) {
+            std::cerr << "Batch response has " << results.size() << " results for "
+                      << count << " frames" << std::endl;
         }
-    }).detach();
+        for (size_t i = 0; i < count && i < results.size(); i++) {
+            const nlohmann::json& result = results[i];
+            if (result.contains("masks") && result["masks"].is_array() && !result["masks"].empty()) {
+                masks[i] = decodeBase64Mask(result["masks"][0].get<std::string>());
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error parsing batch JSON response: " << e.what() << std::endl;
+    }
     
-    return resultFuture;
-}
-
-std::vector<uchar> SegmentationClient::encodeImageToPNG(const cv::Mat& image) {
-    std::vector<uchar> buffer;
-    std::vector<int> params = {cv::IMWRITE_PNG_COMPRESSION, 9}; // Maximum compression
-    cv::imencode(".png", image, buffer, params);
-    return buffer;
+    return masks;
 }
 
 std::string SegmentationClient::extractBase64MaskFromJson(const std::string& jsonResponse) {
@@ -123,53 +1026,70 @@ std::string SegmentationClient::extractBase64MaskFromJson(const std::string& jso
     return "";
 }
 
-cv::Mat SegmentationClient::decodeBase64Mask(const std::string& base64Mask) {
-    if (base64Mask.empty()) {
+cv::Mat SegmentationClient::decodeBinaryMask(const uint8_t* data, size_t size) {
+    mask_codec::MaskSetReader reader;
+    if (!reader.parse(data, size)) {
+        std::cerr << "Error parsing binary mask response: " << reader.error() << std::endl;
         return cv::Mat();
     }
     
-    // Base64 decode
-    std::string decoded;
-    decoded.resize(base64Mask.size() * 3 / 4); // Approximate size
+    return decodeFirstInstance(reader);
+}
+
+cv::Mat SegmentationClient::decodeFirstInstance(const mask_codec::MaskSetReader& reader) {
+    // Same contract as the JSON path: the first mask, if any
+    if (reader.instanceCount() == 0) {
+        return cv::Mat();
+    }
     
-    // Create Base64 decoding table
-    std::vector<unsigned char> decodingTable(256, -1);
-    for (int i = 0; i < 64; i++) {
-        unsigned char c = 0;
-        if (i < 26) c = 'A' + i;
-        else if (i < 52) c = 'a' + (i - 26);
-        else if (i < 62) c = '0' + (i - 52);
-        else if (i == 62) c = '+';
-        else c = '/';
-        
-        decodingTable[c] = i;
+    cv::Mat mask = m_maskPool.create(reader.height(), reader.width(), CV_8UC1);
+    if (!reader.decodeInstance(0, mask.data, mask.step)) {
+        std::cerr << "Error decoding binary mask: " << reader.error() << std::endl;
+        return cv::Mat();
+    }
+    return mask;
+}
+
+cv::Mat SegmentationClient::decodeScannedMask(const JsonMaskScanner& scanner, size_t result) {
+    if (!scanner.complete()) {
+        std::cerr << "Error parsing JSON response: "
+                  << (scanner.error().empty() ? "truncated" : scanner.error()) << std::endl;
+        return cv::Mat();
     }
     
-    int padding = 0;
-    if (base64Mask.length() > 0 && base64Mask[base64Mask.length() - 1] == '=') padding++;
-    if (base64Mask.length() > 1 && base64Mask[base64Mask.length() - 2] == '=') padding++;
+    const JsonMaskScanner::Mask* mask = scanner.firstMask(result);
+    if (!mask || mask->size == 0) {
+        return cv::Mat();
+    }
     
-    std::vector<uchar> data;
-    for (size_t i = 0; i < base64Mask.length(); i += 4) {
-        // Get values for each group of four characters
-        unsigned char v1 = (i+0 < base64Mask.length() && base64Mask[i+0] != '=') ? decodingTable[base64Mask[i+0]] : 0;
-        unsigned char v2 = (i+1 < base64Mask.length() && base64Mask[i+1] != '=') ? decodingTable[base64Mask[i+1]] : 0;
-        unsigned char v3 = (i+2 < base64Mask.length() && base64Mask[i+2] != '=') ? decodingTable[base64Mask[i+2]] : 0;
-        unsigned char v4 = (i+3 < base64Mask.length() && base64Mask[i+3] != '=') ? decodingTable[base64Mask[i+3]] : 0;
-        
-        // Write the first byte
-        data.push_back((v1 << 2) | (v2 >> 4));
-        
-        // Write the second byte if there is enough data
-        if (i+2 < base64Mask.length() && base64Mask[i+2] != '=')
-            data.push_back(((v2 & 0x0F) << 4) | (v3 >> 2));
-        
-        // Write the third byte if there is enough data
-        if (i+3 < base64Mask.length() && base64Mask[i+3] != '=')
-            data.push_back(((v3 & 0x03) << 6) | v4);
+    // Decode the PNG in place, straight from the scanner's buffer, into a
+    // recycled one
+    cv::Mat encoded(1, static_cast<int>(mask->size), CV_8UC1, const_cast<uint8_t*>(scanner.data(*mask)));
+    cv::Mat decoded;
+    m_maskPool.attach(decoded);
+    cv::imdecode(encoded, cv::IMREAD_UNCHANGED, &decoded);
+    return decoded;
+}
+
+cv::Mat SegmentationClient::decodeBase64Mask(const std::string& base64Mask) {
+    if (base64Mask.empty()) {
+        return cv::Mat();
     }
     
-    // Decode the binary data to a Mat object
-    return cv::imdecode(data, cv::IMREAD_UNCHANGED);
+    // Decode into a per-thread buffer that only ever grows, validating
+    // every symbol
+    thread_local std::vector<uchar> data;
+    data.resize(std::max(data.size(), base64::decodedSizeBound(base64Mask.size())));
+    size_t written = 0;
+    if (!base64::decode(base64Mask.data(), base64Mask.size(), data.data(), written)) {
+        std::cerr << "Error: Invalid base64 in mask" << std::endl;
+        return cv::Mat();
+    }
     
+    // Decode the binary data to a Mat object in a recycled buffer
+    cv::Mat encoded(1, static_cast<int>(written), CV_8UC1, data.data());
+    cv::Mat decoded;
+    m_maskPool.attach(decoded);
+    cv::imdecode(encoded, cv::IMREAD_UNCHANGED, &decoded);
+    return decoded;
 }
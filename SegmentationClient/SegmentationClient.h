@@ -1,7 +1,11 @@
 #pragma once
 
 #include <opencv2/opencv.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <future>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -14,28 +18,311 @@
     #error "nlohmann/json.hpp not found"
 #endif
 
-// Include the appropriate HTTP client
-#ifdef USE_MINIMAL_HTTP_CLIENT
-    #include "minimal_http_client.h"
-#else
-    #include <cpr/cpr.h>
-#endif
+#include "AsyncRequestEngine.h"
+#include "ContentCoding.h"
+#include "EndpointPool.h"
+#include "HttpSession.h"
+#include "JsonMaskScanner.h"
+#include "MaskBufferPool.h"
+#include "MaskCodec.h"
+#include "MaskResultCache.h"
+#include "RateLimiter.h"
+#include "ShmTransport.h"
+#include "StreamingSession.h"
+#include "TileDelta.h"
+#include "UploadCodec.h"
+#include "WorkerPool.h"
+
+// Mask encoding requested from the server
+enum class ResponseFormat {
+    Json,        // {"masks": [<base64 PNG>, ...]}
+    BinaryMasks  // compact run-length masks (see MaskCodec.h), JSON as fallback
+};
 
 class SegmentationClient {
 public:
-    SegmentationClient(const std::string& server_url = "http://192.248.10.70:8000/segment");
+    // Point in time after which a frame's mask is no longer wanted. The
+    // default (epoch) means no deadline.
+    using Deadline = std::chrono::steady_clock::time_point;
+    
+    // Frames given up on because their deadline passed, by stage
+    struct DropCounters {
+        size_t beforeEncoding = 0;  // expired before the request was built
+        size_t beforeSending = 0;   // expired while queued for a connection
+        size_t inFlight = 0;        // transfer aborted on the wire
+        size_t overLimit = 0;       // requests shed, every endpoint at its concurrency limit
+        size_t rateLimited = 0;     // over this client's or the global rate budget
+    };
+    
+    // Outcome of warmUp()
+    struct WarmUpReport {
+        bool ready = false;             // at least one server answered
+        size_t endpoints = 0;           // servers that answered
+        double milliseconds = 0.0;      // until the last answer
+        uint32_t streamSequence = 0;    // sequence ID the frame took on a stream (0: none)
+    };
+    
+    // max_sessions bounds concurrent synchronous requests, max_in_flight
+    // the number of asynchronous requests on the wire at once. Masks are
+    // decoded into buffers from MaskBufferPool::shared(), which they return
+    // to once released.
+    SegmentationClient(const std::string& server_url = "http://192.248.10.70:8000/segment",
+                       size_t max_sessions = 2,
+                       size_t max_in_flight = 4);
+    ~SegmentationClient();
+    
+    // Synchronous request - blocks until completion, or until the deadline
+    // passes (the mask is then empty)
+    cv::Mat segmentImage(const cv::Mat& image, Deadline deadline = Deadline());
+    
+    // Asynchronous request using future/promise. The frame is encoded on the
+    // calling thread, sent by the shared request engine and its response
+    // decoded on a worker thread; blocks only if the engine's queue is full.
+    std::future<cv::Mat> segmentImageAsync(const cv::Mat& image, Deadline deadline = Deadline());
+    
+    // Batch request: all frames go up in one multipart request and one mask
+    // per frame comes back, in order (empty where the server had none)
+    std::vector<cv::Mat> segmentImages(const std::vector<cv::Mat>& images,
+                                       Deadline deadline = Deadline());
+    
+    // Asynchronous batch request; the masks are decoded and the callback
+    // runs on a worker thread, which other responses wait for meanwhile
+    using BatchCallback = std::function<void(std::vector<cv::Mat> masks)>;
+    void segmentImagesAsync(const std::vector<cv::Mat>& images, BatchCallback callback,
+                            Deadline deadline = Deadline());
+    
+    // Connection setup limit, and abort transfers slower than
+    // low_speed_bytes per second for low_speed_seconds (0 = no limit).
+    // Call before issuing requests.
+    void setTimeouts(long connect_timeout_ms, long low_speed_bytes = 0, long low_speed_seconds = 0);
+    
+    DropCounters dropCounters() const;
+    
+    // Send requests over HTTP/2 (h2c prior knowledge for http:// URLs, ALPN
+    // for https://) so pipelined frames share one connection as up to
+    // max_streams concurrent streams. Servers without HTTP/2 support are
+    // detected and served over HTTP/1.1. Call before issuing requests.
+    void enableHttp2(long max_streams = 100);
+    
+    // Ask the server for a response format via the Accept header. Servers
+    // that do not know the binary format keep answering with JSON.
+    void setResponseFormat(ResponseFormat format);
+    
+    // Encoders to upload frames with. A single encoder is always used; with
+    // several, an autotuner picks whichever currently gives the lowest
+    // encode + upload time (see UploadCodecTuner). Defaults to PNG level 9.
+    // Call before issuing requests.
+    void setUploadEncoders(std::vector<std::unique_ptr<UploadEncoder>> encoders,
+                           size_t explore_interval = 50);
+    
+    // Current encoder estimates, for logging
+    std::string uploadCodecSummary() const;
+    
+    // Send HTTP requests over a Unix domain socket to a co-located server.
+    // The server URL's host then only fills the Host header. Call before
+    // issuing requests.
+    void setUnixSocketPath(const std::string& path);
+    
+    // Spread requests over several interchangeable servers. server_url is
+    // the first endpoint; each request goes to the one with the fewest
+    // outstanding requests relative to its weight (see EndpointPool).
+    // Call before issuing requests.
+    void addEndpoint(const std::string& url, double weight = 1.0);
+    
+    // Hedge requests: one still unanswered after its endpoint's latency
+    // quantile (p95 by default) is duplicated to another endpoint, the first
+    // answer wins and the other copy is cancelled. Synchronous calls then go
+    // through the request engine too. Needs two or more endpoints and ~20
+    // completed requests per endpoint before the first hedge.
+    void enableHedging(double quantile = 0.95);
+    
+    // Endpoint load, latency and hedging counters, for logging
+    std::string endpointSummary() const;
+    
+    // Adapt the number of outstanding requests per endpoint to its latency
+    // (see ConcurrencyLimit): more while responses come back near the
+    // endpoint's minimum RTT, fewer once they queue up inside the server.
+    // Requests beyond every endpoint's limit fail right away instead of
+    // waiting (see DropCounters::overLimit). max_limit 0 means the
+    // constructor's max_in_flight. Call before issuing requests.
+    void enableAdaptiveConcurrency(size_t min_limit = 1, size_t max_limit = 0);
+    
+    // Current limit and RTT estimates per endpoint, as metrics
+    std::vector<EndpointPool::ConcurrencyStats> concurrencyStats() const;
+    
+    // Downscale frames before upload (e.g. 0.5 or 0.25). Masks then come
+    // back at the reduced size; see GuidedMaskUpsampler to restore them.
+    // Call before issuing requests.
+    void setUploadScale(double scale);
+    
+    // Upload single frames as tile deltas (see TileDelta.h): only the tiles
+    // that changed since the last frame the server answered go up, with a
+    // full keyframe every keyframe_interval frames and whenever the server
+    // lost the reference. Needs a server that understands the format and a
+    // single endpoint, since the reference lives on one server; batches and
+    // streams keep the regular encoders. Call before issuing requests.
+    void enableDeltaUploads(int tile_size = 32, size_t keyframe_interval = 100, int change_threshold = 12);
     
-    // Synchronous request - blocks until completion
-    cv::Mat segmentImage(const cv::Mat& image);
+    // Keyframe, tile and byte counts of delta uploads, for logging
+    std::string deltaUploadSummary() const;
     
-    // Asynchronous request using future/promise
-    std::future<cv::Mat> segmentImageAsync(const cv::Mat& image);
+    // Answer single frames that look like a recent one (at most max_distance
+    // of 64 perceptual hash bits apart, within ttl) with that frame's mask
+    // instead of a server round trip (see MaskResultCache). Call before
+    // issuing requests.
+    void enableResultCache(int max_distance = 4,
+                           std::chrono::milliseconds ttl = std::chrono::milliseconds(1000),
+                           size_t capacity = 8);
+    
+    // Hit rate and round-trip time saved by the result cache, for logging
+    std::string resultCacheSummary() const;
+    
+    // Budget for this client's (camera's) requests per second and upload
+    // bytes per second (<= 0: unlimited), so one busy camera cannot crowd
+    // out the others on a shared server. Frames over budget are dropped
+    // (see DropCounters::rateLimited). Results from the mask cache are
+    // free.
+    void setRateLimits(double requests_per_second, double upload_bytes_per_second);
+    
+    // The same budget for all clients of the process together
+    static void setGlobalRateLimits(double requests_per_second, double upload_bytes_per_second);
+    
+    // Requests, drops and bytes sent and received on the wire by this
+    // client and by all clients of the process, for logging
+    RateLimiter::Stats trafficStats() const;
+    std::string trafficSummary() const;
+    
+    // Request and response compression per endpoint (see
+    // ContentCodingNegotiator), for logging. Responses are always offered in
+    // the codings libcurl decodes; uploads are compressed once a server
+    // announces the codings it takes, in both cases only while it pays off.
+    std::string transferCodingSummary() const;
+    
+    // Invoked on the stream's reader thread with a frame's sequence ID and
+    // its mask (empty if the server failed the frame or the stream dropped)
+    using StreamCallback = std::function<void(uint32_t sequence, cv::Mat mask)>;
+    
+    // Open a persistent streaming session (see StreamProtocol.h). Frames are
+    // pushed back-to-back over one TCP connection with at most max_in_flight
+    // unanswered, and the server may answer them in any order.
+    bool openStream(const std::string& host, int port, size_t max_in_flight = 8);
+    
+    // Same streaming interface to a server on this machine: frames go
+    // through a shared memory ring with up to slots frames in flight, and
+    // only descriptors cross the Unix socket (see ShmTransport.h)
+    bool openLocalStream(const std::string& socket_path, size_t slots = 4);
+    
+    // Close whichever stream is open
+    void closeStream();
+    bool isStreaming() const;
+    
+    // Prime the servers before the first real frame: a synthetic frame of
+    // frame_size goes to every endpoint at once (or down the open stream),
+    // so DNS, the request engine's TCP/TLS connections and the server's
+    // lazily loaded model are ready when the camera delivers. Blocks until every server has
+    // answered or timeout has passed. Warm-up requests skip the result
+    // cache, delta uploads and the rate budget, and don't count towards
+    // endpoint latencies.
+    WarmUpReport warmUp(cv::Size frame_size,
+                        std::chrono::milliseconds timeout = std::chrono::milliseconds(10000));
+    
+    // Push a frame on the stream, tagged with its capture timestamp. Returns
+    // the frame's sequence ID, or 0 if the stream is down or the frame's
+    // deadline passed before it could be sent (the callback is not invoked
+    // then). A frame still unanswered at its deadline gets an empty mask.
+    uint32_t streamFrame(const cv::Mat& image, uint64_t timestamp_us, StreamCallback callback,
+                         Deadline deadline = Deadline());
 
 private:
-    std::string m_serverUrl;
+    HttpVersion m_httpVersion;
+    ResponseFormat m_responseFormat;
+    
+    // Long-lived HTTP sessions sharing DNS/TLS caches with the engine
+    HttpSessionPool m_sessions;
+    
+    // Servers to balance over, and the hedging quantile (0 = off)
+    EndpointPool m_endpoints;
+    double m_hedgeQuantile;
+    std::atomic<size_t> m_hedgesSent;
+    std::atomic<size_t> m_hedgesWon;
+    
+    // Upload encoder selection
+    std::unique_ptr<UploadCodecTuner> m_codecs;
+    double m_uploadScale;
+    std::string m_unixSocketPath;
+    HttpTimeouts m_timeouts;
+    
+    // Tile-delta encoding of single frames, if enabled
+    std::unique_ptr<tile_delta::TileDeltaEncoder> m_deltas;
+    
+    // Masks of recent frames, if enabled
+    std::unique_ptr<MaskResultCache> m_resultCache;
+    
+    // Request and upload budget of this camera, nested in the global one
+    RateLimiter m_rateLimiter;
+    
+    // Content codings per endpoint
+    ContentCodingNegotiator m_coding;
+    
+    // Deadline drops per stage
+    std::atomic<size_t> m_droppedBeforeEncoding;
+    std::atomic<size_t> m_droppedBeforeSending;
+    std::atomic<size_t> m_droppedInFlight;
+    std::atomic<size_t> m_droppedOverLimit;
+    std::atomic<size_t> m_droppedRateLimited;
+    
+    // Recycled mask buffers and JSON sinks (with their decode buffers)
+    MaskBufferPool& m_maskPool;
+    JsonMaskSinkPool m_sinks;
+    
+    struct EncodedFrame {
+        std::vector<uchar> data;
+        std::string contentType;
+        std::string filename;
+    };
+    
+    // One request and its hedged duplicate, if any
+    struct HedgedCall;
     
     // Helper methods
-    std::vector<uchar> encodeImageToPNG(const cv::Mat& image);
+    HttpResponse send(HttpRequest request);
+    void dispatch(HttpRequest request, AsyncRequestEngine::Callback callback);
+    bool startAttempt(const std::shared_ptr<HedgedCall>& call, HttpRequest request, size_t exclude);
+    void finishAttempt(const std::shared_ptr<HedgedCall>& call, size_t attempt, HttpResponse&& response);
+    void hedge(const std::shared_ptr<HedgedCall>& call);
+    cv::Size uploadSize(const cv::Mat& image) const;
+    void convertForUpload(const cv::Mat& image, cv::Mat& out);
+    EncodedFrame encodeFrame(const cv::Mat& image);
+    bool expired(Deadline deadline, size_t frames);
+    void countUnsent(Deadline deadline);
+    bool rateLimited(size_t frames);
+    void releaseEndpoint(size_t endpoint, const HttpResponse& response);
+    bool encodeDelta(const cv::Mat& image, EncodedFrame& encoded, uint32_t& frame_id);
+    void finishDelta(uint32_t frame_id, const HttpResponse& response);
+    bool lookupResult(const cv::Mat& image, uint64_t& key, cv::Mat& mask);
+    void storeResult(uint64_t key, cv::Size frame_size, const HttpResponse& response, const cv::Mat& mask);
+    cv::Mat copyMask(const cv::Mat& mask);
+    HttpRequest buildRequest(const std::vector<cv::Mat>& images, Deadline deadline,
+                             uint32_t* delta_frame = nullptr);
+    bool checkResponse(const HttpResponse& response, size_t frames);
+    cv::Mat parseResponse(const HttpResponse& response);
+    std::vector<cv::Mat> parseBatchResponse(const HttpResponse& response, size_t count);
     cv::Mat decodeBase64Mask(const std::string& base64Mask);
     std::string extractBase64MaskFromJson(const std::string& jsonResponse);
+    cv::Mat decodeBinaryMask(const uint8_t* data, size_t size);
+    cv::Mat decodeFirstInstance(const mask_codec::MaskSetReader& reader);
+    cv::Mat decodeScannedMask(const JsonMaskScanner& scanner, size_t result);
+    
+    // Persistent streaming session (TCP or local), if open
+    std::unique_ptr<StreamingSession> m_stream;
+    std::unique_ptr<ShmSession> m_localStream;
+    
+    // curl-multi I/O thread for segmentImageAsync. Stopped by the
+    // destructor before any member its callbacks use goes away.
+    AsyncRequestEngine m_engine;
+    
+    // Decode responses and send hedges off the engine's I/O thread.
+    // Declared last so it is destroyed first: its threads finish what the
+    // stopped engine handed them while everything else is still there.
+    WorkerPool m_decoders;
 };
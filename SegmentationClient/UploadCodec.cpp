@@ -0,0 +1,224 @@
+#include "UploadCodec.h"
+#include <cstring>
+#include <sstream>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+namespace {
+
+// Weight of a new sample in the moving averages
+constexpr double kSmoothing = 0.2;
+
+// Samples per encoder before the tuner starts choosing by cost
+constexpr size_t kWarmupSamples = 3;
+
+// Throughput assumed until the first upload is measured (10 Mbit/s)
+constexpr double kInitialThroughput = 1250.0;
+
+double smooth(double average, double sample, size_t samples) {
+    return samples == 0 ? sample : average + kSmoothing * (sample - average);
+}
+
+} // namespace
+
+PngUploadEncoder::PngUploadEncoder(int level) : m_level(level) {
+}
+
+std::string PngUploadEncoder::name() const {
+    return "png-" + std::to_string(m_level);
+}
+
+bool PngUploadEncoder::encode(const cv::Mat& gray, std::vector<uchar>& out) {
+    std::vector<int> params = {cv::IMWRITE_PNG_COMPRESSION, m_level};
+    return cv::imencode(".png", gray, out, params);
+}
+
+JpegUploadEncoder::JpegUploadEncoder(int quality) : m_quality(quality) {
+}
+
+std::string JpegUploadEncoder::name() const {
+    return "jpeg-" + std::to_string(m_quality);
+}
+
+bool JpegUploadEncoder::encode(const cv::Mat& gray, std::vector<uchar>& out) {
+    std::vector<int> params = {cv::IMWRITE_JPEG_QUALITY, m_quality};
+    return cv::imencode(".jpg", gray, out, params);
+}
+
+WebpUploadEncoder::WebpUploadEncoder(int quality) : m_quality(quality) {
+}
+
+bool WebpUploadEncoder::isAvailable() {
+    return cv::haveImageWriter(".webp");
+}
+
+std::string WebpUploadEncoder::name() const {
+    return "webp-" + std::to_string(m_quality);
+}
+
+bool WebpUploadEncoder::encode(const cv::Mat& gray, std::vector<uchar>& out) {
+    std::vector<int> params = {cv::IMWRITE_WEBP_QUALITY, m_quality};
+    return cv::imencode(".webp", gray, out, params);
+}
+
+#ifdef HAVE_LZ4
+bool Lz4RawUploadEncoder::encode(const cv::Mat& gray, std::vector<uchar>& out) {
+    // LZ4 wants one contiguous block
+    cv::Mat pixels = gray.isContinuous() ? gray : gray.clone();
+    const int size = static_cast<int>(pixels.total());
+
+    const size_t headerSize = 12;
+    out.resize(headerSize + LZ4_compressBound(size));
+    std::memcpy(out.data(), "GRY8", 4);
+    for (int i = 0; i < 4; i++) {
+        out[4 + i] = static_cast<uchar>(static_cast<uint32_t>(pixels.cols) >> (8 * i));
+        out[8 + i] = static_cast<uchar>(static_cast<uint32_t>(pixels.rows) >> (8 * i));
+    }
+
+    int compressed = LZ4_compress_default(reinterpret_cast<const char*>(pixels.data),
+                                          reinterpret_cast<char*>(out.data() + headerSize),
+                                          size, static_cast<int>(out.size() - headerSize));
+    if (compressed <= 0) {
+        return false;
+    }
+    out.resize(headerSize + compressed);
+    return true;
+}
+#endif
+
+UploadCodecTuner::UploadCodecTuner(std::vector<std::unique_ptr<UploadEncoder>> encoders,
+                                   size_t explore_interval)
+    : m_encoders(std::move(encoders)),
+      m_estimates(m_encoders.size()),
+      m_exploreInterval(explore_interval == 0 ? 1 : explore_interval),
+      m_frames(0) {
+}
+
+std::vector<std::unique_ptr<UploadEncoder>> UploadCodecTuner::defaultEncoders(bool include_raw) {
+    std::vector<std::unique_ptr<UploadEncoder>> encoders;
+    encoders.emplace_back(new PngUploadEncoder(1));
+    encoders.emplace_back(new PngUploadEncoder(9));
+    encoders.emplace_back(new JpegUploadEncoder(90));
+    if (WebpUploadEncoder::isAvailable()) {
+        encoders.emplace_back(new WebpUploadEncoder(90));
+    }
+#ifdef HAVE_LZ4
+    if (include_raw) {
+        encoders.emplace_back(new Lz4RawUploadEncoder());
+    }
+#else
+    (void)include_raw;
+#endif
+    return encoders;
+}
+
+size_t UploadCodecTuner::choose(const std::string& origin) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_frames++;
+
+    if (m_encoders.size() == 1) {
+        return 0;
+    }
+
+    // Warm-up: try every encoder a few times first
+    for (size_t i = 0; i < m_estimates.size(); i++) {
+        if (!m_estimates[i].failed && m_estimates[i].samples < kWarmupSamples) {
+            m_estimates[i].lastUsed = m_frames;
+            return i;
+        }
+    }
+
+    // Re-explore now and then: the encoder whose estimate is the most out of date
+    bool explore = m_frames % m_exploreInterval == 0;
+    double linkThroughput = throughput(origin);
+
+    size_t best = m_estimates.size();
+    for (size_t i = 0; i < m_estimates.size(); i++) {
+        if (m_estimates[i].failed) {
+            continue;
+        }
+        if (best == m_estimates.size() ||
+            (explore ? m_estimates[i].lastUsed < m_estimates[best].lastUsed
+                     : cost(m_estimates[i], linkThroughput) < cost(m_estimates[best], linkThroughput))) {
+            best = i;
+        }
+    }
+    if (best == m_estimates.size()) {
+        // Everything failed; keep trying the first encoder
+        best = 0;
+    }
+
+    m_estimates[best].lastUsed = m_frames;
+    return best;
+}
+
+void UploadCodecTuner::recordEncode(size_t index, double encode_ms, size_t bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Estimate& estimate = m_estimates[index];
+    estimate.encodeMs = smooth(estimate.encodeMs, encode_ms, estimate.samples);
+    estimate.bytes = smooth(estimate.bytes, static_cast<double>(bytes), estimate.samples);
+    estimate.samples++;
+}
+
+void UploadCodecTuner::recordUpload(const std::string& origin, size_t bytes, double seconds) {
+    if (bytes == 0 || seconds <= 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Link& link = m_links[origin];
+    link.throughput = smooth(link.throughput, bytes / (seconds * 1000.0), link.samples);
+    link.samples++;
+}
+
+void UploadCodecTuner::recordFailure(size_t index) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_estimates[index].failed = true;
+}
+
+double UploadCodecTuner::throughput(const std::string& origin) const {
+    auto it = m_links.find(origin);
+    if (it != m_links.end()) {
+        return it->second.throughput;
+    }
+    if (m_links.empty()) {
+        return kInitialThroughput;
+    }
+    double sum = 0;
+    for (const auto& link : m_links) {
+        sum += link.second.throughput;
+    }
+    return sum / m_links.size();
+}
+
+double UploadCodecTuner::cost(const Estimate& estimate, double throughput) const {
+    return estimate.encodeMs + estimate.bytes / throughput;
+}
+
+std::string UploadCodecTuner::summary() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::ostringstream out;
+    out.setf(std::ios::fixed);
+    out.precision(2);
+    out << "Upload throughput";
+    if (m_links.empty()) {
+        out << " " << kInitialThroughput / 1000.0 << " MB/s (assumed)";
+    }
+    for (const auto& link : m_links) {
+        out << " " << link.first << " " << link.second.throughput / 1000.0 << " MB/s";
+    }
+    double linkThroughput = throughput(std::string());
+    for (size_t i = 0; i < m_encoders.size(); i++) {
+        const Estimate& estimate = m_estimates[i];
+        out << "\n  " << m_encoders[i]->name();
+        if (estimate.failed) {
+            out << ": failed";
+            continue;
+        }
+        out << ": encode " << estimate.encodeMs << "ms, "
+            << static_cast<size_t>(estimate.bytes) << " bytes, cost " << cost(estimate, linkThroughput) << "ms";
+    }
+    return out.str();
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Encodes a grayscale frame for upload
+class UploadEncoder {
+public:
+    virtual ~UploadEncoder() = default;
+
+    // Short label for logs, e.g. "png-1" or "jpeg-90"
+    virtual std::string name() const = 0;
+
+    // Multipart content type and file name of the encoded frame
+    virtual std::string contentType() const = 0;
+    virtual std::string filename() const = 0;
+
+    virtual bool encode(const cv::Mat& gray, std::vector<uchar>& out) = 0;
+};
+
+// PNG at a zlib level from 0 (fastest) to 9 (smallest)
+class PngUploadEncoder : public UploadEncoder {
+public:
+    explicit PngUploadEncoder(int level);
+    std::string name() const override;
+    std::string contentType() const override { return "image/png"; }
+    std::string filename() const override { return "image.png"; }
+    bool encode(const cv::Mat& gray, std::vector<uchar>& out) override;
+
+private:
+    int m_level;
+};
+
+// Grayscale JPEG at a quality from 1 to 100
+class JpegUploadEncoder : public UploadEncoder {
+public:
+    explicit JpegUploadEncoder(int quality);
+    std::string name() const override;
+    std::string contentType() const override { return "image/jpeg"; }
+    std::string filename() const override { return "image.jpg"; }
+    bool encode(const cv::Mat& gray, std::vector<uchar>& out) override;
+
+private:
+    int m_quality;
+};
+
+// WebP at a quality from 1 to 100 (above 100 is lossless). Only usable if
+// OpenCV was built with WebP; see isAvailable().
+class WebpUploadEncoder : public UploadEncoder {
+public:
+    explicit WebpUploadEncoder(int quality);
+    static bool isAvailable();
+    std::string name() const override;
+    std::string contentType() const override { return "image/webp"; }
+    std::string filename() const override { return "image.webp"; }
+    bool encode(const cv::Mat& gray, std::vector<uchar>& out) override;
+
+private:
+    int m_quality;
+};
+
+#ifdef HAVE_LZ4
+// Raw 8-bit pixels compressed with LZ4. The payload is "GRY8", uint32 LE
+// width and height, then one LZ4 block of width * height bytes.
+class Lz4RawUploadEncoder : public UploadEncoder {
+public:
+    std::string name() const override { return "raw-lz4"; }
+    std::string contentType() const override { return "application/x-gray8-lz4"; }
+    std::string filename() const override { return "image.gray8.lz4"; }
+    bool encode(const cv::Mat& gray, std::vector<uchar>& out) override;
+};
+#endif
+
+// Picks the upload encoder with the lowest expected cost per frame:
+//
+//     encode time + encoded size / upload throughput
+//
+// Encode time and size are moving averages per encoder; throughput is a
+// moving average per server origin (a fixed 10 Mbit/s until the first
+// upload to it is timed). Each encoder is tried a few times up
+// front, and every explore_interval frames the least recently used one is
+// tried again so the estimates follow changes in content and network.
+class UploadCodecTuner {
+public:
+    explicit UploadCodecTuner(std::vector<std::unique_ptr<UploadEncoder>> encoders,
+                              size_t explore_interval = 50);
+
+    // PNG levels, JPEG and, where OpenCV supports it, WebP. Raw LZ4 (if
+    // built with HAVE_LZ4) is only added on request since the server has
+    // to understand it.
+    static std::vector<std::unique_ptr<UploadEncoder>> defaultEncoders(bool include_raw = false);
+
+    // Index of the encoder to use for the next frame, which goes to origin
+    // ("scheme://host:port"; empty if not known yet, which assumes the
+    // average of the servers measured so far)
+    size_t choose(const std::string& origin = std::string());
+
+    UploadEncoder& encoder(size_t index) { return *m_encoders[index]; }
+    size_t encoderCount() const { return m_encoders.size(); }
+
+    // Feed back one encode and one finished upload
+    void recordEncode(size_t index, double encode_ms, size_t bytes);
+    void recordUpload(const std::string& origin, size_t bytes, double seconds);
+
+    // Stop choosing an encoder that failed to encode a frame
+    void recordFailure(size_t index);
+
+    // One line per encoder with its current estimates
+    std::string summary() const;
+
+private:
+    struct Estimate {
+        double encodeMs = 0;
+        double bytes = 0;
+        size_t samples = 0;
+        size_t lastUsed = 0;
+        bool failed = false;
+    };
+
+    std::vector<std::unique_ptr<UploadEncoder>> m_encoders;
+    std::vector<Estimate> m_estimates;
+    size_t m_exploreInterval;
+    size_t m_frames;
+
+    // Upload throughput to one origin in bytes per millisecond
+    struct Link {
+        double throughput = 0;
+        size_t samples = 0;
+    };
+    std::map<std::string, Link> m_links;
+
+    mutable std::mutex m_mutex;
+
+    // With m_mutex held
+    double throughput(const std::string& origin) const;
+    double cost(const Estimate& estimate, double throughput) const;
+};
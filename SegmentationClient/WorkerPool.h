@@ -0,0 +1,39 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A few threads running tasks in submission order. Takes work off threads
+// that must stay responsive, e.g. decoding responses off the request
+// engine's I/O thread, where it would hold up every other transfer and
+// timer.
+class WorkerPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit WorkerPool(size_t threads = 2);
+
+    // Runs every task still queued, then stops
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Queue a task; never blocks
+    void post(Task task);
+
+private:
+    std::deque<Task> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopping;
+
+    std::vector<std::thread> m_threads;
+
+    void run();
+};
@@ -0,0 +1,112 @@
+#include "Base64.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Throughput of the shared base64 decoder on mask-sized payloads, for each
+// implementation this CPU supports. Masks arrive as base64 PNGs; compressed
+// PNG data is close to random bytes, so random bytes behind a PNG header
+// make a realistic payload.
+
+namespace {
+
+std::string encode(const std::vector<uint8_t>& data) {
+    static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::string out;
+    out.reserve((data.size() + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 3 <= data.size(); i += 3) {
+        uint32_t bits = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        out.push_back(alphabet[(bits >> 18) & 63]);
+        out.push_back(alphabet[(bits >> 12) & 63]);
+        out.push_back(alphabet[(bits >> 6) & 63]);
+        out.push_back(alphabet[bits & 63]);
+    }
+
+    size_t rest = data.size() - i;
+    if (rest > 0) {
+        uint32_t bits = data[i] << 16;
+        if (rest == 2) {
+            bits |= data[i + 1] << 8;
+        }
+        out.push_back(alphabet[(bits >> 18) & 63]);
+        out.push_back(alphabet[(bits >> 12) & 63]);
+        out.push_back(rest == 2 ? alphabet[(bits >> 6) & 63] : '=');
+        out.push_back('=');
+    }
+    return out;
+}
+
+std::vector<uint8_t> pngLikePayload(size_t size, std::mt19937& rng) {
+    static const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+    std::vector<uint8_t> data(size);
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (uint8_t& value : data) {
+        value = static_cast<uint8_t>(byte(rng));
+    }
+    std::copy(signature, signature + std::min(size, sizeof(signature)), data.begin());
+    return data;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    // Total input to decode per measurement, in MB
+    double totalMb = argc > 1 ? std::atof(argv[1]) : 512.0;
+
+    std::cout << "Active implementation: " << base64::name(base64::activeImplementation()) << std::endl;
+
+    std::mt19937 rng(1234);
+    const size_t payloadSizes[] = {4 * 1024, 64 * 1024, 512 * 1024};
+    const base64::Implementation implementations[] = {
+        base64::Implementation::Scalar,
+        base64::Implementation::Sse41,
+        base64::Implementation::Avx2
+    };
+
+    for (size_t payloadSize : payloadSizes) {
+        std::vector<uint8_t> payload = pngLikePayload(payloadSize, rng);
+        std::string encoded = encode(payload);
+        std::vector<uint8_t> output(base64::decodedSizeBound(encoded.size()));
+        size_t iterations = std::max<size_t>(1, static_cast<size_t>(totalMb * 1e6 / encoded.size()));
+
+        std::cout << "\nMask of " << payloadSize / 1024 << " KB (" << encoded.size()
+                  << " base64 characters), " << iterations << " iterations" << std::endl;
+
+        for (base64::Implementation implementation : implementations) {
+            if (!base64::isSupported(implementation)) {
+                std::cout << "  " << std::setw(8) << base64::name(implementation) << ": not supported" << std::endl;
+                continue;
+            }
+
+            size_t written = 0;
+            bool ok = base64::decodeWith(implementation, encoded.data(), encoded.size(), output.data(), written) &&
+                      written == payload.size() && std::equal(payload.begin(), payload.end(), output.begin());
+            if (!ok) {
+                std::cerr << "Error: " << base64::name(implementation) << " decoded the payload incorrectly" << std::endl;
+                return 1;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < iterations; i++) {
+                base64::decodeWith(implementation, encoded.data(), encoded.size(), output.data(), written);
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            // Rates are in input (base64) bytes
+            std::cout << "  " << std::setw(8) << base64::name(implementation) << ": " << std::fixed
+                      << std::setprecision(2) << iterations * encoded.size() / seconds / 1e9 << " GB/s, "
+                      << std::setprecision(1) << seconds / iterations * 1e6 << " us per mask" << std::endl;
+            std::cout.unsetf(std::ios::fixed);
+        }
+    }
+
+    return 0;
+}
@@ -1,39 +1,161 @@
 #include "SegmentationClient.h"
+#include "BatchCoalescer.h"
 #include "IPCameraCapture.h"
+#include "MaskUpsampler.h"
+#include "ReorderBuffer.h"
+#include <algorithm>
 #include <iostream>
 #include <chrono>
+#include <deque>
+#include <future>
+#include <memory>
 #include <queue>
+#include <string>
+#include <vector>
 #include <mutex>
 #include <condition_variable>
 
+namespace {
+
+bool hasScheme(const std::string& url, const std::string& scheme) {
+    return url.compare(0, scheme.size(), scheme) == 0;
+}
+
+// HTTP URL for the client; unix:// servers are reached through the socket
+std::string httpUrl(const std::string& serverUrl) {
+    return hasScheme(serverUrl, "unix://") ? "http://localhost/segment" : serverUrl;
+}
+
+// Split a comma-separated server list; the first entry picks the transport
+std::vector<std::string> splitServers(const std::string& serverUrl) {
+    std::vector<std::string> servers;
+    size_t start = 0;
+    while (start <= serverUrl.size()) {
+        size_t comma = serverUrl.find(',', start);
+        if (comma == std::string::npos) {
+            comma = serverUrl.size();
+        }
+        if (comma > start) {
+            servers.push_back(serverUrl.substr(start, comma - start));
+        }
+        start = comma + 1;
+    }
+    return servers;
+}
+
+long long millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
 class SegmentationPipeline {
 public:
+    // serverUrl selects the transport:
+    //   http://host:port/segment  one HTTP request per frame
+    //   unix:///path/to.sock      the same over a Unix domain socket
+    //   tcp://host:port           persistent streaming session
+    //   shm:///path/to.sock       shared memory ring to a local server
+    // Several comma-separated http:// URLs are load balanced with hedged
+    // requests; "url#2" weights a server twice as much as the first one.
     SegmentationPipeline(const std::string& cameraUrl, const std::string& serverUrl)
         : m_camera(cameraUrl), 
-          m_segmentationClient(serverUrl),
+          m_segmentationClient(httpUrl(serverUrl.substr(0, serverUrl.find(',')))),
           m_isRunning(false),
           m_processingQueueSize(3),  // Max number of frames in processing queue
-          m_showVisualization(true) {
+          m_showVisualization(true),
+          m_batcher(nullptr),
+          m_maxFrameAge(1000),
+          m_droppedQueueFull(0),
+          m_firstMaskSeen(false),
+          m_streamPort(0),
+          m_frameCount(0) {
+        if (hasScheme(serverUrl, "tcp://")) {
+            std::string address = serverUrl.substr(6);
+            size_t colon = address.rfind(':');
+            m_streamHost = address.substr(0, colon);
+            m_streamPort = colon == std::string::npos ? 9000 : std::stoi(address.substr(colon + 1));
+        } else if (hasScheme(serverUrl, "shm://")) {
+            m_localSocket = serverUrl.substr(6);
+        } else if (hasScheme(serverUrl, "unix://")) {
+            m_segmentationClient.setUnixSocketPath(serverUrl.substr(7));
+        }
+        
+        std::vector<std::string> servers = splitServers(serverUrl);
+        for (size_t i = 1; i < servers.size(); i++) {
+            size_t hash = servers[i].find('#');
+            double weight = hash == std::string::npos ? 1.0 : std::stod(servers[i].substr(hash + 1));
+            m_segmentationClient.addEndpoint(servers[i].substr(0, hash), weight);
+        }
+        if (servers.size() > 1) {
+            m_segmentationClient.enableHedging();
+        }
+        
+        // Let the client pick the upload codec that is fastest end to end
+        m_segmentationClient.setUploadEncoders(UploadCodecTuner::defaultEncoders());
+        
+        // Fail fast on an unreachable server or a stalled upload
+        m_segmentationClient.setTimeouts(1000, 1024, 2);
     }
     
+    // Opens the camera and warms up the server side in parallel, and
+    // returns once both are ready
     bool start() {
         if (m_isRunning) {
             return true;
         }
+        m_startedAt = std::chrono::steady_clock::now();
+        m_firstMaskSeen = false;
         
         // Set the camera resolution to match the required dimensions
-        m_camera.setResolution(600, 350);
+        const cv::Size frameSize(600, 350);
+        m_camera.setResolution(frameSize.width, frameSize.height);
         
         // Set the frame callback
-        m_camera.setFrameCallback([this](const cv::Mat& frame) {
+        m_camera.setFrameCallback([this](const FramePtr& frame) {
             this->processFrame(frame);
         });
         
-        // Start the camera
-        if (!m_camera.start()) {
+        // Opening a network camera takes seconds; so do DNS, connecting and
+        // the server's first inference. Do them side by side.
+        std::future<long long> cameraOpened = std::async(std::launch::async, [this] {
+            if (!m_camera.start()) {
+                return -1LL;
+            }
+            return static_cast<long long>(millisecondsSince(m_startedAt));
+        });
+        
+        // Open the streaming session up front so the first frame doesn't wait
+        bool serverReachable = !isStreamingMode() || openStream();
+        SegmentationClient::WarmUpReport warmUp;
+        if (serverReachable) {
+            warmUp = m_segmentationClient.warmUp(frameSize);
+            
+            // The warm-up frame took the stream's first sequence ID
+            if (warmUp.streamSequence != 0) {
+                std::lock_guard<std::mutex> lock(m_resultMutex);
+                m_reorder = ReorderBuffer<StreamResult>(warmUp.streamSequence + 1);
+            }
+        }
+        
+        long long cameraMs = cameraOpened.get();
+        if (cameraMs < 0) {
             std::cerr << "Failed to start camera" << std::endl;
             return false;
         }
+        if (!serverReachable) {
+            std::cerr << "Failed to open the streaming session" << std::endl;
+            m_camera.stop();
+            return false;
+        }
+        
+        // A server that is still down is retried frame by frame
+        if (!warmUp.ready) {
+            std::cerr << "Server warm-up failed; starting cold" << std::endl;
+        }
+        std::cout << "Ready after " << millisecondsSince(m_startedAt) << " ms (camera " << cameraMs
+                  << " ms, server warm-up " << static_cast<long long>(warmUp.milliseconds) << " ms, "
+                  << warmUp.endpoints << " server(s) primed)" << std::endl;
         
         // Start the processing thread
         m_isRunning = true;
@@ -61,6 +183,27 @@ public:
             m_processingThread.join();
         }
         
+        // Unanswered stream frames are failed here, while the pipeline is alive
+        m_segmentationClient.closeStream();
+        
+        std::cout << m_camera.captureSummary() << std::endl;
+        std::cout << m_segmentationClient.uploadCodecSummary() << std::endl;
+        std::cout << m_segmentationClient.endpointSummary() << std::endl;
+        std::cout << m_segmentationClient.deltaUploadSummary() << std::endl;
+        std::cout << m_segmentationClient.resultCacheSummary() << std::endl;
+        std::cout << m_segmentationClient.transferCodingSummary() << std::endl;
+        std::cout << MaskBufferPool::shared().summary() << std::endl;
+        
+        SegmentationClient::DropCounters drops = m_segmentationClient.dropCounters();
+        std::cout << "Dropped frames: " << m_droppedQueueFull << " queue full, "
+                  << (m_batcher ? m_batcher->framesExpired() : 0) << " expired in batch queue, "
+                  << drops.beforeEncoding << " expired before encoding, "
+                  << drops.beforeSending << " expired before sending, "
+                  << drops.inFlight << " aborted in flight, "
+                  << drops.overLimit << " shed at the concurrency limit, "
+                  << drops.rateLimited << " over the rate budget" << std::endl;
+        std::cout << m_segmentationClient.trafficSummary() << std::endl;
+        
         // Close OpenCV windows
         cv::destroyAllWindows();
     }
@@ -69,18 +212,102 @@ public:
         m_showVisualization = show;
     }
     
+    // Send frames through a batch coalescer (possibly shared with other
+    // pipelines) instead of one request per frame. Call before start().
+    void setBatchCoalescer(BatchCoalescer* batcher) {
+        m_batcher = batcher;
+    }
+    
+    // Send this camera's frames in batches of up to max_batch_size, each
+    // waiting at most max_wait for the batch to fill. Call before start().
+    void enableBatching(size_t max_batch_size,
+                        std::chrono::milliseconds max_wait = std::chrono::milliseconds(10)) {
+        m_ownBatcher.reset(new BatchCoalescer(m_segmentationClient, max_batch_size, max_wait));
+        m_batcher = m_ownBatcher.get();
+    }
+    
+    // Upload frames at a fraction of their size (1, 1/2 or 1/4); the low-res
+    // masks are brought back to frame size by the guided upsampler.
+    // Call before start().
+    void setUploadScale(double scale) {
+        m_segmentationClient.setUploadScale(scale);
+    }
+    
+    // Upload only the tiles that changed since the last answered frame.
+    // Needs a server that understands tile deltas. Call before start().
+    void enableDeltaUploads() {
+        m_segmentationClient.enableDeltaUploads();
+    }
+    
+    // Reuse the mask of a near-identical frame from the last second instead
+    // of asking the server again. Call before start().
+    void enableResultCache() {
+        m_segmentationClient.enableResultCache();
+    }
+    
+    // Let each server's latency set how many requests it gets at once.
+    // Call before start().
+    void enableAdaptiveConcurrency() {
+        m_segmentationClient.enableAdaptiveConcurrency();
+    }
+    
+    // Cap this camera's requests per second and upload bytes per second
+    // (0: unlimited), leaving the server's capacity to the other cameras.
+    // Call before start().
+    void setRateLimits(double requests_per_second, double upload_bytes_per_second) {
+        m_segmentationClient.setRateLimits(requests_per_second, upload_bytes_per_second);
+    }
+    
+    // Pass on at most fps camera frames per second (0: all the camera
+    // sends), picked evenly by their timestamps
+    void setCaptureFps(double fps) {
+        m_camera.setTargetFps(fps);
+    }
+    
+    // Give up on a frame this long after it was captured: it is dropped
+    // before encoding, or its request is aborted. Call before start().
+    void setMaxFrameAge(std::chrono::milliseconds max_age) {
+        m_maxFrameAge = max_age;
+    }
+    
 private:
-    void processFrame(const cv::Mat& frame) {
+    // A captured frame waiting to be processed
+    struct QueuedFrame {
+        FramePtr frame;   // shared with the camera, not copied
+        std::chrono::steady_clock::time_point capturedAt;
+    };
+    
+    // A streamed frame waiting for its result to come up in sequence order
+    struct StreamResult {
+        cv::Mat frame;
+        cv::Mat mask;
+        long long latencyMs;
+    };
+    
+    bool isStreamingMode() const {
+        return m_streamPort != 0 || !m_localSocket.empty();
+    }
+    
+    bool openStream() {
+        if (!m_localSocket.empty()) {
+            return m_segmentationClient.openLocalStream(m_localSocket);
+        }
+        return m_segmentationClient.openStream(m_streamHost, m_streamPort);
+    }
+    
+    void processFrame(const FramePtr& frame) {
         std::unique_lock<std::mutex> lock(m_queueMutex);
         
         // Check if the queue is full
         if (m_frameQueue.size() >= m_processingQueueSize) {
             // Remove the oldest frame
             m_frameQueue.pop();
+            m_droppedQueueFull++;
         }
         
-        // Add the new frame to the queue
-        m_frameQueue.push(frame.clone());
+        // Queue a handle to the camera's buffer; it goes back to the camera
+        // once the frame has been converted
+        m_frameQueue.push({frame, frame->capturedAt});
         
         // Notify the processing thread
         lock.unlock();
@@ -92,62 +319,164 @@ private:
         system("rm -rf ./output_frames");
         system("mkdir -p output_frames");
         
-        int frame_count = 0;
         while (m_isRunning) {
-            cv::Mat frame;
+            FramePtr frame;
+            std::chrono::steady_clock::time_point capturedAt;
             
             // Get frame from queue (existing code remains same)
             {
                 std::unique_lock<std::mutex> lock(m_queueMutex);
-                m_queueCondition.wait(lock, [this] { 
+                auto ready = [this] { 
                     return !m_frameQueue.empty() || !m_isRunning; 
-                });
+                };
+                if (m_batched.empty()) {
+                    m_queueCondition.wait(lock, ready);
+                } else {
+                    // Look in on the batched frames while waiting
+                    m_queueCondition.wait_for(lock, std::chrono::milliseconds(5), ready);
+                }
                 
                 if (!m_isRunning) break;
-                if (m_frameQueue.empty()) continue;
-                
-                frame = m_frameQueue.front();
-                m_frameQueue.pop();
+                if (!m_frameQueue.empty()) {
+                    frame = std::move(m_frameQueue.front().frame);
+                    capturedAt = m_frameQueue.front().capturedAt;
+                    m_frameQueue.pop();
+                }
             }
+            if (!frame) {
+                saveBatchedResults(m_batcher->maxBatchSize() * 2);
+                continue;
+            }
+            
+            // Past this point the mask is no longer wanted
+            SegmentationClient::Deadline deadline = capturedAt + m_maxFrameAge;
             
-            // Convert to grayscale
+            // Convert to grayscale. Pooled, since the frame may be held on
+            // to until its streamed result comes back.
             cv::Mat grayFrame;
-            cv::cvtColor(frame, grayFrame, cv::COLOR_BGR2GRAY);
+            MaskBufferPool::shared().attach(grayFrame);
+            cv::cvtColor(frame->image, grayFrame, cv::COLOR_BGR2GRAY);
+            frame.reset();
+            
+            // Streaming mode: push the frame and move on, the result is
+            // handled by onStreamResult when it comes back
+            if (isStreamingMode()) {
+                streamFrame(grayFrame, capturedAt, deadline);
+                continue;
+            }
             
             // Process segmentation
             auto start = std::chrono::high_resolution_clock::now();
-            cv::Mat mask = m_segmentationClient.segmentImage(grayFrame);
+            if (m_batcher) {
+                // Don't wait for the mask, or there would never be a second
+                // frame to batch with; up to two batches stay outstanding
+                m_batched.push_back({m_batcher->submit(grayFrame, deadline), grayFrame, start});
+                saveBatchedResults(m_batcher->maxBatchSize() * 2);
+                continue;
+            }
+            cv::Mat mask = m_segmentationClient.segmentImage(grayFrame, deadline);
             auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
                 std::chrono::high_resolution_clock::now() - start).count();
             
-            if (!mask.empty()) {
-                // Resize and process mask
-                if (mask.size() != grayFrame.size()) {
-                    cv::resize(mask, mask, grayFrame.size(), 0, 0, cv::INTER_NEAREST);
-                }
-                
-                if (mask.channels() != 1) {
-                    cv::cvtColor(mask, mask, cv::COLOR_BGR2GRAY);
-                }
-                
-                cv::threshold(mask, mask, 1, 255, cv::THRESH_BINARY);
+            saveResult(grayFrame, mask, duration);
+        }
+        
+        saveBatchedResults(0);
+    }
     
-                // Create side-by-side result
-                cv::Mat result;
-                cv::cvtColor(grayFrame, result, cv::COLOR_GRAY2BGR);
-                cv::Mat colorMask(mask.size(), CV_8UC3, cv::Scalar(0, 255, 0));
-                colorMask.copyTo(result, mask);
-                
-                // Save all frames
-                std::string frame_num = std::to_string(frame_count++);
-                cv::imwrite("output_frames/original_" + frame_num + ".jpg", grayFrame);
-                cv::imwrite("output_frames/mask_" + frame_num + ".jpg", mask);
-                cv::imwrite("output_frames/result_" + frame_num + ".jpg", result);
-                
-                std::cout << "Saved frame " << frame_num 
-                          << " | Processing time: " << duration << "ms" << std::endl;
+    // Saves the masks of batched frames that are back, in capture order,
+    // waiting for them until at most keep are outstanding
+    void saveBatchedResults(size_t keep) {
+        while (!m_batched.empty()) {
+            BatchedFrame& next = m_batched.front();
+            if (m_batched.size() <= keep &&
+                next.mask.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                return;
+            }
+            cv::Mat mask = next.mask.get();
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::high_resolution_clock::now() - next.start).count();
+            saveResult(next.frame, mask, duration);
+            m_batched.pop_front();
+        }
+    }
+    
+    void streamFrame(const cv::Mat& grayFrame, std::chrono::steady_clock::time_point capturedAt,
+                     SegmentationClient::Deadline deadline) {
+        auto now = std::chrono::steady_clock::now();
+        
+        // Reconnect a dropped stream, at most once a second
+        if (!m_segmentationClient.isStreaming()) {
+            if (now - m_lastConnectAttempt < std::chrono::seconds(1)) {
+                return;
             }
+            m_lastConnectAttempt = now;
+            if (!openStream()) {
+                return;
+            }
+            // Sequence IDs restart with the new session
+            std::lock_guard<std::mutex> lock(m_resultMutex);
+            m_reorder = ReorderBuffer<StreamResult>();
+        }
+        
+        uint64_t timestampUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            capturedAt.time_since_epoch()).count();
+        m_segmentationClient.streamFrame(grayFrame, timestampUs,
+            [this, grayFrame, capturedAt](uint32_t sequence, cv::Mat mask) {
+                auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - capturedAt).count();
+                onStreamResult(sequence, {grayFrame, mask, latency});
+            }, deadline);
+    }
+    
+    // Runs on the stream's reader thread. Results can arrive out of order;
+    // they are saved in the order the frames were captured.
+    void onStreamResult(uint32_t sequence, StreamResult result) {
+        std::lock_guard<std::mutex> lock(m_resultMutex);
+        
+        std::vector<ReorderBuffer<StreamResult>::Entry> ready;
+        if (!m_reorder.push(sequence, std::move(result), ready)) {
+            std::cout << "Dropped late result for frame " << sequence << std::endl;
+        }
+        for (auto& entry : ready) {
+            saveResult(entry.second.frame, entry.second.mask, entry.second.latencyMs);
+        }
+    }
+    
+    void saveResult(const cv::Mat& grayFrame, cv::Mat mask, long long duration) {
+        if (mask.empty()) {
+            return;
+        }
+        
+        if (!m_firstMaskSeen) {
+            m_firstMaskSeen = true;
+            std::cout << "Time to first mask: " << millisecondsSince(m_startedAt) << " ms" << std::endl;
         }
+        
+        if (mask.channels() != 1) {
+            cv::cvtColor(mask, mask, cv::COLOR_BGR2GRAY);
+        }
+        
+        // Low-res masks (downscaled uploads) are upsampled along the frame's edges
+        if (mask.size() != grayFrame.size()) {
+            mask = m_upsampler.upsample(mask, grayFrame);
+        } else {
+            cv::threshold(mask, mask, 1, 255, cv::THRESH_BINARY);
+        }
+
+        // Create side-by-side result, reusing the last frame's image
+        cv::Mat& result = m_resultImage;
+        cv::cvtColor(grayFrame, result, cv::COLOR_GRAY2BGR);
+        result.setTo(cv::Scalar(0, 255, 0), mask);
+        
+        // Save all frames
+        std::string frame_num = std::to_string(m_frameCount++);
+        cv::imwrite("output_frames/original_" + frame_num + ".jpg", grayFrame);
+        cv::imwrite("output_frames/mask_" + frame_num + ".jpg", mask);
+        cv::imwrite("output_frames/result_" + frame_num + ".jpg", result);
+        
+        std::cout << "Saved frame " << frame_num 
+                  << " | Processing time: " << duration << "ms" << std::endl;
     }
     
     IPCameraCapture m_camera;
@@ -157,13 +486,54 @@ private:
     std::thread m_processingThread;
     
     // Frame queue
-    std::queue<cv::Mat> m_frameQueue;
+    std::queue<QueuedFrame> m_frameQueue;
     std::mutex m_queueMutex;
     std::condition_variable m_queueCondition;
     size_t m_processingQueueSize;
     
     // Visualization flag
     bool m_showVisualization;
+    
+    // Optional micro-batcher, shared or this pipeline's own
+    BatchCoalescer* m_batcher;
+    std::unique_ptr<BatchCoalescer> m_ownBatcher;
+    
+    // Frames handed to the batcher whose masks are not saved yet, oldest
+    // first (processing thread only)
+    struct BatchedFrame {
+        std::future<cv::Mat> mask;
+        cv::Mat frame;
+        std::chrono::high_resolution_clock::time_point start;
+    };
+    std::deque<BatchedFrame> m_batched;
+    
+    // Frame deadline, and frames pushed out of the full queue
+    std::chrono::milliseconds m_maxFrameAge;
+    std::atomic<size_t> m_droppedQueueFull;
+    
+    // Startup, for time-to-ready and time-to-first-mask
+    std::chrono::steady_clock::time_point m_startedAt;
+    bool m_firstMaskSeen;
+    
+    // Restores masks of downscaled uploads to frame resolution
+    GuidedMaskUpsampler m_upsampler;
+    
+    // Overlay written by saveResult, reused from frame to frame (saveResult
+    // runs on one thread at a time)
+    cv::Mat m_resultImage;
+    
+    // Streaming session endpoint: TCP host/port or the local server's
+    // socket (neither set: HTTP requests)
+    std::string m_streamHost;
+    int m_streamPort;
+    std::string m_localSocket;
+    std::chrono::steady_clock::time_point m_lastConnectAttempt;
+    
+    // Puts streamed results back into capture order
+    ReorderBuffer<StreamResult> m_reorder;
+    std::mutex m_resultMutex;
+    
+    int m_frameCount;
 };
 
 int main(int argc, char* argv[]) {
@@ -178,10 +548,68 @@ int main(int argc, char* argv[]) {
         cameraUrl = argv[1];
     }
     
+    // Server URL; tcp://, shm:// and unix:// select other transports, a
+    // comma-separated list of http:// URLs balances over several servers
+    if (argc > 2) {
+        serverUrl = argv[2];
+    }
+    
+    // Upload scale: 1 (full resolution), 0.5 or 0.25
+    double uploadScale = 1.0;
+    if (argc > 3) {
+        uploadScale = std::stod(argv[3]);
+    }
+    
+    // Frames older than this (in milliseconds) are not worth a mask
+    long maxFrameAgeMs = 1000;
+    if (argc > 4) {
+        maxFrameAgeMs = std::stol(argv[4]);
+    }
+    
+    // Comma-separated options for fixed cameras: "delta" uploads changed
+    // tiles only (needs a matching server), "cache" reuses the mask of a
+    // near-identical recent frame, "adaptive" sizes each server's request
+    // window by its latency, "fps=N" and "kbps=N" cap the requests per
+    // second and upload kilobits per second, "capture=N" takes at most N
+    // frames per second from the camera, "batch=N" sends up to N frames
+    // per request
+    std::vector<std::string> options;
+    if (argc > 5) {
+        options = splitServers(argv[5]);
+    }
+    auto hasOption = [&options](const std::string& name) {
+        return std::find(options.begin(), options.end(), name) != options.end();
+    };
+    auto optionValue = [&options](const std::string& name) {
+        for (const auto& option : options) {
+            if (option.compare(0, name.size() + 1, name + "=") == 0) {
+                return std::stod(option.substr(name.size() + 1));
+            }
+        }
+        return 0.0;
+    };
+    
     std::cout << "Starting segmentation pipeline with camera: " << cameraUrl << std::endl;
     
     // Create and start the pipeline
     SegmentationPipeline pipeline(cameraUrl, serverUrl);
+    pipeline.setUploadScale(uploadScale);
+    pipeline.setMaxFrameAge(std::chrono::milliseconds(maxFrameAgeMs));
+    if (hasOption("delta")) {
+        pipeline.enableDeltaUploads();
+    }
+    if (hasOption("cache")) {
+        pipeline.enableResultCache();
+    }
+    if (hasOption("adaptive")) {
+        pipeline.enableAdaptiveConcurrency();
+    }
+    // kbps: kilobits, 125 bytes each
+    pipeline.setRateLimits(optionValue("fps"), optionValue("kbps") * 125);
+    pipeline.setCaptureFps(optionValue("capture"));
+    if (optionValue("batch") > 1) {
+        pipeline.enableBatching(static_cast<size_t>(optionValue("batch")));
+    }
     if (!pipeline.start()) {
         std::cerr << "Failed to start the segmentation pipeline" << std::endl;
         return 1;
@@ -0,0 +1,569 @@
+"""Local stand-in for the YOLO segmentation server.
+
+Answers POST /segment like the real server ({"masks": [<base64 PNG>]}),
+returning one rectangular "person" mask in the middle of the frame, so the
+clients can be exercised without a GPU box. Only the standard library is
+needed.
+
+If the request's Accept header lists application/x-segmentation-masks the
+masks come back in the compact run-length format of common/MaskCodec.h.
+With application/x-yolo-prototypes (single images only) the answer is a
+YOLOv8-style prototype set (common/ProtoMasks.h) that the client assembles
+into the same mask; --proto-dtype picks float16 or int8 prototypes.
+With application/x-instance-shapes+json (single images only) the mask comes
+back as a polygon or, with --shape-format rle, as COCO-style RLE.
+
+Single frames may be uploaded as tile deltas (common/TileDelta.h): the
+server rebuilds each frame from the last frames it saw of the client's
+session and answers 409 when a delta's base frame is not among them.
+
+Request bodies may be gzip or deflate compressed (Content-Encoding); the
+server announces that in an Accept-Encoding response header and answers 415
+to other codings. Responses over 1 KB are gzipped when the request's
+Accept-Encoding allows it.
+
+A request with several "image" parts is a batch: the answer is
+{"results": [{"masks": [...]}, ...]} with one entry per image, or one binary
+mask set per image back to back.
+
+    python3 mock_server.py --port 8000 --delay-ms 40
+
+Several instances with different latency profiles exercise the client's
+load balancing and hedging, e.g. a fast server with a slow tail next to a
+steady but slower one (the second URL is weighted 2):
+
+    python3 mock_server.py --port 8000 --delay-ms 20 --slow-fraction 0.1 --slow-ms 300
+    python3 mock_server.py --port 8010 --delay-ms 40
+    ./SegmentationClient <camera url> http://127.0.0.1:8000/segment,http://127.0.0.1:8010/segment#2
+
+The server itself speaks HTTP/1.1. To test the client's HTTP/2 mode, put an
+h2c-capable proxy in front of it, e.g. nghttpx:
+
+    nghttpx --frontend='127.0.0.1,8001;no-tls' --backend='127.0.0.1,8000'
+
+and point the client at http://127.0.0.1:8001/segment.
+
+With --stream-port the server also accepts the persistent streaming protocol
+of common/StreamProtocol.h. Each frame is answered from its own thread after
+a randomized delay, so results come back out of order:
+
+    python3 mock_server.py --stream-port 9000 --delay-ms 40
+    ./SegmentationClient <camera url> tcp://127.0.0.1:9000
+
+For a co-located client, --unix-socket serves the HTTP API on a Unix domain
+socket and --shm-socket the shared memory transport of common/ShmTransport.h:
+
+    python3 mock_server.py --shm-socket /tmp/segment.sock
+    ./SegmentationClient <camera url> shm:///tmp/segment.sock
+"""
+import argparse
+import base64
+import gzip
+import json
+import mmap
+import os
+import random
+import socket
+import socketserver
+import struct
+import threading
+import time
+import zlib
+from email.parser import BytesParser
+from email.policy import HTTP
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+DEFAULT_SIZE = (600, 350)
+BINARY_MASKS = "application/x-segmentation-masks"
+PROTOTYPES = "application/x-yolo-prototypes"
+SHAPES = "application/x-instance-shapes+json"
+
+# Prototype response header: magic, version, type, count, width, height,
+# image width, image height, int8 scale, instance count
+PROTO_HEADER = struct.Struct("<4sBBHHHIIfI")
+PROTO_COUNT = 32
+
+# Tile-delta upload header: magic, version, kind, compression, reserved,
+# tile size, reserved, width, height, session, frame, base frame, payload
+# size, raw payload size
+DELTA_HEADER = struct.Struct("<4sBBBBHHIIQIIII")
+DELTA_KEYFRAME, DELTA_COMPRESSED = 0, 1
+DELTA_HISTORY = 32
+
+# Streaming protocol header: magic, type, flags, reserved, sequence, timestamp, size
+STREAM_HEADER = struct.Struct("<4sBBHIQI")
+STREAM_FRAME, STREAM_RESULT, STREAM_ERROR = 1, 2, 3
+
+# Shared memory transport: ring header and descriptors
+RING_HEADER = struct.Struct("<4sIIII")
+RING_HEADER_SIZE = 64
+DESCRIPTOR = struct.Struct("<4sIIIIIIIQ")
+SHM_HELLO, SHM_FRAME, SHM_RESULT, SHM_ERROR = 1, 2, 3, 4
+
+
+def image_size(data):
+    """Width and height of an uploaded frame (falls back to 600x350).
+
+    Understands PNG, JPEG, WebP and the client's raw "GRY8" LZ4 upload.
+    """
+    if data[:8] == b"\x89PNG\r\n\x1a\n":
+        return struct.unpack(">II", data[16:24])
+    if data[:4] == b"GRY8":
+        return struct.unpack("<II", data[4:12])
+    if data[:4] == b"RIFF" and data[8:12] == b"WEBP":
+        chunk = data[12:16]
+        if chunk == b"VP8 ":
+            width, height = struct.unpack("<HH", data[26:30])
+            return width & 0x3FFF, height & 0x3FFF
+        if chunk == b"VP8L":
+            bits = struct.unpack("<I", data[21:25])[0]
+            return (bits & 0x3FFF) + 1, ((bits >> 14) & 0x3FFF) + 1
+        if chunk == b"VP8X":
+            width = int.from_bytes(data[24:27], "little") + 1
+            height = int.from_bytes(data[27:30], "little") + 1
+            return width, height
+    if data[:2] == b"\xff\xd8":
+        i = 2
+        while i + 9 < len(data):
+            if data[i] != 0xFF:
+                i += 1
+                continue
+            marker = data[i + 1]
+            length = struct.unpack(">H", data[i + 2:i + 4])[0]
+            if marker in (0xC0, 0xC1, 0xC2):
+                height, width = struct.unpack(">HH", data[i + 5:i + 9])
+                return width, height
+            i += 2 + length
+    return DEFAULT_SIZE
+
+
+class DeltaFrames:
+    """Rebuilds tile-delta uploads; keeps the last frames of every session."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.sessions = {}
+
+    def rebuild(self, data):
+        """(width, height) of the rebuilt frame, or None if the base is unknown."""
+        (_, _, kind, compression, _, tile, _, width, height, session, frame_id,
+         base_id, _, _) = DELTA_HEADER.unpack_from(data)
+        tiles_x = (width + tile - 1) // tile
+        tiles_y = (height + tile - 1) // tile
+        map_size = 0 if kind == DELTA_KEYFRAME else (tiles_x * tiles_y + 7) // 8
+        tile_map = data[DELTA_HEADER.size:DELTA_HEADER.size + map_size]
+        payload = data[DELTA_HEADER.size + map_size:]
+        if compression == DELTA_COMPRESSED:
+            payload = zlib.decompress(payload)
+
+        with self.lock:
+            frames = self.sessions.setdefault(session, {})
+            if kind == DELTA_KEYFRAME:
+                pixels = bytearray(payload)
+            elif base_id in frames and len(frames[base_id]) == width * height:
+                pixels = bytearray(frames[base_id])
+                offset = 0
+                for index in range(tiles_x * tiles_y):
+                    if not tile_map[index // 8] & (1 << (index % 8)):
+                        continue
+                    x = (index % tiles_x) * tile
+                    y = (index // tiles_x) * tile
+                    w = min(tile, width - x)
+                    for row in range(y, min(y + tile, height)):
+                        pixels[row * width + x:row * width + x + w] = payload[offset:offset + w]
+                        offset += w
+            else:
+                return None
+            frames[frame_id] = bytes(pixels)
+            while len(frames) > DELTA_HISTORY:
+                del frames[min(frames)]
+        return width, height
+
+
+def person_mask(width, height):
+    """8-bit mask (list of rows) with a filled box in the middle third."""
+    x0, x1 = width // 3, 2 * width // 3
+    y0, y1 = height // 4, 3 * height // 4
+    rows = []
+    for y in range(height):
+        if y0 <= y < y1:
+            rows.append(bytes(x0) + b"\xff" * (x1 - x0) + bytes(width - x1))
+        else:
+            rows.append(bytes(width))
+    return rows
+
+
+def encode_png(rows, width, height):
+    """Grayscale PNG from a list of rows."""
+    def chunk(tag, payload):
+        body = tag + payload
+        return struct.pack(">I", len(payload)) + body + struct.pack(">I", zlib.crc32(body))
+
+    raw = b"".join(b"\x00" + row for row in rows)
+    return (b"\x89PNG\r\n\x1a\n"
+            + chunk(b"IHDR", struct.pack(">IIBBBBB", width, height, 8, 0, 0, 0, 0))
+            + chunk(b"IDAT", zlib.compress(raw, 6))
+            + chunk(b"IEND", b""))
+
+
+def encode_prototypes(width, height, dtype):
+    """Prototype response for the person_mask box (see common/ProtoMasks.h).
+
+    The grid is what YOLOv8-seg gives for a 640 letterboxed input, with the
+    padding cropped away. Prototype 0 is strongly positive under the box and
+    the only one the detection uses; the others are empty.
+    """
+    gain = 640.0 / max(width, height)
+    proto_width = max(1, round(width * gain / 4))
+    proto_height = max(1, round(height * gain / 4))
+    box = (width // 3, height // 4, 2 * width // 3, 3 * height // 4)
+
+    # Cells whose centres fall inside the box
+    def cells(start, end, size, proto_size):
+        return [start <= (i + 0.5) * size / proto_size < end for i in range(proto_size)]
+
+    columns = cells(box[0], box[2], width, proto_width)
+    rows = cells(box[1], box[3], height, proto_height)
+
+    if dtype == "int8":
+        kind, scale, size = 1, 6.0 / 127, 1
+        inside, outside = struct.pack("<b", 127), struct.pack("<b", -127)
+    else:
+        kind, scale, size = 0, 0.0, 2
+        inside, outside = struct.pack("<e", 6.0), struct.pack("<e", -6.0)
+    row_inside = b"".join(inside if column else outside for column in columns)
+    row_outside = outside * proto_width
+    plane = b"".join(row_inside if row else row_outside for row in rows)
+    empty = bytes(proto_width * proto_height * size * (PROTO_COUNT - 1))
+
+    coefficients = [1.0] + [0.0] * (PROTO_COUNT - 1)
+    instance = struct.pack("<4ff%df" % PROTO_COUNT, *box, 0.9, *coefficients)
+    header = PROTO_HEADER.pack(b"YPRT", 1, kind, PROTO_COUNT, proto_width, proto_height,
+                               width, height, scale, 1)
+    return header + instance + plane + empty
+
+
+def coco_rle(rows, width, height):
+    """COCO compressed RLE string (pycocotools rleToString) of a mask.
+
+    Runs go down the columns and alternate background and foreground,
+    starting with background.
+    """
+    counts, foreground, run = [], False, 0
+    for x in range(width):
+        for y in range(height):
+            if (rows[y][x] != 0) != foreground:
+                counts.append(run)
+                foreground, run = not foreground, 0
+            run += 1
+    counts.append(run)
+
+    out = bytearray()
+    for i, count in enumerate(counts):
+        value = count - counts[i - 2] if i > 2 else count
+        more = True
+        while more:
+            c = value & 0x1F
+            value >>= 5
+            more = value != -1 if c & 0x10 else value != 0
+            out.append((c | (0x20 if more else 0)) + 48)
+    return out.decode()
+
+
+def encode_shapes(width, height, shape_format):
+    """Shapes response for the person_mask box (see moresimpler/InstanceShapes.h)."""
+    box = [width // 3, height // 4, 2 * width // 3, 3 * height // 4]
+    instance = {"box": box, "score": 0.9}
+    if shape_format == "rle":
+        rle = coco_rle(person_mask(width, height), width, height)
+        instance["rle"] = {"size": [height, width], "counts": rle}
+    else:
+        x0, y0, x1, y1 = box
+        instance["polygons"] = [[x0, y0, x1, y0, x1, y1, x0, y1]]
+    return json.dumps({"width": width, "height": height, "instances": [instance]}).encode()
+
+
+def varint(value):
+    out = bytearray()
+    while value >= 0x80:
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+    return bytes(out)
+
+
+def encode_mask_set(masks, width, height):
+    """Run-length binary mask response (see common/MaskCodec.h)."""
+    out = bytearray(b"SGMK" + struct.pack("<BBHIII", 1, 1, 0, width, height, len(masks)))
+    for rows in masks:
+        payload = bytearray()
+        foreground, run = False, 0
+        for row in rows:
+            for pixel in row:
+                if (pixel != 0) != foreground:
+                    payload += varint(run)
+                    foreground, run = not foreground, 0
+                run += 1
+        payload += varint(run)
+        out += struct.pack("<I", len(payload)) + payload
+    return bytes(out)
+
+
+REQUEST_CODINGS = ("gzip", "deflate")
+
+
+def decode_body(coding, body):
+    """Undo a request's Content-Encoding; ValueError for unsupported codings."""
+    if coding in ("", "identity"):
+        return body
+    if coding in ("gzip", "x-gzip"):
+        return gzip.decompress(body)
+    if coding == "deflate":
+        return zlib.decompress(body)
+    raise ValueError("unsupported content coding: " + coding)
+
+
+def parse_multipart(headers, body):
+    """Map of field name -> list of payloads."""
+    message = BytesParser(policy=HTTP).parsebytes(
+        b"Content-Type: " + headers["Content-Type"].encode() + b"\r\n\r\n" + body)
+    fields = {}
+    for part in message.iter_parts():
+        name = part.get_param("name", header="content-disposition")
+        fields.setdefault(name, []).append(part.get_payload(decode=True))
+    return fields
+
+
+class SegmentHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    delay = 0.0
+    slow_fraction = 0.0
+    slow_delay = 0.0
+    proto_dtype = "fp16"
+    shape_format = "polygon"
+    deltas = DeltaFrames()
+
+    def do_POST(self):
+        length = int(self.headers.get("Content-Length", 0))
+        body = self.rfile.read(length)
+
+        coding = self.headers.get("Content-Encoding", "identity").strip().lower()
+        try:
+            body = decode_body(coding, body)
+        except (ValueError, zlib.error) as e:
+            self.reply(415 if isinstance(e, ValueError) else 400, "application/json",
+                       json.dumps({"error": str(e)}).encode())
+            return
+
+        if self.path != "/segment":
+            self.reply(404, "application/json", b'{"error": "not found"}')
+            return
+
+        content_type = self.headers.get("Content-Type", "")
+        if content_type.startswith("multipart/form-data"):
+            images = parse_multipart(self.headers, body).get("image", [])
+        else:
+            images = [body]
+
+        # Latency profile: a fixed inference time plus occasional stragglers
+        delay = self.delay
+        if random.random() < self.slow_fraction:
+            delay += self.slow_delay
+        if delay:
+            time.sleep(delay)
+
+        sizes = []
+        for image in images or [b""]:
+            if image[:4] != b"TDLT":
+                sizes.append(image_size(image))
+                continue
+            size = self.deltas.rebuild(image)
+            if size is None:
+                self.reply(409, "application/json", b'{"error": "unknown base frame"}')
+                return
+            sizes.append(size)
+        masks = [person_mask(width, height) for width, height in sizes]
+
+        if PROTOTYPES in self.headers.get("Accept", "") and len(sizes) == 1:
+            width, height = sizes[0]
+            self.reply(200, PROTOTYPES, encode_prototypes(width, height, self.proto_dtype))
+            return
+
+        if SHAPES in self.headers.get("Accept", "") and len(sizes) == 1:
+            width, height = sizes[0]
+            self.reply(200, SHAPES, encode_shapes(width, height, self.shape_format))
+            return
+
+        if BINARY_MASKS in self.headers.get("Accept", ""):
+            payload = b"".join(encode_mask_set([mask], width, height)
+                               for mask, (width, height) in zip(masks, sizes))
+            self.reply(200, BINARY_MASKS, payload)
+            return
+
+        results = [{"masks": [base64.b64encode(encode_png(mask, width, height)).decode()]}
+                   for mask, (width, height) in zip(masks, sizes)]
+        answer = results[0] if len(results) == 1 else {"results": results}
+        self.reply(200, "application/json", json.dumps(answer).encode())
+
+    def reply(self, status, content_type, payload):
+        self.send_response(status)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Accept-Encoding", ", ".join(REQUEST_CODINGS))
+        accepted = [c.split(";")[0].strip() for c in self.headers.get("Accept-Encoding", "").split(",")]
+        if len(payload) > 1024 and "gzip" in accepted:
+            payload = gzip.compress(payload, compresslevel=1)
+            self.send_header("Content-Encoding", "gzip")
+        self.send_header("Content-Length", str(len(payload)))
+        self.end_headers()
+        self.wfile.write(payload)
+
+    def log_message(self, format, *args):
+        pass
+
+
+class StreamHandler(socketserver.BaseRequestHandler):
+    """One persistent streaming session; frames are answered concurrently."""
+    delay = 0.0
+
+    def handle(self):
+        self.send_lock = threading.Lock()
+        stream = self.request.makefile("rb")
+        while True:
+            header = stream.read(STREAM_HEADER.size)
+            if len(header) < STREAM_HEADER.size:
+                return
+            magic, kind, _, _, sequence, timestamp, size = STREAM_HEADER.unpack(header)
+            payload = stream.read(size)
+            if magic != b"SGST" or len(payload) < size:
+                return
+            if kind == STREAM_FRAME:
+                threading.Thread(target=self.answer, args=(sequence, timestamp, payload),
+                                 daemon=True).start()
+
+    def answer(self, sequence, timestamp, image):
+        # Jitter the simulated inference time so answers overtake each other
+        time.sleep(self.delay * random.uniform(0.5, 1.5) or random.uniform(0, 0.01))
+        width, height = image_size(image)
+        payload = encode_mask_set([person_mask(width, height)], width, height)
+        header = STREAM_HEADER.pack(b"SGST", STREAM_RESULT, 0, 0, sequence, timestamp, len(payload))
+        with self.send_lock:
+            try:
+                self.request.sendall(header + payload)
+            except OSError:
+                pass
+
+
+class StreamServer(socketserver.ThreadingTCPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+
+class UnixHTTPServer(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    daemon_threads = True
+
+
+def serve_shm(connection, delay):
+    """One shared memory session: map the client's ring, answer descriptors."""
+    packet, fds, _, _ = socket.recv_fds(connection, DESCRIPTOR.size, 1)
+    if len(packet) != DESCRIPTOR.size or not fds:
+        connection.close()
+        return
+    magic, kind, _, _, _, _, ring_size, _, _ = DESCRIPTOR.unpack(packet)
+    if magic != b"SGSD" or kind != SHM_HELLO:
+        connection.close()
+        return
+    ring = mmap.mmap(fds[0], ring_size)
+    os.close(fds[0])
+    _, _, slots, frame_size, result_size = RING_HEADER.unpack(ring[:RING_HEADER.size])
+    send_lock = threading.Lock()
+
+    def answer(slot, sequence, width, height, timestamp):
+        time.sleep(delay * random.uniform(0.5, 1.5) or random.uniform(0, 0.005))
+        base = RING_HEADER_SIZE + slot * (frame_size + result_size)
+        frame = ring[base:base + width * height]
+        # Foreground where the frame is bright; the box otherwise
+        rows = [bytes(255 if pixel > 127 else 0 for pixel in frame[y * width:(y + 1) * width])
+                for y in range(height)]
+        if not any(any(row) for row in rows):
+            rows = person_mask(width, height)
+        payload = encode_mask_set([rows], width, height)
+        ring[base + frame_size:base + frame_size + len(payload)] = payload
+        reply = DESCRIPTOR.pack(b"SGSD", SHM_RESULT, slot, sequence, width, height,
+                                len(payload), 0, timestamp)
+        with send_lock:
+            try:
+                connection.send(reply)
+            except OSError:
+                pass
+
+    while True:
+        packet = connection.recv(DESCRIPTOR.size)
+        if len(packet) != DESCRIPTOR.size:
+            break
+        magic, kind, slot, sequence, width, height, _, _, timestamp = DESCRIPTOR.unpack(packet)
+        if magic == b"SGSD" and kind == SHM_FRAME and slot < slots:
+            threading.Thread(target=answer, args=(slot, sequence, width, height, timestamp),
+                             daemon=True).start()
+    connection.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8000)
+    parser.add_argument("--delay-ms", type=float, default=0.0,
+                        help="simulated inference time per request")
+    parser.add_argument("--slow-fraction", type=float, default=0.0,
+                        help="fraction of HTTP requests that take --slow-ms longer")
+    parser.add_argument("--slow-ms", type=float, default=0.0,
+                        help="extra time of a slow HTTP request")
+    parser.add_argument("--proto-dtype", choices=("fp16", "int8"), default="fp16",
+                        help="prototype type of application/x-yolo-prototypes answers")
+    parser.add_argument("--shape-format", choices=("polygon", "rle"), default="polygon",
+                        help="mask encoding of application/x-instance-shapes+json answers")
+    parser.add_argument("--stream-port", type=int, default=0,
+                        help="also serve the streaming protocol on this TCP port")
+    parser.add_argument("--unix-socket", default="",
+                        help="also serve HTTP on this Unix domain socket")
+    parser.add_argument("--shm-socket", default="",
+                        help="also serve the shared memory transport on this Unix socket")
+    args = parser.parse_args()
+
+    SegmentHandler.delay = args.delay_ms / 1000.0
+    SegmentHandler.slow_fraction = args.slow_fraction
+    SegmentHandler.slow_delay = args.slow_ms / 1000.0
+    SegmentHandler.proto_dtype = args.proto_dtype
+    SegmentHandler.shape_format = args.shape_format
+    StreamHandler.delay = args.delay_ms / 1000.0
+    if args.stream_port:
+        streams = StreamServer((args.host, args.stream_port), StreamHandler)
+        threading.Thread(target=streams.serve_forever, daemon=True).start()
+        print(f"Mock streaming server on tcp://{args.host}:{args.stream_port}")
+    if args.unix_socket:
+        if os.path.exists(args.unix_socket):
+            os.unlink(args.unix_socket)
+        local = UnixHTTPServer(args.unix_socket, SegmentHandler)
+        threading.Thread(target=local.serve_forever, daemon=True).start()
+        print(f"Mock segmentation server on unix://{args.unix_socket}")
+    if args.shm_socket:
+        if os.path.exists(args.shm_socket):
+            os.unlink(args.shm_socket)
+        listener = socket.socket(socket.AF_UNIX, socket.SOCK_SEQPACKET)
+        listener.bind(args.shm_socket)
+        listener.listen()
+
+        def accept_shm():
+            while True:
+                connection, _ = listener.accept()
+                threading.Thread(target=serve_shm, args=(connection, StreamHandler.delay),
+                                 daemon=True).start()
+
+        threading.Thread(target=accept_shm, daemon=True).start()
+        print(f"Mock shared memory server on shm://{args.shm_socket}")
+    server = ThreadingHTTPServer((args.host, args.port), SegmentHandler)
+    print(f"Mock segmentation server on http://{args.host}:{args.port}/segment")
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
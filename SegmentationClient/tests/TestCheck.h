@@ -0,0 +1,32 @@
+#pragma once
+
+#include <iostream>
+
+// Minimal checks for the test programs. A failed CHECK prints the
+// expression and its location and is counted; main() returns
+// test_check::result() so ctest sees the failure.
+namespace test_check {
+
+inline int& failures() {
+    static int count = 0;
+    return count;
+}
+
+inline void report(bool ok, const char* expression, const char* file, int line) {
+    if (!ok) {
+        std::cerr << file << ":" << line << ": CHECK(" << expression << ") failed" << std::endl;
+        failures()++;
+    }
+}
+
+inline int result() {
+    if (failures() > 0) {
+        std::cerr << failures() << " check(s) failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+} // namespace test_check
+
+#define CHECK(expression) test_check::report(static_cast<bool>(expression), #expression, __FILE__, __LINE__)
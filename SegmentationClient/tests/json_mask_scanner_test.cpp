@@ -0,0 +1,230 @@
+#include "Base64.h"
+#include "JsonMaskScanner.h"
+#include "TestCheck.h"
+#include <random>
+#include <string>
+#include <vector>
+
+// JsonMaskScanner over bodies cut into pieces at every possible byte, the
+// base64 rules it shares with base64::decode(), and malformed documents.
+
+namespace {
+
+const char* kAlphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+std::string encodeBase64(const std::vector<uint8_t>& bytes, bool padded = true) {
+    std::string text;
+    for (size_t i = 0; i < bytes.size(); i += 3) {
+        uint32_t bits = bytes[i] << 16;
+        size_t left = bytes.size() - i;
+        if (left > 1) {
+            bits |= bytes[i + 1] << 8;
+        }
+        if (left > 2) {
+            bits |= bytes[i + 2];
+        }
+        for (size_t k = 0; k < 4; k++) {
+            if (k <= left) {
+                text.push_back(kAlphabet[(bits >> (18 - 6 * k)) & 0x3F]);
+            } else if (padded) {
+                text.push_back('=');
+            }
+        }
+    }
+    return text;
+}
+
+// As a JSON encoder that escapes '/' writes it
+std::string escapeSlashes(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '/') {
+            escaped += "\\/";
+        } else {
+            escaped.push_back(c);
+        }
+    }
+    return escaped;
+}
+
+std::vector<uint8_t> randomBytes(size_t size, std::mt19937& rng) {
+    std::vector<uint8_t> bytes(size);
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (uint8_t& b : bytes) {
+        b = static_cast<uint8_t>(byte(rng));
+    }
+    // Runs of 0xFF encode as '/', so the escape is exercised
+    for (size_t i = 0; i + 3 <= size; i += 17) {
+        bytes[i] = bytes[i + 1] = bytes[i + 2] = 0xFF;
+    }
+    return bytes;
+}
+
+std::vector<uint8_t> maskBytes(const JsonMaskScanner& scanner, size_t index) {
+    const JsonMaskScanner::Mask& mask = scanner.mask(index);
+    return std::vector<uint8_t>(scanner.data(mask), scanner.data(mask) + mask.size);
+}
+
+bool scanPieces(JsonMaskScanner& scanner, const std::string& body, const std::vector<size_t>& cuts) {
+    scanner.reset();
+    size_t start = 0;
+    for (size_t cut : cuts) {
+        if (!scanner.feed(body.data() + start, cut - start)) {
+            return false;
+        }
+        start = cut;
+    }
+    return scanner.feed(body.data() + start, body.size() - start) && scanner.complete();
+}
+
+bool scans(const std::string& body) {
+    JsonMaskScanner scanner;
+    return scanPieces(scanner, body, {});
+}
+
+// The body scans to masks, whole, cut once anywhere and fed byte by byte
+void checkEverySplit(const std::string& body, const std::vector<std::vector<uint8_t>>& masks,
+                     const std::vector<size_t>& results) {
+    JsonMaskScanner scanner;
+    auto matches = [&]() {
+        if (scanner.maskCount() != masks.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < masks.size(); i++) {
+            if (maskBytes(scanner, i) != masks[i] || scanner.mask(i).result != results[i]) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    CHECK(scanPieces(scanner, body, {}) && matches());
+    for (size_t cut = 0; cut <= body.size(); cut++) {
+        bool ok = scanPieces(scanner, body, {cut}) && matches();
+        CHECK(ok);
+        if (!ok) {
+            return;
+        }
+    }
+    std::vector<size_t> everyByte;
+    for (size_t cut = 1; cut < body.size(); cut++) {
+        everyByte.push_back(cut);
+    }
+    CHECK(scanPieces(scanner, body, everyByte) && matches());
+}
+
+void testSplits() {
+    std::mt19937 rng(13);
+    std::vector<uint8_t> a = randomBytes(40, rng);
+    std::vector<uint8_t> b = randomBytes(41, rng);
+    std::vector<uint8_t> c = randomBytes(42, rng);
+
+    // Escapes of every kind around the masks, inside keys and skipped strings
+    std::string body = "{\"id\": \"x\\\"y\\\\z\\u00e9\\/\", \"score\": -1.5E3, \"ok\": true,\n"
+                       "\t\"ma\\u0073ks\": 1, \"masks\": [\"" + escapeSlashes(encodeBase64(a)) + "\", \"" +
+                       encodeBase64(b) + "\" ,\r\n \"" + escapeSlashes(encodeBase64(c, false)) +
+                       "\"], \"none\": null}";
+    checkEverySplit(body, {a, b, c}, {0, 0, 0});
+
+    std::string batch = "{\"results\": [{\"masks\": [\"" + escapeSlashes(encodeBase64(a)) +
+                        "\"]}, {\"masks\": []}, {\"masks\": [\"" + escapeSlashes(encodeBase64(c)) + "\", \"\"]}]}";
+    checkEverySplit(batch, {a, c, {}}, {0, 2, 2});
+
+    JsonMaskScanner scanner;
+    CHECK(scanPieces(scanner, batch, {}));
+    CHECK(scanner.resultCount() == 3);
+    CHECK(scanner.firstMask(1) == nullptr);
+    CHECK(scanner.firstMask(2) != nullptr && scanner.firstMask(2)->offset == a.size());
+}
+
+void testPadding() {
+    std::mt19937 rng(5);
+    for (size_t size = 0; size <= 6; size++) {
+        std::vector<uint8_t> bytes = randomBytes(size, rng);
+        for (bool padded : {true, false}) {
+            checkEverySplit("{\"masks\":[\"" + encodeBase64(bytes, padded) + "\"]}", {bytes}, {0});
+        }
+    }
+
+    CHECK(!scans("{\"masks\":[\"Q\"]}"));
+    CHECK(!scans("{\"masks\":[\"QUJD=\"]}"));
+    CHECK(!scans("{\"masks\":[\"Q===\"]}"));
+    CHECK(!scans("{\"masks\":[\"QQ=A\"]}"));
+    CHECK(!scans("{\"masks\":[\"QQ==QUJD\"]}"));
+    CHECK(!scans("{\"masks\":[\"=\"]}"));
+}
+
+void testWhitespace() {
+    // Between tokens anywhere, never inside a mask
+    CHECK(scans(" \r\n\t{ \"masks\" :\n[ \"QUJD\" , \"QQ==\" ]\t}\r\n "));
+    CHECK(!scans("{\"masks\":[\"QU JD\"]}"));
+    CHECK(!scans("{\"masks\":[\"QUJD\\n\"]}"));
+    CHECK(!scans("{\"masks\":[\"QUJD\\u0041\"]}"));
+    CHECK(!scans("{\"masks\":[\"QUJD\nQUJD\"]}"));
+
+    // base64::decode() follows the same rules, on the vector paths as well
+    std::mt19937 rng(3);
+    std::string text = encodeBase64(randomBytes(95, rng));
+    for (auto implementation : {base64::Implementation::Scalar, base64::Implementation::Sse41,
+                                base64::Implementation::Avx2}) {
+        std::vector<uint8_t> out(base64::decodedSizeBound(text.size()));
+        size_t written = 0;
+        CHECK(base64::decodeWith(implementation, text.data(), text.size(), out.data(), written));
+        CHECK(written == 95);
+        for (size_t position : {size_t(0), size_t(17), size_t(40), text.size() - 3}) {
+            std::string spaced = text;
+            spaced[position] = ' ';
+            CHECK(!base64::decodeWith(implementation, spaced.data(), spaced.size(), out.data(), written));
+        }
+        std::string padded = text.substr(0, 40) + "QQ==" + text.substr(40);
+        CHECK(!base64::decodeWith(implementation, padded.data(), padded.size(), out.data(), written));
+    }
+}
+
+void testMalformed() {
+    CHECK(!scans(""));
+    CHECK(!scans("{\"masks\":[\"QUJD\"]"));
+    CHECK(!scans("{\"masks\":[\"QUJD\"]}}"));
+    CHECK(!scans("{\"masks\":[\"QUJD\"]} {}"));
+    CHECK(!scans("{\"masks\":[\"QUJD\"}"));
+    CHECK(!scans("{\"masks\" [\"QUJD\"]}"));
+    CHECK(!scans("{masks:[]}"));
+    CHECK(!scans("{\"a\":\"\\x\"}"));
+    CHECK(!scans("{\"a\":\"\\u00g0\"}"));
+    CHECK(!scans(std::string(100, '[') + std::string(100, ']')));
+
+    // Nothing is accepted once the scanner failed
+    JsonMaskScanner scanner;
+    CHECK(!scanner.feed("{]", 2));
+    CHECK(!scanner.error().empty());
+    CHECK(!scanner.feed("}", 1));
+    CHECK(!scanner.complete());
+}
+
+void testSink() {
+    JsonMaskSink sink;
+    CHECK(!sink.begin(500, "application/json", -1));
+    CHECK(!sink.begin(200, "text/html", -1));
+
+    // A compressed body's length is unknown; the scanner must still cope
+    std::string body = "{\"masks\":[\"QUJD\"]}";
+    CHECK(sink.begin(200, "application/json; charset=utf-8", -1));
+    CHECK(sink.write(body.data(), body.size()));
+    CHECK(sink.scanner().complete() && sink.scanner().maskCount() == 1);
+
+    // Too small a length only costs a reallocation
+    CHECK(sink.begin(200, "application/json", 4));
+    CHECK(sink.write(body.data(), body.size()));
+    CHECK(sink.scanner().complete() && maskBytes(sink.scanner(), 0) == std::vector<uint8_t>({'A', 'B', 'C'}));
+}
+
+} // namespace
+
+int main() {
+    testSplits();
+    testPadding();
+    testWhitespace();
+    testMalformed();
+    testSink();
+    return test_check::result();
+}
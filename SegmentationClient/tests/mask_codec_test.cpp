@@ -0,0 +1,204 @@
+#include "MaskCodec.h"
+#include "TestCheck.h"
+#include <random>
+#include <vector>
+
+// Round trips through encodeMaskSet() and MaskSetReader for both
+// encodings, and the reader's handling of malformed responses.
+
+using namespace mask_codec;
+
+namespace {
+
+std::vector<uint8_t> randomMask(uint32_t width, uint32_t height, std::mt19937& rng) {
+    // Blocky, so run-length payloads have runs longer than one pixel
+    std::vector<uint8_t> mask(static_cast<size_t>(width) * height);
+    std::uniform_int_distribution<int> coin(0, 3);
+    uint8_t value = 0;
+    for (uint8_t& pixel : mask) {
+        if (coin(rng) == 0) {
+            value = value ? 0 : 1;
+        }
+        pixel = value;
+    }
+    return mask;
+}
+
+// Decodes every instance with a padded stride and compares it to masks
+bool matches(const MaskSetReader& reader, const std::vector<std::vector<uint8_t>>& masks) {
+    const size_t stride = reader.width() + 3;
+    for (size_t i = 0; i < masks.size(); i++) {
+        std::vector<uint8_t> out(stride * reader.height() + 1, 77);
+        if (!reader.decodeInstance(i, out.data(), stride)) {
+            return false;
+        }
+        for (uint32_t y = 0; y < reader.height(); y++) {
+            for (uint32_t x = 0; x < reader.width(); x++) {
+                uint8_t expected = masks[i][y * reader.width() + x] ? 255 : 0;
+                if (out[y * stride + x] != expected) {
+                    return false;
+                }
+            }
+            // Padding between rows is left alone
+            for (size_t x = reader.width(); x < stride && y + 1 < reader.height(); x++) {
+                if (out[y * stride + x] != 77) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+std::vector<uint8_t> encode(uint32_t width, uint32_t height, const std::vector<std::vector<uint8_t>>& masks,
+                            Encoding encoding) {
+    std::vector<const uint8_t*> pointers;
+    for (const auto& mask : masks) {
+        pointers.push_back(mask.data());
+    }
+    return encodeMaskSet(width, height, pointers, encoding);
+}
+
+// A one-instance run-length set with a hand-written payload
+std::vector<uint8_t> runLengthSet(uint32_t width, uint32_t height, const std::vector<uint8_t>& payload) {
+    std::vector<uint8_t> empty(static_cast<size_t>(width) * height);
+    std::vector<uint8_t> data = encode(width, height, {empty}, Encoding::RunLength);
+    data.resize(20);
+    uint32_t size = static_cast<uint32_t>(payload.size());
+    for (int i = 0; i < 4; i++) {
+        data.push_back(static_cast<uint8_t>(size >> (8 * i)));
+    }
+    data.insert(data.end(), payload.begin(), payload.end());
+    return data;
+}
+
+void testRoundTrip(Encoding encoding) {
+    std::mt19937 rng(7);
+    // Odd sizes, so bit-packed rows don't end on byte boundaries
+    const uint32_t width = 13;
+    const uint32_t height = 7;
+    std::vector<std::vector<uint8_t>> masks = {randomMask(width, height, rng), randomMask(width, height, rng),
+                                               std::vector<uint8_t>(width * height, 1)};
+    std::vector<uint8_t> data = encode(width, height, masks, encoding);
+
+    MaskSetReader reader;
+    CHECK(reader.parse(data.data(), data.size()));
+    CHECK(reader.width() == width);
+    CHECK(reader.height() == height);
+    CHECK(reader.encoding() == encoding);
+    CHECK(reader.instanceCount() == masks.size());
+    CHECK(reader.byteSize() == data.size());
+    CHECK(matches(reader, masks));
+    CHECK(!reader.decodeInstance(masks.size(), nullptr, width));
+
+    // A batch: the second set starts where the first one ends
+    std::vector<std::vector<uint8_t>> second = {randomMask(5, 3, rng)};
+    std::vector<uint8_t> batch = data;
+    std::vector<uint8_t> more = encode(5, 3, second, encoding);
+    batch.insert(batch.end(), more.begin(), more.end());
+    CHECK(reader.parse(batch.data(), batch.size()));
+    CHECK(reader.byteSize() == data.size());
+    CHECK(reader.parse(batch.data() + data.size(), batch.size() - data.size()));
+    CHECK(reader.width() == 5 && reader.height() == 3);
+    CHECK(matches(reader, second));
+
+    // Every truncation of the set is caught by parse()
+    for (size_t size = 0; size < data.size(); size++) {
+        std::vector<uint8_t> prefix(data.begin(), data.begin() + size);
+        CHECK(!reader.parse(prefix.data(), prefix.size()));
+    }
+}
+
+void testZeroSize(Encoding encoding) {
+    MaskSetReader reader;
+    for (uint32_t height : {0u, 5u}) {
+        std::vector<std::vector<uint8_t>> masks = {{}};
+        std::vector<uint8_t> data = encode(0, height, masks, encoding);
+        CHECK(reader.parse(data.data(), data.size()));
+        CHECK(reader.instanceCount() == 1);
+        uint8_t out = 0;
+        CHECK(reader.decodeInstance(0, &out, 1));
+    }
+
+    // No instances at all
+    std::vector<uint8_t> data = encode(4, 4, {}, encoding);
+    CHECK(reader.parse(data.data(), data.size()));
+    CHECK(reader.instanceCount() == 0);
+}
+
+void testMalformed() {
+    MaskSetReader reader;
+    std::vector<uint8_t> mask(16, 1);
+    std::vector<uint8_t> good = encode(4, 4, {mask}, Encoding::BitPacked);
+
+    std::vector<uint8_t> data = good;
+    data[0] = 'X';
+    CHECK(!reader.parse(data.data(), data.size()));
+    data = good;
+    data[4] = 2;
+    CHECK(!reader.parse(data.data(), data.size()));
+    data = good;
+    data[5] = 2;
+    CHECK(!reader.parse(data.data(), data.size()));
+
+    // Dimensions past the limit
+    data = good;
+    data[10] = 1;
+    CHECK(!reader.parse(data.data(), data.size()));
+
+    // An instance count far beyond the data
+    data = good;
+    data[19] = 0x7F;
+    CHECK(!reader.parse(data.data(), data.size()));
+
+    // An instance size field larger than what follows
+    data = good;
+    data[23] = 0x7F;
+    CHECK(!reader.parse(data.data(), data.size()));
+
+    // Bit-packed payload one byte short
+    data = good;
+    data[20] = 1;
+    data.pop_back();
+    CHECK(reader.parse(data.data(), data.size()));
+    std::vector<uint8_t> out(16);
+    CHECK(!reader.decodeInstance(0, out.data(), 4));
+
+    // Runs past the end of the image, in one run and summed over several
+    data = runLengthSet(4, 4, {17});
+    CHECK(reader.parse(data.data(), data.size()));
+    CHECK(!reader.decodeInstance(0, out.data(), 4));
+    data = runLengthSet(4, 4, {10, 6, 1});
+    CHECK(reader.parse(data.data(), data.size()));
+    CHECK(!reader.decodeInstance(0, out.data(), 4));
+
+    // A run too long for 64 bits, and one cut off mid-varint
+    data = runLengthSet(4, 4, std::vector<uint8_t>(10, 0xFF));
+    CHECK(reader.parse(data.data(), data.size()));
+    CHECK(!reader.decodeInstance(0, out.data(), 4));
+    data = runLengthSet(4, 4, {0x80});
+    CHECK(reader.parse(data.data(), data.size()));
+    CHECK(!reader.decodeInstance(0, out.data(), 4));
+
+    // Runs that stop short of the image
+    data = runLengthSet(4, 4, {3, 4});
+    CHECK(reader.parse(data.data(), data.size()));
+    CHECK(!reader.decodeInstance(0, out.data(), 4));
+
+    // Exactly covering runs, split across rows
+    data = runLengthSet(4, 4, {3, 6, 7});
+    CHECK(reader.parse(data.data(), data.size()));
+    CHECK(reader.decodeInstance(0, out.data(), 4));
+    CHECK(out[2] == 0 && out[3] == 255 && out[8] == 255 && out[9] == 0 && out[15] == 0);
+}
+
+} // namespace
+
+int main() {
+    testRoundTrip(Encoding::BitPacked);
+    testRoundTrip(Encoding::RunLength);
+    testZeroSize(Encoding::BitPacked);
+    testZeroSize(Encoding::RunLength);
+    testMalformed();
+    return test_check::result();
+}
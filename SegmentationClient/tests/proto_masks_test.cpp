@@ -0,0 +1,159 @@
+#include "ProtoMasks.h"
+#include "TestCheck.h"
+#include <cstring>
+#include <vector>
+
+// ProtoSetReader on well-formed responses of both prototype types, every
+// truncation of one, and headers whose sizes don't add up.
+
+using namespace proto_masks;
+
+namespace {
+
+void putLE(std::vector<uint8_t>& out, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+void putFloat(std::vector<uint8_t>& out, float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    putLE(out, bits, 4);
+}
+
+struct Response {
+    PrototypeType type = PrototypeType::Float16;
+    uint32_t count = 3;
+    uint32_t width = 4;
+    uint32_t height = 2;
+    uint32_t instances = 2;
+
+    std::vector<uint8_t> build() const {
+        std::vector<uint8_t> data = {'Y', 'P', 'R', 'T', 1, static_cast<uint8_t>(type)};
+        putLE(data, count, 2);
+        putLE(data, width, 2);
+        putLE(data, height, 2);
+        putLE(data, 640, 4);
+        putLE(data, 320, 4);
+        putFloat(data, type == PrototypeType::Int8 ? 0.5f : 0.0f);
+        putLE(data, instances, 4);
+        for (uint32_t i = 0; i < instances; i++) {
+            for (float value : {1.0f + i, 2.0f, 300.5f, 200.25f, 0.75f}) {
+                putFloat(data, value);
+            }
+            for (uint32_t k = 0; k < count; k++) {
+                putFloat(data, 0.125f * k - static_cast<float>(i));
+            }
+        }
+        size_t values = static_cast<size_t>(count) * width * height * (type == PrototypeType::Float16 ? 2 : 1);
+        for (size_t v = 0; v < values; v++) {
+            data.push_back(static_cast<uint8_t>(v));
+        }
+        return data;
+    }
+};
+
+void testWellFormed(PrototypeType type) {
+    Response response;
+    response.type = type;
+    std::vector<uint8_t> data = response.build();
+
+    ProtoSetReader reader;
+    CHECK(reader.parse(data.data(), data.size()));
+    CHECK(reader.prototypeType() == type);
+    CHECK(reader.prototypeCount() == 3);
+    CHECK(reader.prototypeWidth() == 4 && reader.prototypeHeight() == 2);
+    CHECK(reader.imageWidth() == 640 && reader.imageHeight() == 320);
+    CHECK(reader.int8Scale() == (type == PrototypeType::Int8 ? 0.5f : 0.0f));
+    CHECK(reader.instanceCount() == 2);
+    CHECK(reader.instance(1).box[0] == 2.0f && reader.instance(1).box[3] == 200.25f);
+    CHECK(reader.instance(1).score == 0.75f);
+
+    float coefficients[3];
+    reader.coefficients(1, coefficients);
+    CHECK(coefficients[0] == -1.0f && coefficients[2] == -0.75f);
+
+    size_t instanceSize = (5 + 3) * 4;
+    CHECK(reader.prototypes() == data.data() + 28 + 2 * instanceSize);
+    CHECK(reader.prototypes()[5] == 5);
+
+    // No detections is a valid answer
+    response.instances = 0;
+    data = response.build();
+    CHECK(reader.parse(data.data(), data.size()));
+    CHECK(reader.instanceCount() == 0);
+    CHECK(reader.prototypes() == data.data() + 28);
+}
+
+void testTruncated() {
+    std::vector<uint8_t> data = Response().build();
+    ProtoSetReader reader;
+    for (size_t size = 0; size < data.size(); size++) {
+        std::vector<uint8_t> prefix(data.begin(), data.begin() + size);
+        CHECK(!reader.parse(prefix.data(), prefix.size()));
+        CHECK(reader.instanceCount() == 0 && reader.prototypes() == nullptr);
+    }
+
+    // Trailing bytes don't belong to the response either
+    data.push_back(0);
+    CHECK(!reader.parse(data.data(), data.size()));
+}
+
+void testBadHeaders() {
+    const std::vector<uint8_t> good = Response().build();
+    ProtoSetReader reader;
+    std::vector<uint8_t> data;
+
+    data = good;
+    data[0] = 'X';
+    CHECK(!reader.parse(data.data(), data.size()));
+    data = good;
+    data[4] = 2;
+    CHECK(!reader.parse(data.data(), data.size()));
+    data = good;
+    data[5] = 2;
+    CHECK(!reader.parse(data.data(), data.size()));
+
+    // Instance counts that overflow or outrun the data
+    for (uint32_t count : {3u, 0x10000000u, 0xFFFFFFFFu}) {
+        data = good;
+        for (int i = 0; i < 4; i++) {
+            data[24 + i] = static_cast<uint8_t>(count >> (8 * i));
+        }
+        CHECK(!reader.parse(data.data(), data.size()));
+        CHECK(!reader.error().empty());
+    }
+
+    // Dimensions out of range: no prototypes, too many, zero-sized planes,
+    // and an image past the limit
+    Response response;
+    response.count = 0;
+    data = response.build();
+    CHECK(!reader.parse(data.data(), data.size()));
+    response.count = 257;
+    data = response.build();
+    CHECK(!reader.parse(data.data(), data.size()));
+    response = Response();
+    response.width = 0;
+    data = response.build();
+    CHECK(!reader.parse(data.data(), data.size()));
+    data = good;
+    data[14] = 1;
+    CHECK(!reader.parse(data.data(), data.size()));
+
+    // A prototype type that doesn't match the data size
+    data = good;
+    data[5] = static_cast<uint8_t>(PrototypeType::Int8);
+    CHECK(!reader.parse(data.data(), data.size()));
+}
+
+} // namespace
+
+int main() {
+    testWellFormed(PrototypeType::Float16);
+    testWellFormed(PrototypeType::Int8);
+    testTruncated();
+    testBadHeaders();
+    return test_check::result();
+}
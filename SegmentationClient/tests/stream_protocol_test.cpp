@@ -0,0 +1,180 @@
+#include "ReorderBuffer.h"
+#include "StreamProtocol.h"
+#include "TestCheck.h"
+#include <string>
+#include <vector>
+
+// StreamDecoder over streams cut at every byte and with bad headers, and
+// ReorderBuffer with results out of order, duplicated and lost.
+
+namespace {
+
+void appendMessage(std::vector<uint8_t>& stream, StreamMessageType type, uint32_t sequence,
+                   uint64_t timestamp_us, const std::vector<uint8_t>& payload) {
+    size_t start = stream.size();
+    stream.resize(start + kStreamHeaderSize);
+    encodeStreamHeader(type, sequence, timestamp_us, static_cast<uint32_t>(payload.size()), stream.data() + start);
+    stream.insert(stream.end(), payload.begin(), payload.end());
+}
+
+std::vector<uint8_t> header(StreamMessageType type, uint32_t payload_size) {
+    std::vector<uint8_t> bytes(kStreamHeaderSize);
+    encodeStreamHeader(type, 1, 0, payload_size, bytes.data());
+    return bytes;
+}
+
+// The three messages of testSplits()
+bool expected(const std::vector<StreamMessage>& messages) {
+    return messages.size() == 3 && messages[0].type == StreamMessageType::Result && messages[0].sequence == 7 &&
+           messages[0].timestamp_us == 0x0102030405060708ull && messages[0].payload == std::vector<uint8_t>{1, 2, 3} &&
+           messages[1].type == StreamMessageType::Result && messages[1].sequence == 0xFFFFFFFFu &&
+           messages[1].payload.empty() && messages[2].type == StreamMessageType::Error &&
+           std::string(messages[2].payload.begin(), messages[2].payload.end()) == "no model" && !messages[2].expired;
+}
+
+void testSplits() {
+    std::vector<uint8_t> stream;
+    appendMessage(stream, StreamMessageType::Result, 7, 0x0102030405060708ull, {1, 2, 3});
+    appendMessage(stream, StreamMessageType::Result, 0xFFFFFFFFu, 1, {});
+    appendMessage(stream, StreamMessageType::Error, 9, 2, {'n', 'o', ' ', 'm', 'o', 'd', 'e', 'l'});
+
+    for (size_t cut = 0; cut <= stream.size(); cut++) {
+        StreamDecoder decoder;
+        std::vector<StreamMessage> messages;
+        CHECK(decoder.feed(stream.data(), cut, messages));
+        CHECK(decoder.feed(stream.data() + cut, stream.size() - cut, messages));
+        CHECK(expected(messages));
+    }
+
+    StreamDecoder decoder;
+    std::vector<StreamMessage> messages;
+    for (size_t i = 0; i < stream.size(); i++) {
+        CHECK(decoder.feed(stream.data() + i, 1, messages));
+    }
+    CHECK(expected(messages));
+
+    // A partial message is held back until its last byte
+    StreamDecoder partial;
+    messages.clear();
+    CHECK(partial.feed(stream.data(), kStreamHeaderSize + 2, messages));
+    CHECK(messages.empty());
+    CHECK(partial.feed(stream.data() + kStreamHeaderSize + 2, 1, messages));
+    CHECK(messages.size() == 1);
+}
+
+void testLengthPrefix() {
+    // The largest payload allowed only waits for its data
+    StreamDecoder decoder;
+    std::vector<StreamMessage> messages;
+    std::vector<uint8_t> bytes = header(StreamMessageType::Result, kMaxStreamPayload);
+    CHECK(decoder.feed(bytes.data(), bytes.size(), messages));
+    CHECK(messages.empty() && decoder.error().empty());
+
+    // One byte more is a protocol error, even before any payload arrives
+    for (uint32_t size : {kMaxStreamPayload + 1, 0xFFFFFFFFu}) {
+        StreamDecoder oversized;
+        bytes = header(StreamMessageType::Result, size);
+        CHECK(!oversized.feed(bytes.data(), bytes.size(), messages));
+        CHECK(!oversized.error().empty());
+        CHECK(messages.empty());
+    }
+
+    // A length prefix cut short is not an error yet
+    StreamDecoder truncated;
+    bytes = header(StreamMessageType::Result, 5);
+    CHECK(truncated.feed(bytes.data(), kStreamHeaderSize - 1, messages));
+    CHECK(messages.empty() && truncated.error().empty());
+}
+
+void testBadHeaders() {
+    std::vector<StreamMessage> messages;
+    std::vector<uint8_t> bytes = header(StreamMessageType::Result, 0);
+    bytes[0] = 'X';
+    StreamDecoder magic;
+    CHECK(!magic.feed(bytes.data(), bytes.size(), messages));
+
+    for (uint8_t type : {uint8_t(0), uint8_t(4), uint8_t(255)}) {
+        bytes = header(StreamMessageType::Result, 0);
+        bytes[4] = type;
+        StreamDecoder decoder;
+        CHECK(!decoder.feed(bytes.data(), bytes.size(), messages));
+    }
+
+    // A good message followed by garbage: the first is delivered, then the
+    // stream stays unusable
+    bytes = header(StreamMessageType::Result, 0);
+    bytes.resize(2 * kStreamHeaderSize, 0);
+    StreamDecoder decoder;
+    CHECK(!decoder.feed(bytes.data(), bytes.size(), messages));
+    CHECK(messages.size() == 1);
+    std::vector<uint8_t> good = header(StreamMessageType::Result, 0);
+    CHECK(!decoder.feed(good.data(), good.size(), messages));
+    CHECK(messages.size() == 1);
+}
+
+std::vector<uint32_t> sequences(const std::vector<ReorderBuffer<int>::Entry>& ready) {
+    std::vector<uint32_t> result;
+    for (const auto& entry : ready) {
+        result.push_back(entry.first);
+    }
+    return result;
+}
+
+void testReorder() {
+    std::vector<ReorderBuffer<int>::Entry> ready;
+
+    ReorderBuffer<int> buffer(1, 8);
+    CHECK(buffer.push(3, 30, ready));
+    CHECK(buffer.push(2, 20, ready));
+    CHECK(ready.empty() && buffer.held() == 2);
+    CHECK(buffer.push(1, 10, ready));
+    CHECK(sequences(ready) == std::vector<uint32_t>({1, 2, 3}));
+    CHECK(ready[0].second == 10 && ready[2].second == 30);
+    CHECK(buffer.nextSequence() == 4 && buffer.held() == 0);
+
+    // Duplicates: a released sequence is late, a held one keeps the first
+    ready.clear();
+    CHECK(!buffer.push(2, 21, ready));
+    CHECK(buffer.late() == 1);
+    CHECK(buffer.push(5, 50, ready));
+    CHECK(buffer.push(5, 51, ready));
+    CHECK(buffer.held() == 1);
+    CHECK(buffer.push(4, 40, ready));
+    CHECK(sequences(ready) == std::vector<uint32_t>({4, 5}));
+    CHECK(ready[1].second == 50);
+
+    // A lost sequence is skipped once too much waits behind it, and dropped
+    // as late if it turns up after all
+    ReorderBuffer<int> lossy(10, 2);
+    ready.clear();
+    CHECK(lossy.push(12, 0, ready));
+    CHECK(lossy.push(11, 0, ready));
+    CHECK(ready.empty());
+    CHECK(lossy.push(14, 0, ready));
+    CHECK(sequences(ready) == std::vector<uint32_t>({11, 12}));
+    CHECK(lossy.skipped() == 1 && lossy.nextSequence() == 13);
+    CHECK(!lossy.push(10, 0, ready));
+    CHECK(lossy.late() == 1);
+    CHECK(lossy.push(16, 0, ready));
+    CHECK(lossy.push(17, 0, ready));
+    CHECK(sequences(ready) == std::vector<uint32_t>({11, 12, 14}));
+    CHECK(lossy.skipped() == 2 && lossy.nextSequence() == 15 && lossy.held() == 2);
+
+    // max_held 0 still holds one result
+    ReorderBuffer<int> minimal(1, 0);
+    ready.clear();
+    CHECK(minimal.push(2, 0, ready));
+    CHECK(ready.empty());
+    CHECK(minimal.push(3, 0, ready));
+    CHECK(sequences(ready) == std::vector<uint32_t>({2, 3}));
+}
+
+} // namespace
+
+int main() {
+    testSplits();
+    testLengthPrefix();
+    testBadHeaders();
+    testReorder();
+    return test_check::result();
+}
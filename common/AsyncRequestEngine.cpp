@@ -0,0 +1,391 @@
+#include "AsyncRequestEngine.h"
+#include <algorithm>
+#include <iostream>
+
+AsyncRequestEngine::AsyncRequestEngine(size_t max_in_flight, size_t max_queued,
+                                       std::shared_ptr<CurlShare> share)
+    : m_maxInFlight(max_in_flight > 0 ? max_in_flight : 1),
+      m_maxQueued(max_queued > 0 ? max_queued : 1),
+      m_share(std::move(share)),
+      m_multi(nullptr),
+      m_isRunning(true),
+      m_maxStreams(100),
+      m_streamsChanged(false),
+      m_nextId(1),
+      m_inFlight(0) {
+    ensureCurlGlobalInit();
+
+    m_multi = curl_multi_init();
+    curl_multi_setopt(m_multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, static_cast<long>(m_maxInFlight));
+
+    // HTTP/2 requests share connections as concurrent streams
+    curl_multi_setopt(m_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(m_multi, CURLMOPT_MAX_CONCURRENT_STREAMS, m_maxStreams.load());
+
+    m_ioThread = std::thread(&AsyncRequestEngine::ioLoop, this);
+}
+
+AsyncRequestEngine::~AsyncRequestEngine() {
+    stop();
+
+    for (CURL* easy : m_idleHandles) {
+        curl_easy_cleanup(easy);
+    }
+    curl_multi_cleanup(m_multi);
+}
+
+void AsyncRequestEngine::stop() {
+    // Signal the I/O thread to stop and wake it up. Under the lock, so a
+    // request is either queued in time to be failed or refused by submit().
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_isRunning = false;
+    }
+    curl_multi_wakeup(m_multi);
+    m_queueSpace.notify_all();
+
+    if (m_ioThread.joinable()) {
+        m_ioThread.join();
+    }
+}
+
+AsyncRequestEngine::RequestId AsyncRequestEngine::submit(HttpRequest request, Callback callback) {
+    auto transfer = std::make_unique<Transfer>();
+    transfer->request = std::move(request);
+    transfer->callback = std::move(callback);
+
+    // Waiting on the I/O thread would deadlock: it is the one freeing room
+    bool onIoThread = std::this_thread::get_id() == m_ioThread.get_id();
+
+    RequestId id = 0;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        // Backpressure: wait for room in the queue
+        m_queueSpace.wait(lock, [this, onIoThread] {
+            return m_pending.size() < m_maxQueued || onIoThread || !m_isRunning;
+        });
+
+        id = m_nextId++;
+        transfer->id = id;
+        if (m_isRunning) {
+            m_pending.push_back(std::move(transfer));
+        }
+    }
+
+    if (transfer) {
+        // The engine is shutting down
+        transfer->response.error = "Request engine stopped";
+        transfer->callback(std::move(transfer->response));
+        return id;
+    }
+
+    curl_multi_wakeup(m_multi);
+    return id;
+}
+
+std::future<HttpResponse> AsyncRequestEngine::submit(HttpRequest request) {
+    auto promise = std::make_shared<std::promise<HttpResponse>>();
+    std::future<HttpResponse> future = promise->get_future();
+
+    submit(std::move(request), [promise](HttpResponse&& response) {
+        promise->set_value(std::move(response));
+    });
+
+    return future;
+}
+
+void AsyncRequestEngine::cancel(RequestId id) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cancelled.insert(id);
+    }
+    curl_multi_wakeup(m_multi);
+}
+
+void AsyncRequestEngine::schedule(std::chrono::milliseconds delay, std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_timers.push_back({std::chrono::steady_clock::now() + delay, std::move(task)});
+    }
+    curl_multi_wakeup(m_multi);
+}
+
+void AsyncRequestEngine::setMaxStreamsPerConnection(long max_streams) {
+    // Applied by the I/O thread, the multi handle is not thread-safe
+    m_maxStreams = max_streams > 0 ? max_streams : 1;
+    m_streamsChanged = true;
+    curl_multi_wakeup(m_multi);
+}
+
+size_t AsyncRequestEngine::inFlight() const {
+    return m_inFlight;
+}
+
+size_t AsyncRequestEngine::queued() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pending.size();
+}
+
+void AsyncRequestEngine::ioLoop() {
+    while (m_isRunning) {
+        if (m_streamsChanged.exchange(false)) {
+            curl_multi_setopt(m_multi, CURLMOPT_MAX_CONCURRENT_STREAMS, m_maxStreams.load());
+        }
+
+        int timeoutMs = std::min(runTimers(), expirePending());
+        processCancellations();
+        startPending();
+
+        int stillRunning = 0;
+        curl_multi_perform(m_multi, &stillRunning);
+
+        // Collect finished transfers
+        bool finishedAny = false;
+        int messagesLeft = 0;
+        while (CURLMsg* message = curl_multi_info_read(m_multi, &messagesLeft)) {
+            if (message->msg == CURLMSG_DONE) {
+                finishTransfer(message->easy_handle, message->data.result);
+                finishedAny = true;
+            }
+        }
+
+        // Freed slots go straight to queued requests
+        if (finishedAny) {
+            continue;
+        }
+
+        // Sleep until there is socket activity, a wakeup from submit() or
+        // cancel(), or the next timer or queued deadline is due
+        curl_multi_poll(m_multi, nullptr, 0, timeoutMs, nullptr);
+    }
+
+    cancelAll("Request engine stopped");
+}
+
+void AsyncRequestEngine::startPending() {
+    std::vector<std::unique_ptr<Transfer>> starting;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        while (!m_pending.empty() && m_active.size() + starting.size() < m_maxInFlight) {
+            starting.push_back(std::move(m_pending.front()));
+            m_pending.pop_front();
+        }
+    }
+
+    if (starting.empty()) {
+        return;
+    }
+    m_queueSpace.notify_all();
+
+    for (auto& transfer : starting) {
+        // Reuse an idle easy handle when possible, it may hold a live connection
+        if (!m_idleHandles.empty()) {
+            transfer->easy = m_idleHandles.back();
+            m_idleHandles.pop_back();
+            curl_easy_reset(transfer->easy);
+        } else {
+            transfer->easy = curl_easy_init();
+        }
+
+        bindTransfer(*transfer);
+        m_active.push_back(std::move(transfer));
+    }
+
+    m_inFlight = m_active.size();
+}
+
+void AsyncRequestEngine::processCancellations() {
+    std::unordered_set<RequestId> cancelled;
+    std::vector<std::unique_ptr<Transfer>> aborted;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_cancelled.empty()) {
+            return;
+        }
+        cancelled.swap(m_cancelled);
+
+        for (auto it = m_pending.begin(); it != m_pending.end();) {
+            if (cancelled.count((*it)->id)) {
+                aborted.push_back(std::move(*it));
+                it = m_pending.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    m_queueSpace.notify_all();
+
+    // Removing a running transfer aborts it on the wire
+    for (auto it = m_active.begin(); it != m_active.end();) {
+        if (cancelled.count((*it)->id)) {
+            releaseTransfer(**it);
+            aborted.push_back(std::move(*it));
+            it = m_active.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    m_inFlight = m_active.size();
+
+    for (auto& transfer : aborted) {
+        transfer->response = HttpResponse();
+        transfer->response.error = "Request cancelled";
+        try {
+            transfer->callback(std::move(transfer->response));
+        } catch (const std::exception& e) {
+            std::cerr << "Request callback error: " << e.what() << std::endl;
+        }
+    }
+}
+
+int AsyncRequestEngine::expirePending() {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::unique_ptr<Transfer>> expired;
+    int timeoutMs = 1000;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_pending.begin(); it != m_pending.end();) {
+            const auto& deadline = (*it)->request.deadline;
+            if (deadline.time_since_epoch().count() == 0) {
+                ++it;
+            } else if (deadline <= now) {
+                expired.push_back(std::move(*it));
+                it = m_pending.erase(it);
+            } else {
+                auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+                timeoutMs = std::min(timeoutMs, static_cast<int>(wait));
+                ++it;
+            }
+        }
+    }
+
+    if (expired.empty()) {
+        return timeoutMs;
+    }
+    m_queueSpace.notify_all();
+
+    // Not worth sending any more
+    for (auto& transfer : expired) {
+        transfer->response.error = "Deadline exceeded before sending";
+        transfer->response.expired = DeadlineExpiry::BeforeSending;
+        try {
+            transfer->callback(std::move(transfer->response));
+        } catch (const std::exception& e) {
+            std::cerr << "Request callback error: " << e.what() << std::endl;
+        }
+    }
+    return timeoutMs;
+}
+
+int AsyncRequestEngine::runTimers() {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<Timer> due;
+    int timeoutMs = 1000;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_timers.begin(); it != m_timers.end();) {
+            if (it->due <= now) {
+                due.push_back(std::move(*it));
+                it = m_timers.erase(it);
+                continue;
+            }
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(it->due - now).count() + 1;
+            timeoutMs = std::min(timeoutMs, static_cast<int>(wait));
+            ++it;
+        }
+    }
+
+    for (Timer& timer : due) {
+        try {
+            timer.task();
+        } catch (const std::exception& e) {
+            std::cerr << "Scheduled task error: " << e.what() << std::endl;
+        }
+    }
+
+    // Tasks may have scheduled new timers; poll briefly and look again
+    return due.empty() ? timeoutMs : 0;
+}
+
+void AsyncRequestEngine::bindTransfer(Transfer& transfer) {
+    transfer.binding = std::make_unique<RequestBinding>(transfer.easy, transfer.request,
+                                                        transfer.response, m_share);
+    curl_easy_setopt(transfer.easy, CURLOPT_PRIVATE, &transfer);
+    curl_multi_add_handle(m_multi, transfer.easy);
+}
+
+void AsyncRequestEngine::restartTransfer(Transfer& transfer) {
+    curl_multi_remove_handle(m_multi, transfer.easy);
+    transfer.binding.reset();
+    transfer.response = HttpResponse();
+
+    curl_easy_reset(transfer.easy);
+    bindTransfer(transfer);
+}
+
+void AsyncRequestEngine::finishTransfer(CURL* easy, CURLcode result) {
+    Transfer* finished = nullptr;
+    curl_easy_getinfo(easy, CURLINFO_PRIVATE, reinterpret_cast<char**>(&finished));
+
+    for (auto it = m_active.begin(); it != m_active.end(); ++it) {
+        if (it->get() != finished) {
+            continue;
+        }
+
+        if ((*it)->binding->rejectedHttp2(result)) {
+            // The server does not speak h2c: retry over HTTP/1.1 in place
+            restartTransfer(**it);
+            return;
+        }
+
+        std::unique_ptr<Transfer> transfer = std::move(*it);
+        m_active.erase(it);
+        m_inFlight = m_active.size();
+
+        transfer->binding->complete(result);
+        releaseTransfer(*transfer);
+
+        try {
+            transfer->callback(std::move(transfer->response));
+        } catch (const std::exception& e) {
+            std::cerr << "Request callback error: " << e.what() << std::endl;
+        }
+        return;
+    }
+}
+
+void AsyncRequestEngine::releaseTransfer(Transfer& transfer) {
+    curl_multi_remove_handle(m_multi, transfer.easy);
+    transfer.binding.reset();
+
+    // Keep the handle (and its connection) for the next transfer
+    m_idleHandles.push_back(transfer.easy);
+    transfer.easy = nullptr;
+}
+
+void AsyncRequestEngine::cancelAll(const std::string& reason) {
+    std::deque<std::unique_ptr<Transfer>> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        pending.swap(m_pending);
+    }
+    m_queueSpace.notify_all();
+
+    for (auto& transfer : m_active) {
+        releaseTransfer(*transfer);
+        pending.push_back(std::move(transfer));
+    }
+    m_active.clear();
+    m_inFlight = 0;
+
+    // Runs from the destructor too: a throwing callback must not escape it
+    for (auto& transfer : pending) {
+        transfer->response.error = reason;
+        try {
+            transfer->callback(std::move(transfer->response));
+        } catch (const std::exception& e) {
+            std::cerr << "Request callback error: " << e.what() << std::endl;
+        }
+    }
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "HttpSession.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// Event-driven HTTP client built on the curl multi interface. A single I/O
+// thread drives up to max_in_flight transfers concurrently, so network
+// waits overlap without spawning a thread per request. Requests with
+// HttpVersion::Http2 are multiplexed as concurrent streams over a shared
+// connection instead of needing one connection each.
+//
+// Requests beyond the in-flight window wait in a queue of at most
+// max_queued entries; once that queue is full submit() blocks, which gives
+// producers (e.g. a camera loop) natural backpressure. Requests submitted
+// from the I/O thread itself (callbacks, scheduled tasks) never block; they
+// are queued past the limit instead.
+//
+// A request's deadline (HttpRequest::deadline) is enforced in both places:
+// queued requests that expire are failed without being sent, and transfers
+// still running at their deadline are aborted by libcurl.
+class AsyncRequestEngine {
+public:
+    // Completion callback, invoked on the I/O thread. Keep it short: while
+    // it runs no other transfer makes progress.
+    using Callback = std::function<void(HttpResponse&&)>;
+
+    // Identifies a submitted request, e.g. to cancel it (never 0)
+    using RequestId = uint64_t;
+
+    AsyncRequestEngine(size_t max_in_flight = 4, size_t max_queued = 8,
+                       std::shared_ptr<CurlShare> share = nullptr);
+    ~AsyncRequestEngine();
+
+    AsyncRequestEngine(const AsyncRequestEngine&) = delete;
+    AsyncRequestEngine& operator=(const AsyncRequestEngine&) = delete;
+
+    // Fail everything queued or on the wire and stop the I/O thread; later
+    // requests fail at once. Called by the destructor; call it earlier when
+    // callbacks hand work to objects that go away before the engine. Not
+    // from a callback.
+    void stop();
+
+    // Queue a request; the response is delivered through the callback
+    RequestId submit(HttpRequest request, Callback callback);
+
+    // Queue a request; the response is delivered through the future
+    std::future<HttpResponse> submit(HttpRequest request);
+
+    // Abort a queued or running request; its callback gets an error
+    // response. Requests that already completed are left alone.
+    void cancel(RequestId id);
+
+    // Run task on the I/O thread once delay has passed (e.g. a hedging or
+    // timeout check). Tasks still pending when the engine stops are dropped.
+    void schedule(std::chrono::milliseconds delay, std::function<void()> task);
+
+    // Transfers currently on the wire / waiting for a slot
+    size_t inFlight() const;
+    size_t queued() const;
+
+    size_t maxInFlight() const { return m_maxInFlight; }
+
+    // Upper bound of concurrent HTTP/2 streams on one connection (default 100)
+    void setMaxStreamsPerConnection(long max_streams);
+
+private:
+    struct Transfer {
+        RequestId id = 0;
+        HttpRequest request;
+        HttpResponse response;
+        Callback callback;
+        CURL* easy = nullptr;
+        std::unique_ptr<RequestBinding> binding;
+    };
+
+    const size_t m_maxInFlight;
+    const size_t m_maxQueued;
+    std::shared_ptr<CurlShare> m_share;
+
+    CURLM* m_multi;
+    std::thread m_ioThread;
+    std::atomic<bool> m_isRunning;
+    std::atomic<long> m_maxStreams;
+    std::atomic<bool> m_streamsChanged;
+
+    // Submitted but not started yet (guarded by m_mutex)
+    std::deque<std::unique_ptr<Transfer>> m_pending;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_queueSpace;
+    RequestId m_nextId;
+
+    // Cancellations and timers for the I/O thread (guarded by m_mutex)
+    std::unordered_set<RequestId> m_cancelled;
+    struct Timer {
+        std::chrono::steady_clock::time_point due;
+        std::function<void()> task;
+    };
+    std::vector<Timer> m_timers;
+
+    // Owned by the I/O thread
+    std::vector<std::unique_ptr<Transfer>> m_active;
+    std::vector<CURL*> m_idleHandles;
+    std::atomic<size_t> m_inFlight;
+
+    void ioLoop();
+    void startPending();
+    void processCancellations();
+    int expirePending();
+    int runTimers();
+    void bindTransfer(Transfer& transfer);
+    void restartTransfer(Transfer& transfer);
+    void finishTransfer(CURL* easy, CURLcode result);
+    void cancelAll(const std::string& reason);
+    void releaseTransfer(Transfer& transfer);
+};
@@ -0,0 +1,300 @@
+#include "Base64.h"
+#include <algorithm>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    #define BASE64_X86_SIMD 1
+    #include <immintrin.h>
+#endif
+
+namespace base64 {
+
+namespace {
+
+// Symbol values; -1 for everything outside the alphabet
+struct SymbolTable {
+    int8_t values[256];
+
+    SymbolTable() {
+        std::fill(values, values + 256, static_cast<int8_t>(-1));
+        const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (int i = 0; i < 64; i++) {
+            values[static_cast<uint8_t>(alphabet[i])] = static_cast<int8_t>(i);
+        }
+    }
+};
+
+// Built on first use, so decoding works during static initialization too
+const int8_t* symbolValues() {
+    static const SymbolTable table;
+    return table.values;
+}
+
+size_t decodeBlocksScalar(const char* in, size_t size, uint8_t* out) {
+    const int8_t* table = symbolValues();
+    size_t i = 0;
+    for (; size - i >= 4; i += 4) {
+        int a = table[static_cast<uint8_t>(in[i])];
+        int b = table[static_cast<uint8_t>(in[i + 1])];
+        int c = table[static_cast<uint8_t>(in[i + 2])];
+        int d = table[static_cast<uint8_t>(in[i + 3])];
+        if ((a | b | c | d) < 0) {
+            break;
+        }
+
+        uint32_t bits = (a << 18) | (b << 12) | (c << 6) | d;
+        out[0] = static_cast<uint8_t>(bits >> 16);
+        out[1] = static_cast<uint8_t>(bits >> 8);
+        out[2] = static_cast<uint8_t>(bits);
+        out += 3;
+    }
+    return i;
+}
+
+#ifdef BASE64_X86_SIMD
+
+// Vector decoding after Muła and Lemire, "Faster Base64 Encoding and
+// Decoding Using AVX2 Instructions" (2018). Two nibble lookups classify
+// every byte at once: lo & hi is non-zero exactly for bytes outside the
+// alphabet. A third lookup, on the high nibble (with '/' told apart from
+// '+'), gives the offset from ASCII to the 6-bit value. Multiply-adds then
+// pack four 6-bit values into three bytes per 32-bit lane.
+
+__attribute__((target("sse4.1")))
+size_t decodeBlocksSse41(const char* in, size_t size, uint8_t* out) {
+    const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                          0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask2F = _mm_set1_epi8(0x2F);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    size_t i = 0;
+    uint8_t* start = out;
+
+    // Each step stores 16 bytes but advances 12: keep 24 symbols ahead so
+    // the store stays inside the output
+    while (size - i >= 24) {
+        __m128i symbols = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+
+        __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(symbols, 4), mask2F);
+        __m128i loNibbles = _mm_and_si128(symbols, mask2F);
+        __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+        __m128i lo = _mm_shuffle_epi8(lutLo, loNibbles);
+        if (!_mm_testz_si128(lo, hi)) {
+            // Padding or an invalid symbol somewhere in these 16
+            break;
+        }
+
+        __m128i eq2F = _mm_cmpeq_epi8(symbols, mask2F);
+        __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(eq2F, hiNibbles));
+        __m128i values = _mm_add_epi8(symbols, roll);
+
+        __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+        merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(merged, pack));
+
+        i += 16;
+        out += 12;
+    }
+
+    return i + decodeBlocksScalar(in + i, size - i, start + i / 4 * 3);
+}
+
+__attribute__((target("avx2")))
+size_t decodeBlocksAvx2(const char* in, size_t size, uint8_t* out) {
+    const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                           0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                           0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                             0, 0, 0, 0, 0, 0, 0, 0,
+                                             0, 16, 19, 4, -65, -65, -71, -71,
+                                             0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask2F = _mm256_set1_epi8(0x2F);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
+
+    size_t i = 0;
+    uint8_t* start = out;
+
+    // 32-byte stores, 24-byte steps
+    while (size - i >= 44) {
+        __m256i symbols = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+
+        __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(symbols, 4), mask2F);
+        __m256i loNibbles = _mm256_and_si256(symbols, mask2F);
+        __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+        __m256i lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+        if (!_mm256_testz_si256(lo, hi)) {
+            break;
+        }
+
+        __m256i eq2F = _mm256_cmpeq_epi8(symbols, mask2F);
+        __m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(eq2F, hiNibbles));
+        __m256i values = _mm256_add_epi8(symbols, roll);
+
+        __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        merged = _mm256_shuffle_epi8(merged, pack);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_permutevar8x32_epi32(merged, lanes));
+
+        i += 32;
+        out += 24;
+    }
+
+    // The 16-wide loop takes what is left, down to its own margin
+    return i + decodeBlocksSse41(in + i, size - i, start + i / 4 * 3);
+}
+
+#endif
+
+using DecodeBlocks = size_t (*)(const char*, size_t, uint8_t*);
+
+DecodeBlocks blocksFunction(Implementation implementation) {
+    if (!isSupported(implementation)) {
+        return &decodeBlocksScalar;
+    }
+
+    switch (implementation) {
+#ifdef BASE64_X86_SIMD
+    case Implementation::Avx2:
+        return &decodeBlocksAvx2;
+    case Implementation::Sse41:
+        return &decodeBlocksSse41;
+#endif
+    default:
+        return &decodeBlocksScalar;
+    }
+}
+
+Implementation detectImplementation() {
+#ifdef BASE64_X86_SIMD
+    __builtin_cpu_init();
+#endif
+    if (isSupported(Implementation::Avx2)) {
+        return Implementation::Avx2;
+    }
+    if (isSupported(Implementation::Sse41)) {
+        return Implementation::Sse41;
+    }
+    return Implementation::Scalar;
+}
+
+Implementation activeImpl() {
+    static const Implementation implementation = detectImplementation();
+    return implementation;
+}
+
+DecodeBlocks activeBlocks() {
+    static const DecodeBlocks blocks = blocksFunction(activeImpl());
+    return blocks;
+}
+
+// The whole input: vector blocks, then the final group with its padding
+bool decodeUsing(DecodeBlocks blocks, const char* in, size_t size, uint8_t* out, size_t& written) {
+    size_t consumed = blocks(in, size, out);
+    written = consumed / 4 * 3;
+
+    const char* tail = in + consumed;
+    size_t rest = size - consumed;
+    if (rest == 0) {
+        return true;
+    }
+
+    // Anything but one final group means an invalid symbol or stray padding
+    if (rest > 4) {
+        return false;
+    }
+
+    size_t symbols = rest;
+    while (symbols > 0 && rest - symbols < 2 && tail[symbols - 1] == '=') {
+        symbols--;
+    }
+    if ((symbols < rest && rest != 4) || symbols < 2) {
+        return false;
+    }
+
+    uint32_t bits = 0;
+    for (size_t k = 0; k < 4; k++) {
+        int value = k < symbols ? symbolValues()[static_cast<uint8_t>(tail[k])] : 0;
+        if (value < 0) {
+            return false;
+        }
+        bits = (bits << 6) | static_cast<uint32_t>(value);
+    }
+
+    out[written++] = static_cast<uint8_t>(bits >> 16);
+    if (symbols > 2) {
+        out[written++] = static_cast<uint8_t>(bits >> 8);
+    }
+    if (symbols > 3) {
+        out[written++] = static_cast<uint8_t>(bits);
+    }
+    return true;
+}
+
+} // namespace
+
+Implementation activeImplementation() {
+    return activeImpl();
+}
+
+bool isSupported(Implementation implementation) {
+    switch (implementation) {
+    case Implementation::Scalar:
+        return true;
+#ifdef BASE64_X86_SIMD
+    case Implementation::Sse41:
+        return __builtin_cpu_supports("sse4.1");
+    case Implementation::Avx2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+const char* name(Implementation implementation) {
+    switch (implementation) {
+    case Implementation::Sse41:
+        return "sse4.1";
+    case Implementation::Avx2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+int symbolValue(char symbol) {
+    return symbolValues()[static_cast<uint8_t>(symbol)];
+}
+
+bool decode(const char* in, size_t size, uint8_t* out, size_t& written) {
+    return decodeUsing(activeBlocks(), in, size, out, written);
+}
+
+bool decode(const std::string& in, std::vector<uint8_t>& out) {
+    out.resize(decodedSizeBound(in.size()));
+    size_t written = 0;
+    bool ok = decode(in.data(), in.size(), out.data(), written);
+    out.resize(ok ? written : 0);
+    return ok;
+}
+
+bool decodeWith(Implementation implementation, const char* in, size_t size, uint8_t* out,
+                size_t& written) {
+    return decodeUsing(blocksFunction(implementation), in, size, out, written);
+}
+
+size_t decodeBlocks(const char* in, size_t size, uint8_t* out) {
+    return activeBlocks()(in, size, out);
+}
+
+} // namespace base64
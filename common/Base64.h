@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Base64 decoding (standard alphabet) into caller-supplied memory.
+//
+// The bulk of the input is decoded 32 (AVX2) or 16 (SSE4.1) characters at
+// a time, validating every symbol on the way; the instruction set is picked
+// once at run time and anything else falls back to portable scalar code.
+// Padding is only accepted at the very end, an unpadded tail of 2 or 3
+// symbols is accepted, and anything else (whitespace included) is invalid.
+namespace base64 {
+
+enum class Implementation {
+    Scalar,
+    Sse41,
+    Avx2
+};
+
+// The implementation decode() uses on this CPU
+Implementation activeImplementation();
+bool isSupported(Implementation implementation);
+const char* name(Implementation implementation);
+
+// Output space needed for size input characters
+inline size_t decodedSizeBound(size_t size) {
+    return size / 4 * 3 + 3;
+}
+
+// Value (0-63) of a base64 symbol, or -1 for anything else including '='
+int symbolValue(char symbol);
+
+// Decode size characters into out, which must hold decodedSizeBound(size)
+// bytes. Returns false on invalid input; written is the decoded length.
+bool decode(const char* in, size_t size, uint8_t* out, size_t& written);
+
+// Convenience form; out is resized to the decoded length
+bool decode(const std::string& in, std::vector<uint8_t>& out);
+
+// decode() with a given implementation (benchmarks); unsupported ones
+// fall back to scalar
+bool decodeWith(Implementation implementation, const char* in, size_t size, uint8_t* out,
+                size_t& written);
+
+// Decode the longest prefix of whole 4-symbol groups that contain neither
+// padding nor invalid symbols, for incremental decoders that handle the
+// rest themselves. out must hold size / 4 * 3 bytes. Returns the number of
+// input characters consumed (a multiple of 4); they produced consumed / 4 * 3
+// bytes.
+size_t decodeBlocks(const char* in, size_t size, uint8_t* out);
+
+} // namespace base64
@@ -0,0 +1,95 @@
+#include "ConcurrencyLimit.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// RTT up to this multiple of the minimum counts as no queueing yet
+const double kTolerance = 1.25;
+
+// Never shrink by more than half on one response
+const double kMinGradient = 0.5;
+
+// Multiplicative decrease on failures
+const double kBackoff = 0.9;
+
+} // namespace
+
+ConcurrencyLimit::ConcurrencyLimit(size_t initial, size_t min_limit, size_t max_limit,
+                                   std::chrono::milliseconds min_rtt_window)
+    : m_minLimit(static_cast<double>(std::max<size_t>(min_limit, 1))),
+      m_maxLimit(static_cast<double>(std::max(max_limit, std::max<size_t>(min_limit, 1)))),
+      m_minRttWindow(min_rtt_window),
+      m_estimate(std::min(std::max(static_cast<double>(initial), m_minLimit), m_maxLimit)),
+      m_rttMs(0.0),
+      m_sampleRttSum(0.0),
+      m_sampleCount(0),
+      m_sampleMaxInFlight(0),
+      m_windowMinMs(0.0),
+      m_previousMinMs(0.0),
+      m_windowStart(Clock::now()),
+      m_increases(0),
+      m_decreases(0) {
+}
+
+size_t ConcurrencyLimit::limit() const {
+    return static_cast<size_t>(m_estimate);
+}
+
+double ConcurrencyLimit::minRttMs() const {
+    if (m_previousMinMs == 0.0) {
+        return m_windowMinMs;
+    }
+    return m_windowMinMs == 0.0 ? m_previousMinMs : std::min(m_windowMinMs, m_previousMinMs);
+}
+
+void ConcurrencyLimit::onSample(double rtt_ms, size_t in_flight) {
+    if (rtt_ms <= 0.0) {
+        return;
+    }
+
+    Clock::time_point now = Clock::now();
+    if (now - m_windowStart >= m_minRttWindow) {
+        m_previousMinMs = m_windowMinMs;
+        m_windowMinMs = 0.0;
+        m_windowStart = now;
+    }
+    m_windowMinMs = m_windowMinMs == 0.0 ? rtt_ms : std::min(m_windowMinMs, rtt_ms);
+
+    // One update per round trip's worth of responses: the effect of a new
+    // limit only shows in the RTT of requests sent under it
+    m_sampleRttSum += rtt_ms;
+    m_sampleMaxInFlight = std::max(m_sampleMaxInFlight, in_flight);
+    if (++m_sampleCount < limit()) {
+        return;
+    }
+    m_rttMs = m_sampleRttSum / m_sampleCount;
+    size_t maxInFlight = m_sampleMaxInFlight;
+    m_sampleRttSum = 0.0;
+    m_sampleCount = 0;
+    m_sampleMaxInFlight = 0;
+
+    // Probe upwards while responses come back near the minimum RTT, shrink
+    // in proportion to the queueing once they don't
+    double gradient = kTolerance * minRttMs() / m_rttMs;
+    if (gradient < 1.0) {
+        setEstimate(m_estimate * std::max(gradient, kMinGradient));
+    } else if (maxInFlight * 2 >= m_estimate) {
+        // A client that doesn't use its limit learns nothing about a larger one
+        setEstimate(m_estimate + std::sqrt(m_estimate));
+    }
+}
+
+void ConcurrencyLimit::onDrop() {
+    setEstimate(m_estimate * kBackoff);
+}
+
+void ConcurrencyLimit::setEstimate(double estimate) {
+    size_t before = limit();
+    m_estimate = std::min(std::max(estimate, m_minLimit), m_maxLimit);
+    if (limit() > before) {
+        m_increases++;
+    } else if (limit() < before) {
+        m_decreases++;
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+// Adaptive limit on the requests outstanding at one server, in the style of
+// TCP Vegas and Netflix's gradient concurrency limits.
+//
+// A server's latency stays near its minimum RTT while it has idle capacity
+// and grows once requests start to queue inside it. Once per round trip
+// (every limit() responses) the limit moves by the gradient minRtt / rtt
+// of that round trip's mean RTT, with some tolerance: it grows by
+// sqrt(limit) while the two stay close, and shrinks in proportion to the
+// queueing once the RTT rises. Failed requests cut the limit
+// multiplicatively, as in AIMD.
+//
+// The minimum RTT is taken over a sliding window (the current and the
+// previous min_rtt_window), so it follows a server that got slower for
+// good instead of throttling against a stale best case.
+//
+// Not thread-safe; EndpointPool guards it.
+class ConcurrencyLimit {
+public:
+    ConcurrencyLimit(size_t initial = 4, size_t min_limit = 1, size_t max_limit = 64,
+                     std::chrono::milliseconds min_rtt_window = std::chrono::milliseconds(10000));
+
+    // Requests that may be outstanding now
+    size_t limit() const;
+
+    // A request finished after rtt_ms with in_flight requests outstanding
+    // (itself included)
+    void onSample(double rtt_ms, size_t in_flight);
+
+    // A request failed or timed out
+    void onDrop();
+
+    double minRttMs() const;
+    double rttMs() const { return m_rttMs; }
+
+    // Limit changes, for logging
+    size_t increases() const { return m_increases; }
+    size_t decreases() const { return m_decreases; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    double m_minLimit;
+    double m_maxLimit;
+    std::chrono::milliseconds m_minRttWindow;
+
+    double m_estimate;
+    double m_rttMs;   // mean RTT of the last round trip
+
+    // Responses since the last update
+    double m_sampleRttSum;
+    size_t m_sampleCount;
+    size_t m_sampleMaxInFlight;
+
+    // Minimum RTT of the current and the previous window (0 = none yet)
+    double m_windowMinMs;
+    double m_previousMinMs;
+    Clock::time_point m_windowStart;
+
+    size_t m_increases;
+    size_t m_decreases;
+
+    void setEstimate(double estimate);
+};
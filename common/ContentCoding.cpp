@@ -0,0 +1,324 @@
+#include "ContentCoding.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <strings.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace content_coding {
+
+const char* name(Coding coding) {
+    switch (coding) {
+        case Coding::Gzip: return "gzip";
+        case Coding::Zstd: return "zstd";
+        default: return "identity";
+    }
+}
+
+std::vector<Coding> parseList(const std::string& header) {
+    std::vector<Coding> codings;
+    std::istringstream in(header);
+    std::string token;
+    while (std::getline(in, token, ',')) {
+        // Drop whitespace and parameters (";q=0.5")
+        token = token.substr(0, token.find(';'));
+        token.erase(std::remove_if(token.begin(), token.end(), [](unsigned char c) {
+            return std::isspace(c) != 0;
+        }), token.end());
+        if (strcasecmp(token.c_str(), "gzip") == 0 || strcasecmp(token.c_str(), "x-gzip") == 0) {
+            codings.push_back(Coding::Gzip);
+        } else if (strcasecmp(token.c_str(), "zstd") == 0) {
+            codings.push_back(Coding::Zstd);
+        }
+    }
+    return codings;
+}
+
+const std::string& responseCodings() {
+    static const std::string codings = [] {
+        ensureCurlGlobalInit();
+        const curl_version_info_data* info = curl_version_info(CURLVERSION_NOW);
+        std::string list;
+#ifdef CURL_VERSION_ZSTD
+        if (info->features & CURL_VERSION_ZSTD) {
+            list = "zstd";
+        }
+#endif
+        if (info->features & CURL_VERSION_LIBZ) {
+            list += list.empty() ? "gzip" : ", gzip";
+        }
+        return list;
+    }();
+    return codings;
+}
+
+bool canCompress(Coding coding) {
+    switch (coding) {
+#ifdef HAVE_ZLIB
+        case Coding::Gzip: return true;
+#endif
+#ifdef HAVE_ZSTD
+        case Coding::Zstd: return true;
+#endif
+        default: return false;
+    }
+}
+
+bool compress(Coding coding, const unsigned char* data, size_t size, std::vector<unsigned char>& out) {
+#ifdef HAVE_ZLIB
+    if (coding == Coding::Gzip) {
+        // Level 1 with a gzip wrapper (window bits + 16)
+        z_stream stream = {};
+        if (deflateInit2(&stream, 1, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+        out.resize(deflateBound(&stream, size));
+        stream.next_in = const_cast<Bytef*>(data);
+        stream.avail_in = static_cast<uInt>(size);
+        stream.next_out = out.data();
+        stream.avail_out = static_cast<uInt>(out.size());
+        int result = deflate(&stream, Z_FINISH);
+        out.resize(stream.total_out);
+        deflateEnd(&stream);
+        return result == Z_STREAM_END;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (coding == Coding::Zstd) {
+        out.resize(ZSTD_compressBound(size));
+        size_t written = ZSTD_compress(out.data(), out.size(), data, size, 1);
+        if (ZSTD_isError(written)) {
+            return false;
+        }
+        out.resize(written);
+        return true;
+    }
+#endif
+    (void)data;
+    (void)size;
+    (void)out;
+    (void)coding;
+    return false;
+}
+
+std::string serializeMultipart(const std::vector<MultipartPart>& parts, std::vector<unsigned char>& body) {
+    // Random boundary like curl's, so it can't clash with part bytes
+    static std::mutex mutex;
+    static std::mt19937_64 random(std::random_device{}());
+    char boundary[41];
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::snprintf(boundary, sizeof(boundary), "------------------------%016llx",
+                      static_cast<unsigned long long>(random()));
+    }
+
+    body.clear();
+    auto append = [&body](const std::string& text) {
+        body.insert(body.end(), text.begin(), text.end());
+    };
+    for (const auto& part : parts) {
+        append(std::string("--") + boundary + "\r\nContent-Disposition: form-data; name=\"" + part.name + "\"");
+        if (!part.filename.empty()) {
+            append("; filename=\"" + part.filename + "\"");
+        }
+        append("\r\nContent-Type: " + part.content_type + "\r\n\r\n");
+        body.insert(body.end(), part.data.begin(), part.data.end());
+        append("\r\n");
+    }
+    append(std::string("--") + boundary + "--\r\n");
+    return std::string("multipart/form-data; boundary=") + boundary;
+}
+
+} // namespace content_coding
+
+namespace {
+
+using content_coding::Coding;
+
+constexpr double kSmoothing = 0.2;
+
+// Transfers shorter than this mostly measure round trips, not the link
+constexpr size_t kMinLinkSample = 16 * 1024;
+
+// Decoding speed in raw MB/s on one core; libcurl decodes responses where
+// it can't be timed
+constexpr double kGzipDecodeSpeed = 300.0;
+constexpr double kZstdDecodeSpeed = 1000.0;
+
+double smooth(double average, double sample, size_t samples) {
+    return samples == 0 ? sample : average + kSmoothing * (sample - average);
+}
+
+} // namespace
+
+ContentCodingNegotiator::ContentCodingNegotiator(size_t probe_interval)
+    : m_probeInterval(std::max<size_t>(probe_interval, 1)) {
+}
+
+void ContentCodingNegotiator::prepare(HttpRequest& request) {
+    std::string origin = originOf(request.url);
+    Coding upload = Coding::Identity;
+    bool download = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Origin& state = m_origins[origin];
+        download = !content_coding::responseCodings().empty() && use(state.download);
+
+        // The server's preferred coding among those this build can produce
+        for (Coding coding : state.requestCodings) {
+            if (content_coding::canCompress(coding)) {
+                if (use(state.upload)) {
+                    upload = coding;
+                }
+                break;
+            }
+        }
+    }
+
+    if (download) {
+        request.accept_encoding = content_coding::responseCodings();
+    }
+    if (upload == Coding::Identity) {
+        return;
+    }
+
+    // Multipart uploads are compressed as one body
+    std::vector<unsigned char> serialized;
+    std::string contentType = request.content_type;
+    if (!request.parts.empty()) {
+        contentType = content_coding::serializeMultipart(request.parts, serialized);
+    }
+    const std::vector<unsigned char>& raw = request.parts.empty() ? request.body : serialized;
+    if (raw.empty()) {
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<unsigned char> compressed;
+    if (!content_coding::compress(upload, raw.data(), raw.size(), compressed)) {
+        return;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    size_t rawSize = raw.size();
+    request.body = std::move(compressed);
+    request.parts.clear();
+    request.content_type = contentType;
+    request.headers.push_back(std::string("Content-Encoding: ") + content_coding::name(upload));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Origin& state = m_origins[origin];
+    Direction& direction = state.upload;
+    direction.ratio = smooth(direction.ratio, static_cast<double>(request.body.size()) / rawSize, direction.samples);
+    direction.codecSpeed = smooth(direction.codecSpeed, rawSize / std::max(elapsed.count(), 1e-6) / 1e6,
+                                  direction.samples);
+    direction.samples++;
+    direction.rawBytes += rawSize;
+    direction.wireBytes += request.body.size();
+    update(direction);
+}
+
+void ContentCodingNegotiator::record(const std::string& url, const HttpResponse& response) {
+    if (response.status_code == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Origin& state = m_origins[originOf(url)];
+
+    // 415: the server no longer takes what it announced
+    if (!response.accept_encoding.empty()) {
+        state.requestCodings = content_coding::parseList(response.accept_encoding);
+    } else if (response.status_code == 415) {
+        state.requestCodings.clear();
+    }
+
+    // Uploads are timed by HttpSession on any libcurl version
+    auto sampleLink = [](Direction& direction, size_t bytes, double seconds) {
+        if (bytes >= kMinLinkSample && seconds > 0) {
+            direction.linkSpeed = smooth(direction.linkSpeed, bytes / seconds / 1e6, direction.linkSamples);
+            direction.linkSamples++;
+        }
+    };
+    sampleLink(state.upload, response.upload_bytes, response.upload_seconds);
+    sampleLink(state.download, response.download_bytes, response.download_seconds);
+
+    std::vector<Coding> codings = content_coding::parseList(response.content_encoding);
+    if (!codings.empty() && response.body_bytes > 0) {
+        Direction& direction = state.download;
+        double speed = codings[0] == Coding::Zstd ? kZstdDecodeSpeed : kGzipDecodeSpeed;
+        direction.ratio = smooth(direction.ratio, static_cast<double>(response.download_bytes) / response.body_bytes,
+                                 direction.samples);
+        direction.codecSpeed = smooth(direction.codecSpeed, speed, direction.samples);
+        direction.samples++;
+        direction.rawBytes += response.body_bytes;
+        direction.wireBytes += response.download_bytes;
+    }
+
+    update(state.upload);
+    update(state.download);
+}
+
+std::string ContentCodingNegotiator::summary() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::ostringstream out;
+    out.setf(std::ios::fixed);
+    out.precision(2);
+    out << "Content coding:";
+    auto describe = [&out](const char* label, const Direction& direction) {
+        out << label << " " << (direction.enabled ? "on" : "off") << " (link ";
+        if (direction.linkSamples > 0) {
+            out << direction.linkSpeed << " MB/s)";
+        } else {
+            out << "unmeasured)";
+        }
+        if (direction.rawBytes > 0) {
+            out << " (" << direction.rawBytes / 1024 << " KB as " << direction.wireBytes / 1024
+                << " KB, ratio " << direction.ratio << ")";
+        }
+    };
+    for (const auto& entry : m_origins) {
+        const Origin& state = entry.second;
+        out << "\n  " << entry.first << ": ";
+        if (state.requestCodings.empty()) {
+            out << "uploads identity";
+        } else {
+            describe("uploads", state.upload);
+        }
+        out << ", ";
+        describe("responses", state.download);
+    }
+    return out.str();
+}
+
+bool ContentCodingNegotiator::use(Direction& direction) {
+    if (direction.enabled) {
+        return true;
+    }
+
+    // Probe now and then: the link may have slowed down or the data changed
+    if (++direction.sinceProbe >= m_probeInterval) {
+        direction.sinceProbe = 0;
+        return true;
+    }
+    return false;
+}
+
+void ContentCodingNegotiator::update(Direction& direction) {
+    // Worth it until measured otherwise: the slow links are the ones where
+    // it matters most
+    if (direction.samples == 0 || direction.linkSamples == 0) {
+        direction.enabled = true;
+        return;
+    }
+    direction.enabled = (1.0 - direction.ratio) * direction.codecSpeed > direction.linkSpeed;
+}
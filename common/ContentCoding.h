@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "HttpSession.h"
+
+// HTTP content codings (gzip, zstd) for request and response bodies.
+//
+// Responses: the client lists the codings libcurl can decode in
+// Accept-Encoding, and libcurl inflates the body on the fly, so response
+// sinks still see plain bytes chunk by chunk while they arrive.
+//
+// Requests: there is no Accept-Encoding for request bodies, so a server
+// announces the codings it takes in an Accept-Encoding response header
+// (RFC 7694). Until it has, uploads go out uncompressed. A compressed
+// multipart upload is serialized into one body and sent with
+// Content-Encoding.
+namespace content_coding {
+
+enum class Coding {
+    Identity,
+    Gzip,
+    Zstd
+};
+
+const char* name(Coding coding);
+
+// Codings in an Accept-Encoding / Content-Encoding header value, in order;
+// unknown ones are skipped
+std::vector<Coding> parseList(const std::string& header);
+
+// Accept-Encoding value with the codings libcurl can decode, best first
+// ("zstd, gzip"); empty if it was built without any
+const std::string& responseCodings();
+
+// Whether this build can compress request bodies with the coding
+bool canCompress(Coding coding);
+
+// Compress data with a fast level; false if the coding isn't available
+bool compress(Coding coding, const unsigned char* data, size_t size, std::vector<unsigned char>& out);
+
+// multipart/form-data body of the parts, as curl would send it. Returns the
+// Content-Type (with boundary).
+std::string serializeMultipart(const std::vector<MultipartPart>& parts, std::vector<unsigned char>& body);
+
+} // namespace content_coding
+
+// Decides per origin whether compression pays off, in each direction.
+//
+// Compressing saves (1 - ratio) * size / link_speed of transfer time and
+// costs size / codec_speed of CPU time, so it pays off while
+// (1 - ratio) * codec_speed > link_speed. The link speed is measured per
+// direction from every transfer, the upload ratio and compression speed from every
+// compressed upload, and the response ratio from compressed responses
+// (decoding speed is a per-coding constant; libcurl decodes out of sight).
+// Fast links (LAN, Unix sockets) and incompressible bodies (PNG/JPEG
+// uploads) thus switch compression off. A disabled direction is probed
+// again every probe_interval requests in case the link got slower.
+//
+// Thread-safe.
+class ContentCodingNegotiator {
+public:
+    explicit ContentCodingNegotiator(size_t probe_interval = 50);
+
+    // Compress request's body and ask for a compressed response, as far as
+    // the origin of request.url takes them and they currently pay off
+    void prepare(HttpRequest& request);
+
+    // Learn from a finished transfer to url: the codings the server takes,
+    // the link speed and the response compression ratio
+    void record(const std::string& url, const HttpResponse& response);
+
+    // Per-origin state and savings, for logging
+    std::string summary() const;
+
+private:
+    // One direction of one origin
+    struct Direction {
+        bool enabled = true;
+        size_t sinceProbe = 0;
+        size_t samples = 0;
+        double ratio = 1.0;          // compressed / raw bytes
+        double codecSpeed = 0.0;     // raw MB/s through the codec
+        size_t rawBytes = 0;
+        size_t wireBytes = 0;
+
+        // Links are often asymmetric, so each direction is timed on its own
+        double linkSpeed = 0.0;      // MB/s, 0 until measured
+        size_t linkSamples = 0;
+    };
+
+    struct Origin {
+        std::vector<content_coding::Coding> requestCodings;   // announced by the server
+        Direction upload;
+        Direction download;
+    };
+
+    size_t m_probeInterval;
+
+    mutable std::mutex m_mutex;
+    std::map<std::string, Origin> m_origins;
+
+    bool use(Direction& direction);
+    void update(Direction& direction);
+};
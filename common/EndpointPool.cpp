@@ -0,0 +1,211 @@
+#include "EndpointPool.h"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+
+// Failures in a row before an endpoint is skipped, and for how long
+const size_t kMaxConsecutiveFailures = 3;
+const std::chrono::seconds kCoolDown(5);
+
+// Weight of the newest sample in the latency average
+const double kEwmaAlpha = 0.2;
+
+} // namespace
+
+EndpointPool::EndpointPool(size_t window)
+    : m_window(window > 0 ? window : 1),
+      m_initialLimit(0),
+      m_minLimit(0),
+      m_maxLimit(0) {
+}
+
+size_t EndpointPool::addEndpoint(const std::string& url, double weight) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Endpoint endpoint;
+    endpoint.url = url;
+    endpoint.weight = weight > 0.0 ? weight : 1.0;
+    endpoint.samples.reserve(m_window);
+    if (m_maxLimit > 0) {
+        endpoint.limit = ConcurrencyLimit(m_initialLimit, m_minLimit, m_maxLimit);
+    }
+    m_endpoints.push_back(std::move(endpoint));
+    return m_endpoints.size() - 1;
+}
+
+size_t EndpointPool::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_endpoints.size();
+}
+
+std::string EndpointPool::url(size_t index) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return index < m_endpoints.size() ? m_endpoints[index].url : std::string();
+}
+
+void EndpointPool::enableAdaptiveConcurrency(size_t initial, size_t min_limit, size_t max_limit) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_minLimit = std::max<size_t>(min_limit, 1);
+    m_maxLimit = std::max(max_limit, m_minLimit);
+    m_initialLimit = std::min(std::max(initial, m_minLimit), m_maxLimit);
+    for (Endpoint& endpoint : m_endpoints) {
+        endpoint.limit = ConcurrencyLimit(m_initialLimit, m_minLimit, m_maxLimit);
+    }
+}
+
+bool EndpointPool::adaptiveConcurrency() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_maxLimit > 0;
+}
+
+size_t EndpointPool::acquire(size_t exclude) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto now = std::chrono::steady_clock::now();
+
+    // Two passes: healthy endpoints first, cooling-down ones only if no
+    // other endpoint is left
+    for (int pass = 0; pass < 2; pass++) {
+        size_t best = npos;
+        double bestLoad = 0.0;
+        for (size_t i = 0; i < m_endpoints.size(); i++) {
+            const Endpoint& endpoint = m_endpoints[i];
+            if (i == exclude || (pass == 0 && endpoint.coolDownUntil > now)) {
+                continue;
+            }
+            if (m_maxLimit > 0 && endpoint.outstanding >= endpoint.limit.limit()) {
+                if (pass == 0) {
+                    m_endpoints[i].limited++;
+                }
+                continue;
+            }
+
+            double load = (endpoint.outstanding + 1) / endpoint.weight;
+            if (best == npos || load < bestLoad ||
+                (load == bestLoad && endpoint.ewmaMs < m_endpoints[best].ewmaMs)) {
+                best = i;
+                bestLoad = load;
+            }
+        }
+
+        if (best != npos) {
+            m_endpoints[best].outstanding++;
+            m_endpoints[best].requests++;
+            return best;
+        }
+    }
+    return npos;
+}
+
+void EndpointPool::release(size_t index, double latency_ms, bool ok) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (index >= m_endpoints.size()) {
+        return;
+    }
+
+    Endpoint& endpoint = m_endpoints[index];
+    size_t inFlight = endpoint.outstanding;
+    if (endpoint.outstanding > 0) {
+        endpoint.outstanding--;
+    }
+
+    if (m_maxLimit > 0) {
+        if (ok) {
+            endpoint.limit.onSample(latency_ms, inFlight);
+        } else {
+            endpoint.limit.onDrop();
+        }
+    }
+
+    if (!ok) {
+        endpoint.failures++;
+        if (++endpoint.consecutiveFailures >= kMaxConsecutiveFailures) {
+            endpoint.coolDownUntil = std::chrono::steady_clock::now() + kCoolDown;
+        }
+        return;
+    }
+    endpoint.consecutiveFailures = 0;
+
+    if (endpoint.samples.size() < m_window) {
+        endpoint.samples.push_back(latency_ms);
+    } else {
+        endpoint.samples[endpoint.nextSample] = latency_ms;
+    }
+    endpoint.nextSample = (endpoint.nextSample + 1) % m_window;
+
+    endpoint.ewmaMs = endpoint.ewmaMs == 0.0
+        ? latency_ms
+        : kEwmaAlpha * latency_ms + (1.0 - kEwmaAlpha) * endpoint.ewmaMs;
+}
+
+void EndpointPool::cancel(size_t index) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (index >= m_endpoints.size()) {
+        return;
+    }
+
+    Endpoint& endpoint = m_endpoints[index];
+    if (endpoint.outstanding > 0) {
+        endpoint.outstanding--;
+    }
+    endpoint.cancelled++;
+}
+
+double EndpointPool::latencyQuantile(size_t index, double quantile, size_t min_samples) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (index >= m_endpoints.size() || m_endpoints[index].samples.size() < std::max<size_t>(min_samples, 1)) {
+        return 0.0;
+    }
+    return quantileLocked(m_endpoints[index], quantile);
+}
+
+double EndpointPool::quantileLocked(const Endpoint& endpoint, double quantile) const {
+    if (endpoint.samples.empty()) {
+        return 0.0;
+    }
+
+    // The window is small, a partial sort of a copy is cheap enough
+    std::vector<double> sorted = endpoint.samples;
+    quantile = std::min(std::max(quantile, 0.0), 1.0);
+    size_t rank = std::min(sorted.size() - 1, static_cast<size_t>(quantile * sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return sorted[rank];
+}
+
+std::vector<EndpointPool::ConcurrencyStats> EndpointPool::concurrencyStats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<ConcurrencyStats> stats;
+    if (m_maxLimit == 0) {
+        return stats;
+    }
+    for (const Endpoint& endpoint : m_endpoints) {
+        ConcurrencyStats entry;
+        entry.url = endpoint.url;
+        entry.outstanding = endpoint.outstanding;
+        entry.limit = endpoint.limit.limit();
+        entry.minRttMs = endpoint.limit.minRttMs();
+        entry.rttMs = endpoint.limit.rttMs();
+        entry.limited = endpoint.limited;
+        stats.push_back(entry);
+    }
+    return stats;
+}
+
+std::string EndpointPool::summary() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    out << "Endpoints:";
+    for (const Endpoint& endpoint : m_endpoints) {
+        out << "\n  " << endpoint.url << " (weight " << endpoint.weight << "): "
+            << endpoint.requests << " requests, " << endpoint.failures << " failed, "
+            << endpoint.cancelled << " cancelled, p50 " << quantileLocked(endpoint, 0.5)
+            << " ms, p95 " << quantileLocked(endpoint, 0.95) << " ms";
+        if (m_maxLimit > 0) {
+            out << ", limit " << endpoint.limit.limit() << " (min RTT " << endpoint.limit.minRttMs()
+                << " ms, RTT " << endpoint.limit.rttMs() << " ms, " << endpoint.limit.increases() << " up, "
+                << endpoint.limit.decreases() << " down, " << endpoint.limited << " times full)";
+        }
+    }
+    return out.str();
+}
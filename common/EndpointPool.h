@@ -0,0 +1,111 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ConcurrencyLimit.h"
+
+// A set of interchangeable inference servers.
+//
+// Requests go to the endpoint with the fewest outstanding requests relative
+// to its weight ((outstanding + 1) / weight), ties broken by the lower
+// recent latency, so a slow or overloaded server naturally gets less work.
+// Every finished request feeds the endpoint's latency window, from which
+// quantiles (e.g. the p95 used as hedging delay) are read.
+//
+// An endpoint that fails several requests in a row is skipped for a
+// cool-down period, unless every endpoint is cooling down.
+//
+// With adaptive concurrency each endpoint also gets a ConcurrencyLimit,
+// learned from its latencies; an endpoint at its limit takes no more
+// requests, and acquire() fails once all of them are.
+//
+// Thread-safe.
+class EndpointPool {
+public:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    // One endpoint's adaptive concurrency state
+    struct ConcurrencyStats {
+        std::string url;
+        size_t outstanding = 0;
+        size_t limit = 0;
+        double minRttMs = 0.0;
+        double rttMs = 0.0;
+        size_t limited = 0;     // acquire() calls that found it at its limit
+    };
+
+    // window: latency samples kept per endpoint for quantiles
+    explicit EndpointPool(size_t window = 256);
+
+    // Returns the new endpoint's index. weight > 0; 2 means twice the share.
+    size_t addEndpoint(const std::string& url, double weight = 1.0);
+
+    size_t size() const;
+
+    // Bound each endpoint's outstanding requests by an adaptive limit
+    // starting at initial, within [min_limit, max_limit]. Applies to
+    // existing and later endpoints.
+    void enableAdaptiveConcurrency(size_t initial, size_t min_limit, size_t max_limit);
+    bool adaptiveConcurrency() const;
+    std::string url(size_t index) const;
+
+    // Pick an endpoint for a request and count it as outstanding. exclude
+    // is skipped (e.g. the endpoint a hedged request is already on).
+    // Returns npos if there is no eligible endpoint.
+    size_t acquire(size_t exclude = npos);
+
+    // A request acquired on index finished. Successful requests contribute
+    // their latency; pass ok = false for transport or HTTP errors.
+    void release(size_t index, double latency_ms, bool ok);
+
+    // A request was abandoned (e.g. the losing copy of a hedged request):
+    // no longer outstanding, but says nothing about the endpoint
+    void cancel(size_t index);
+
+    // Latency quantile (0..1) over the recent window, in milliseconds.
+    // 0 until min_samples requests have completed.
+    double latencyQuantile(size_t index, double quantile, size_t min_samples = 20) const;
+
+    // Per-endpoint limits and RTT estimates (empty unless adaptive)
+    std::vector<ConcurrencyStats> concurrencyStats() const;
+
+    // Per-endpoint load and latency, for logging
+    std::string summary() const;
+
+private:
+    struct Endpoint {
+        std::string url;
+        double weight = 1.0;
+        size_t outstanding = 0;
+
+        // Ring of recent latencies
+        std::vector<double> samples;
+        size_t nextSample = 0;
+        double ewmaMs = 0.0;
+
+        size_t requests = 0;
+        size_t failures = 0;
+        size_t cancelled = 0;
+        size_t consecutiveFailures = 0;
+        std::chrono::steady_clock::time_point coolDownUntil;
+
+        ConcurrencyLimit limit;
+        size_t limited = 0;
+    };
+
+    const size_t m_window;
+
+    // Adaptive concurrency settings (m_maxLimit == 0: off)
+    size_t m_initialLimit;
+    size_t m_minLimit;
+    size_t m_maxLimit;
+
+    std::vector<Endpoint> m_endpoints;
+    mutable std::mutex m_mutex;
+
+    double quantileLocked(const Endpoint& endpoint, double quantile) const;
+};
@@ -0,0 +1,539 @@
+#include "HttpSession.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <strings.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+void ensureCurlGlobalInit() {
+    static std::once_flag initFlag;
+    std::call_once(initFlag, [] {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+    });
+}
+
+bool deadlinePassed(const HttpRequest& request) {
+    return request.deadline.time_since_epoch().count() != 0 &&
+           std::chrono::steady_clock::now() >= request.deadline;
+}
+
+std::string originOf(const std::string& url) {
+    std::string origin;
+    CURLU* handle = curl_url();
+    if (curl_url_set(handle, CURLUPART_URL, url.c_str(), 0) == CURLUE_OK) {
+        char* scheme = nullptr;
+        char* host = nullptr;
+        char* port = nullptr;
+        curl_url_get(handle, CURLUPART_SCHEME, &scheme, 0);
+        curl_url_get(handle, CURLUPART_HOST, &host, 0);
+        curl_url_get(handle, CURLUPART_PORT, &port, CURLU_DEFAULT_PORT);
+        origin = std::string(scheme ? scheme : "") + "://" + (host ? host : "") + ":" + (port ? port : "");
+        curl_free(scheme);
+        curl_free(host);
+        curl_free(port);
+    }
+    curl_url_cleanup(handle);
+    return origin;
+}
+
+namespace {
+
+// What h2c prior knowledge got from an origin ("scheme://host:port")
+struct Http2Verdict {
+    int strikes = 0;                                  // ambiguous failures in a row
+    std::chrono::steady_clock::time_point http1Until; // HTTP/1.1 only until then
+};
+
+// Connection failures could also be a server restarting, so it takes this
+// many in a row on fresh connections to give up on h2c
+const int kHttp2Strikes = 2;
+
+// A rejection is re-checked after this long, in case the server changed
+const std::chrono::minutes kHttp1OnlyFor(10);
+
+std::mutex http1OnlyMutex;
+std::map<std::string, Http2Verdict> http2Verdicts;
+
+// Unsent bytes a TCP socket may buffer. Without a cap the kernel takes a
+// whole frame at once, and the read callbacks can't time the upload.
+const int kUnsentLowWater = 16 * 1024;
+
+int limitUnsent(void*, curl_socket_t socket, curlsocktype purpose) {
+#ifdef TCP_NOTSENT_LOWAT
+    if (purpose == CURLSOCKTYPE_IPCXN) {
+        // Fails harmlessly on Unix domain sockets
+        setsockopt(socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &kUnsentLowWater, sizeof(kUnsentLowWater));
+    }
+#else
+    (void)socket;
+    (void)purpose;
+#endif
+    return CURL_SOCKOPT_OK;
+}
+
+// Value of a "Name: value" header line if it has the given name
+bool headerValue(const char* line, size_t size, const char* name, std::string& value) {
+    size_t length = std::strlen(name);
+    if (size <= length || line[length] != ':' || strncasecmp(line, name, length) != 0) {
+        return false;
+    }
+    size_t begin = length + 1;
+    size_t end = size;
+    while (begin < end && (line[begin] == ' ' || line[begin] == '\t')) {
+        begin++;
+    }
+    while (end > begin && (line[end - 1] == '\r' || line[end - 1] == '\n' || line[end - 1] == ' ')) {
+        end--;
+    }
+    value.assign(line + begin, end - begin);
+    return true;
+}
+
+bool isHttp1Only(const std::string& url) {
+    std::lock_guard<std::mutex> lock(http1OnlyMutex);
+    auto it = http2Verdicts.find(originOf(url));
+    return it != http2Verdicts.end() && it->second.http1Until > std::chrono::steady_clock::now();
+}
+
+void markHttp1Only(const std::string& url) {
+    std::lock_guard<std::mutex> lock(http1OnlyMutex);
+    Http2Verdict& verdict = http2Verdicts[originOf(url)];
+    verdict.strikes = 0;
+    verdict.http1Until = std::chrono::steady_clock::now() + kHttp1OnlyFor;
+    std::cerr << "HTTP/2 prior knowledge rejected by " << url
+              << ", falling back to HTTP/1.1" << std::endl;
+}
+
+// Counts an ambiguous h2c failure; true once there were enough in a row
+bool strikeHttp2(const std::string& url) {
+    std::lock_guard<std::mutex> lock(http1OnlyMutex);
+    return ++http2Verdicts[originOf(url)].strikes >= kHttp2Strikes;
+}
+
+void clearHttp2Strikes(const std::string& url) {
+    std::lock_guard<std::mutex> lock(http1OnlyMutex);
+    auto it = http2Verdicts.find(originOf(url));
+    if (it != http2Verdicts.end()) {
+        it->second.strikes = 0;
+    }
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------------
+// UploadTimer, BodyCursor
+// ---------------------------------------------------------------------------
+
+void UploadTimer::mark(size_t count) {
+    last = std::chrono::steady_clock::now();
+    if (first.time_since_epoch().count() == 0) {
+        first = last;
+    }
+    bytesSent = bytesRead;
+    bytesRead += count;
+}
+
+double UploadTimer::seconds() const {
+    double elapsed = std::chrono::duration<double>(last - first).count();
+    if (elapsed <= 0.0 || bytesSent == 0) {
+        return 0.0;
+    }
+    return elapsed * bytesRead / bytesSent;
+}
+
+size_t BodyCursor::read(char* buffer, size_t size, size_t nitems, void* arg) {
+    BodyCursor* cursor = static_cast<BodyCursor*>(arg);
+    size_t count = std::min(size * nitems, cursor->size - cursor->offset);
+    std::memcpy(buffer, cursor->data + cursor->offset, count);
+    cursor->offset += count;
+    if (count > 0 && cursor->timer) {
+        cursor->timer->mark(count);
+    }
+    return count;
+}
+
+int BodyCursor::seek(void* arg, curl_off_t offset, int origin) {
+    BodyCursor* cursor = static_cast<BodyCursor*>(arg);
+    if (origin != SEEK_SET || offset < 0 || static_cast<size_t>(offset) > cursor->size) {
+        return CURL_SEEKFUNC_CANTSEEK;
+    }
+    cursor->offset = static_cast<size_t>(offset);
+    return CURL_SEEKFUNC_OK;
+}
+
+// ---------------------------------------------------------------------------
+// MimeBody
+// ---------------------------------------------------------------------------
+
+MimeBody::MimeBody(CURL* curl, const std::vector<MultipartPart>& parts, UploadTimer* timer)
+    : m_mime(curl_mime_init(curl)) {
+    // Reserve up front: curl keeps pointers to the cursors
+    m_cursors.reserve(parts.size());
+
+    for (const auto& part : parts) {
+        m_cursors.push_back({part.data.data(), part.data.size(), 0, timer});
+
+        curl_mimepart* mimePart = curl_mime_addpart(m_mime);
+        curl_mime_name(mimePart, part.name.c_str());
+        if (!part.filename.empty()) {
+            curl_mime_filename(mimePart, part.filename.c_str());
+        }
+        if (!part.content_type.empty()) {
+            curl_mime_type(mimePart, part.content_type.c_str());
+        }
+        curl_mime_data_cb(mimePart, static_cast<curl_off_t>(part.data.size()),
+                          &BodyCursor::read, &BodyCursor::seek, nullptr,
+                          &m_cursors.back());
+    }
+}
+
+MimeBody::~MimeBody() {
+    curl_mime_free(m_mime);
+}
+
+// ---------------------------------------------------------------------------
+// RequestBinding
+// ---------------------------------------------------------------------------
+
+RequestBinding::RequestBinding(CURL* curl, const HttpRequest& request, HttpResponse& response,
+                               const std::shared_ptr<CurlShare>& share)
+    : m_curl(curl),
+      m_url(request.url),
+      m_deadline(request.deadline),
+      m_priorKnowledge(false),
+      m_response(response),
+      m_sink(request.make_sink ? request.make_sink() : nullptr),
+      m_sinkStarted(false),
+      m_body{request.body.data(), request.body.size(), 0, &m_uploadTimer},
+      m_headers(nullptr) {
+    if (share) {
+        curl_easy_setopt(m_curl, CURLOPT_SHARE, share->handle());
+    }
+
+    curl_easy_setopt(m_curl, CURLOPT_URL, request.url.c_str());
+    if (!request.unix_socket_path.empty()) {
+        // Co-located server: the URL's host only goes into the Host header
+        curl_easy_setopt(m_curl, CURLOPT_UNIX_SOCKET_PATH, request.unix_socket_path.c_str());
+    }
+    curl_easy_setopt(m_curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(m_curl, CURLOPT_SOCKOPTFUNCTION, &limitUnsent);
+    curl_easy_setopt(m_curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(m_curl, CURLOPT_TCP_NODELAY, 1L);
+    curl_easy_setopt(m_curl, CURLOPT_WRITEFUNCTION, &RequestBinding::writeCallback);
+    curl_easy_setopt(m_curl, CURLOPT_WRITEDATA, this);
+    curl_easy_setopt(m_curl, CURLOPT_HEADERFUNCTION, &RequestBinding::headerCallback);
+    curl_easy_setopt(m_curl, CURLOPT_HEADERDATA, this);
+    if (!request.accept_encoding.empty()) {
+        // libcurl decodes the body before it reaches writeCallback
+        curl_easy_setopt(m_curl, CURLOPT_ACCEPT_ENCODING, request.accept_encoding.c_str());
+    }
+
+    if (request.timeouts.connect_ms > 0) {
+        curl_easy_setopt(m_curl, CURLOPT_CONNECTTIMEOUT_MS, request.timeouts.connect_ms);
+    }
+    if (request.timeouts.low_speed_bytes > 0 && request.timeouts.low_speed_seconds > 0) {
+        curl_easy_setopt(m_curl, CURLOPT_LOW_SPEED_LIMIT, request.timeouts.low_speed_bytes);
+        curl_easy_setopt(m_curl, CURLOPT_LOW_SPEED_TIME, request.timeouts.low_speed_seconds);
+    }
+    if (m_deadline.time_since_epoch().count() != 0) {
+        // libcurl aborts the transfer itself once the deadline passes
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            m_deadline - std::chrono::steady_clock::now()).count();
+        curl_easy_setopt(m_curl, CURLOPT_TIMEOUT_MS, static_cast<long>(std::max<long long>(remaining, 1)));
+    }
+
+    if (request.http_version == HttpVersion::Http2) {
+        // Wait for an existing connection to multiplex on instead of
+        // opening a new one per request
+        curl_easy_setopt(m_curl, CURLOPT_PIPEWAIT, 1L);
+
+        if (request.url.compare(0, 8, "https://") == 0) {
+            // ALPN picks h2 or HTTP/1.1 during the TLS handshake
+            curl_easy_setopt(m_curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+        } else if (!isHttp1Only(request.url)) {
+            // No TLS, so no ALPN: speak h2c right away
+            curl_easy_setopt(m_curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE);
+            m_priorKnowledge = true;
+        } else {
+            curl_easy_setopt(m_curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+        }
+    } else {
+        curl_easy_setopt(m_curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+    }
+
+    if (!request.parts.empty()) {
+        m_mime = std::make_unique<MimeBody>(m_curl, request.parts, &m_uploadTimer);
+        curl_easy_setopt(m_curl, CURLOPT_MIMEPOST, m_mime->get());
+    } else {
+        std::string contentType = "Content-Type: " + request.content_type;
+        m_headers = curl_slist_append(m_headers, contentType.c_str());
+        // Streamed by a read callback rather than POSTFIELDS, to time it
+        curl_easy_setopt(m_curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(m_curl, CURLOPT_READFUNCTION, &BodyCursor::read);
+        curl_easy_setopt(m_curl, CURLOPT_READDATA, &m_body);
+        curl_easy_setopt(m_curl, CURLOPT_SEEKFUNCTION, &BodyCursor::seek);
+        curl_easy_setopt(m_curl, CURLOPT_SEEKDATA, &m_body);
+        curl_easy_setopt(m_curl, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(request.body.size()));
+    }
+
+    for (const auto& header : request.headers) {
+        m_headers = curl_slist_append(m_headers, header.c_str());
+    }
+
+    if (m_headers) {
+        curl_easy_setopt(m_curl, CURLOPT_HTTPHEADER, m_headers);
+    }
+}
+
+RequestBinding::~RequestBinding() {
+    // Detach before freeing so the handle never points at released memory
+    curl_easy_setopt(m_curl, CURLOPT_MIMEPOST, nullptr);
+    curl_easy_setopt(m_curl, CURLOPT_HTTPHEADER, nullptr);
+    curl_slist_free_all(m_headers);
+}
+
+void RequestBinding::complete(CURLcode result) {
+    if (result != CURLE_OK) {
+        m_response.error = curl_easy_strerror(result);
+    }
+
+    // Connect and low-speed timeouts end in the same error; only a timeout
+    // at the deadline counts as the deadline
+    if (result == CURLE_OPERATION_TIMEDOUT && m_deadline.time_since_epoch().count() != 0 &&
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(1) >= m_deadline) {
+        m_response.expired = DeadlineExpiry::InFlight;
+        m_response.error = "Deadline exceeded";
+    }
+
+    curl_easy_getinfo(m_curl, CURLINFO_RESPONSE_CODE, &m_response.status_code);
+
+    char* contentType = nullptr;
+    if (curl_easy_getinfo(m_curl, CURLINFO_CONTENT_TYPE, &contentType) == CURLE_OK && contentType) {
+        m_response.content_type = contentType;
+    }
+
+    curl_off_t uploaded = 0, total = 0, downloaded = 0, firstByte = 0;
+    curl_easy_getinfo(m_curl, CURLINFO_SIZE_UPLOAD_T, &uploaded);
+    curl_easy_getinfo(m_curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+    curl_easy_getinfo(m_curl, CURLINFO_STARTTRANSFER_TIME_T, &firstByte);
+    curl_easy_getinfo(m_curl, CURLINFO_TOTAL_TIME_T, &total);
+
+    m_response.upload_bytes = static_cast<size_t>(uploaded);
+    m_response.upload_seconds = m_uploadTimer.seconds();
+    m_response.total_seconds = total / 1e6;
+    m_response.download_bytes = static_cast<size_t>(downloaded);
+    m_response.download_seconds = total > firstByte ? (total - firstByte) / 1e6 : 0.0;
+
+    if (m_sinkStarted && m_sink) {
+        m_response.sink = m_sink;
+    }
+}
+
+bool RequestBinding::rejectedHttp2(CURLcode result) {
+    if (!m_priorKnowledge) {
+        return false;
+    }
+
+    long version = 0;
+    curl_easy_getinfo(m_curl, CURLINFO_HTTP_VERSION, &version);
+    if (version == CURL_HTTP_VERSION_2_0) {
+        clearHttp2Strikes(m_url);
+        return false;
+    }
+
+    // An HTTP/1.x server answers the h2 connection preface with an
+    // HTTP/1.x status line, which curl reports as a protocol error
+    bool rejected = result == CURLE_HTTP2 || result == CURLE_WEIRD_SERVER_REPLY ||
+                    version == CURL_HTTP_VERSION_1_0 || version == CURL_HTTP_VERSION_1_1;
+
+    // ...or just closes the connection, which a restarting server does too.
+    // Only failures on a fresh connection count, and only repeated ones.
+    if (!rejected && (result == CURLE_GOT_NOTHING || result == CURLE_RECV_ERROR ||
+                      result == CURLE_SEND_ERROR)) {
+        long connects = 0;
+        curl_easy_getinfo(m_curl, CURLINFO_NUM_CONNECTS, &connects);
+        rejected = connects > 0 && strikeHttp2(m_url);
+    }
+
+    if (rejected) {
+        markHttp1Only(m_url);
+    }
+    return rejected;
+}
+
+size_t RequestBinding::writeCallback(char* contents, size_t size, size_t nmemb, void* userp) {
+    RequestBinding* binding = static_cast<RequestBinding*>(userp);
+    size_t bytes = size * nmemb;
+
+    // First piece of the body: the sink decides whether it wants it
+    if (binding->m_sink && !binding->m_sinkStarted) {
+        binding->m_sinkStarted = true;
+
+        long status = 0;
+        char* contentType = nullptr;
+        curl_off_t contentLength = -1;
+        curl_easy_getinfo(binding->m_curl, CURLINFO_RESPONSE_CODE, &status);
+        curl_easy_getinfo(binding->m_curl, CURLINFO_CONTENT_TYPE, &contentType);
+        curl_easy_getinfo(binding->m_curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &contentLength);
+        if (!binding->m_response.content_encoding.empty()) {
+            // The length on the wire says little about the decoded size
+            contentLength = -1;
+        }
+
+        if (!binding->m_sink->begin(status, contentType ? contentType : "", contentLength)) {
+            binding->m_sink.reset();
+        }
+    }
+
+    binding->m_response.body_bytes += bytes;
+    if (binding->m_sink) {
+        // Returning less than bytes aborts the transfer
+        return binding->m_sink->write(contents, bytes) ? bytes : 0;
+    }
+
+    binding->m_response.text.append(contents, bytes);
+    return bytes;
+}
+
+size_t RequestBinding::headerCallback(char* buffer, size_t size, size_t nitems, void* userp) {
+    RequestBinding* binding = static_cast<RequestBinding*>(userp);
+    size_t bytes = size * nitems;
+
+    // A new status line starts another header block (redirect, 100 Continue)
+    if (bytes >= 5 && std::strncmp(buffer, "HTTP/", 5) == 0) {
+        binding->m_response.content_encoding.clear();
+        binding->m_response.accept_encoding.clear();
+        return bytes;
+    }
+
+    std::string value;
+    if (headerValue(buffer, bytes, "Content-Encoding", value)) {
+        binding->m_response.content_encoding = value;
+    } else if (headerValue(buffer, bytes, "Accept-Encoding", value)) {
+        binding->m_response.accept_encoding = value;
+    }
+    return bytes;
+}
+
+// ---------------------------------------------------------------------------
+// CurlShare
+// ---------------------------------------------------------------------------
+
+CurlShare::CurlShare() {
+    ensureCurlGlobalInit();
+
+    m_share = curl_share_init();
+    curl_share_setopt(m_share, CURLSHOPT_LOCKFUNC, &CurlShare::lockCallback);
+    curl_share_setopt(m_share, CURLSHOPT_UNLOCKFUNC, &CurlShare::unlockCallback);
+    curl_share_setopt(m_share, CURLSHOPT_USERDATA, this);
+
+    // Share DNS results and TLS session tickets. Not connections: the
+    // pool's handles and the request engine run on different threads, and
+    // libcurl can't hand a connection (or an h2 stream's connection) from
+    // one thread's transfer to another's.
+    curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+}
+
+CurlShare::~CurlShare() {
+    curl_share_cleanup(m_share);
+}
+
+void CurlShare::lockCallback(CURL* /*handle*/, curl_lock_data data, curl_lock_access /*access*/, void* userptr) {
+    static_cast<CurlShare*>(userptr)->m_locks[data].lock();
+}
+
+void CurlShare::unlockCallback(CURL* /*handle*/, curl_lock_data data, void* userptr) {
+    static_cast<CurlShare*>(userptr)->m_locks[data].unlock();
+}
+
+// ---------------------------------------------------------------------------
+// HttpSession
+// ---------------------------------------------------------------------------
+
+HttpSession::HttpSession(std::shared_ptr<CurlShare> share)
+    : m_curl(nullptr),
+      m_share(std::move(share)) {
+    ensureCurlGlobalInit();
+    m_curl = curl_easy_init();
+}
+
+HttpSession::~HttpSession() {
+    if (m_curl) {
+        curl_easy_cleanup(m_curl);
+    }
+}
+
+HttpResponse HttpSession::post(const HttpRequest& request) {
+    HttpResponse response;
+    if (!m_curl) {
+        response.error = "curl_easy_init failed";
+        return response;
+    }
+
+    if (deadlinePassed(request)) {
+        response.error = "Deadline exceeded before sending";
+        response.expired = DeadlineExpiry::BeforeSending;
+        return response;
+    }
+
+    // curl_easy_reset clears the options but keeps the live connection,
+    // the DNS cache and the TLS session cache of this handle
+    curl_easy_reset(m_curl);
+
+    CURLcode result;
+    {
+        RequestBinding binding(m_curl, request, response, m_share);
+        result = curl_easy_perform(m_curl);
+        if (!binding.rejectedHttp2(result)) {
+            binding.complete(result);
+            return response;
+        }
+    }
+
+    // The server does not speak h2c: retry once over HTTP/1.1
+    response = HttpResponse();
+    curl_easy_reset(m_curl);
+    RequestBinding binding(m_curl, request, response, m_share);
+    binding.complete(curl_easy_perform(m_curl));
+
+    return response;
+}
+
+// ---------------------------------------------------------------------------
+// HttpSessionPool
+// ---------------------------------------------------------------------------
+
+HttpSessionPool::HttpSessionPool(size_t size)
+    : m_share(std::make_shared<CurlShare>()) {
+    if (size == 0) {
+        size = 1;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        m_sessions.push_back(std::make_unique<HttpSession>(m_share));
+        m_idle.push_back(m_sessions.back().get());
+    }
+}
+
+HttpSessionPool::Lease HttpSessionPool::acquire() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_available.wait(lock, [this] { return !m_idle.empty(); });
+
+    // Take the most recently used session, its connection is the warmest
+    HttpSession* session = m_idle.back();
+    m_idle.pop_back();
+    return Lease(this, session);
+}
+
+void HttpSessionPool::release(HttpSession* session) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_idle.push_back(session);
+    }
+    m_available.notify_one();
+}
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <curl/curl.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Where a request's deadline ran out, if it did
+enum class DeadlineExpiry {
+    None,
+    BeforeSending,  // still queued or waiting for a connection
+    InFlight        // transfer aborted mid-way
+};
+
+// Consumes a response body as it arrives, instead of it being collected in
+// HttpResponse::text. Runs on the thread driving the transfer.
+class ResponseSink {
+public:
+    virtual ~ResponseSink() = default;
+
+    // The headers are in. Return false to leave this body in
+    // HttpResponse::text instead (e.g. an error page). content_length is
+    // the size of the body as written to the sink, -1 if unknown. It is
+    // unknown for a content-coded body, whose Content-Length only gives the
+    // compressed size.
+    virtual bool begin(long status_code, const std::string& content_type, curl_off_t content_length) = 0;
+
+    // The next piece of the body; return false to abort the transfer
+    virtual bool write(const char* data, size_t size) = 0;
+};
+
+// Result of a single HTTP transfer
+struct HttpResponse {
+    long status_code = 0;
+    std::string content_type;
+    std::string text;
+    std::string error;
+
+    // Response headers about content codings: the coding the body came in
+    // (already decoded in text / the sink), and the codings the server
+    // takes for request bodies (RFC 7694)
+    std::string content_encoding;
+    std::string accept_encoding;
+
+    // Transfer timing, for upload throughput estimates. upload_seconds is
+    // the time the body took to reach the server, measured by UploadTimer
+    // (0 if the body was too small to time).
+    size_t upload_bytes = 0;
+    double upload_seconds = 0;
+    double total_seconds = 0;
+
+    // Response body as received (possibly compressed) and after decoding,
+    // and the time from its first byte to the last
+    size_t download_bytes = 0;
+    size_t body_bytes = 0;
+    double download_seconds = 0;
+
+    DeadlineExpiry expired = DeadlineExpiry::None;
+
+    // The sink that took the body, if any (text is empty then)
+    std::shared_ptr<ResponseSink> sink;
+};
+
+// Shared DNS and TLS-session caches (CURLSH). Every curl handle attached to
+// the same share reuses name lookups and resumes TLS sessions opened by the
+// others, so a new connection skips the lookup and most of the TLS
+// handshake. Open connections stay with the handle (or multi handle) that
+// made them.
+class CurlShare {
+public:
+    CurlShare();
+    ~CurlShare();
+
+    CurlShare(const CurlShare&) = delete;
+    CurlShare& operator=(const CurlShare&) = delete;
+
+    CURLSH* handle() const { return m_share; }
+
+private:
+    CURLSH* m_share;
+
+    // One lock per shared data type, as required by libcurl
+    std::mutex m_locks[CURL_LOCK_DATA_LAST];
+
+    static void lockCallback(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr);
+    static void unlockCallback(CURL* handle, curl_lock_data data, void* userptr);
+};
+
+// Protocol used for a request. Http2 negotiates h2 via ALPN on https URLs
+// and uses h2c with prior knowledge on plain-http URLs; if a server turns
+// out not to speak h2c the request is retried over HTTP/1.1 and the origin
+// is treated as HTTP/1.1-only for a while. A dropped connection only counts
+// as a rejection when it happens repeatedly on fresh connections.
+enum class HttpVersion {
+    Http1_1,
+    Http2
+};
+
+// One part of a multipart/form-data body, held in memory
+struct MultipartPart {
+    std::string name;
+    std::string filename;
+    std::string content_type;
+    std::vector<unsigned char> data;
+};
+
+// Transfer limits; 0 keeps libcurl's default
+struct HttpTimeouts {
+    long connect_ms = 0;          // TCP (and TLS) connection setup
+    long low_speed_bytes = 0;     // abort a transfer slower than this many
+    long low_speed_seconds = 0;   // bytes per second for this long
+};
+
+// An HTTP POST built entirely in memory. If parts is empty the request is
+// sent as a raw body with the given content type instead of multipart.
+struct HttpRequest {
+    std::string url;
+    std::vector<MultipartPart> parts;
+    std::vector<unsigned char> body;
+    std::string content_type = "application/octet-stream";
+    std::vector<std::string> headers;   // extra "Name: value" lines
+    std::string accept_encoding;        // codings for the response; decoded by libcurl
+    HttpVersion http_version = HttpVersion::Http1_1;
+    std::string unix_socket_path;       // connect here instead of the URL's host
+    HttpTimeouts timeouts;
+
+    // Give up on the request at this point, whether it is still queued or
+    // already on the wire. The default (epoch) means no deadline.
+    std::chrono::steady_clock::time_point deadline;
+
+    // Creates a sink for the response body; called once per transfer
+    // attempt, so retried or duplicated requests never share one
+    std::function<std::shared_ptr<ResponseSink>()> make_sink;
+};
+
+// True if the request has a deadline and it has passed
+bool deadlinePassed(const HttpRequest& request);
+
+// "scheme://host:port" of a URL, for per-server state; empty if it doesn't parse
+std::string originOf(const std::string& url);
+
+// Times a request body from curl's read callbacks, which works on any
+// libcurl version. curl asks for more once the socket took the previous
+// piece, and TCP sockets are kept from buffering much unsent data (see
+// TCP_NOTSENT_LOWAT), so the reads follow the upload. The rate is taken
+// between the first and the last read, and the upload time is the whole
+// body at that rate.
+struct UploadTimer {
+    std::chrono::steady_clock::time_point first;
+    std::chrono::steady_clock::time_point last;
+    size_t bytesRead = 0;
+    size_t bytesSent = 0;   // read before the last read
+
+    void mark(size_t count);
+    double seconds() const;
+};
+
+// An in-memory request body handed to curl by a read callback
+struct BodyCursor {
+    const unsigned char* data;
+    size_t size;
+    size_t offset;
+    UploadTimer* timer;
+
+    static size_t read(char* buffer, size_t size, size_t nitems, void* arg);
+    static int seek(void* arg, curl_off_t offset, int origin);
+};
+
+// curl_mime over in-memory parts. The part bytes are streamed straight out
+// of the request by a read callback, so they are never copied or written
+// to disk. The request must outlive the MimeBody.
+class MimeBody {
+public:
+    MimeBody(CURL* curl, const std::vector<MultipartPart>& parts, UploadTimer* timer = nullptr);
+    ~MimeBody();
+
+    MimeBody(const MimeBody&) = delete;
+    MimeBody& operator=(const MimeBody&) = delete;
+
+    curl_mime* get() const { return m_mime; }
+
+private:
+    curl_mime* m_mime;
+    std::vector<BodyCursor> m_cursors;
+};
+
+// Applies an HttpRequest to a curl easy handle and owns everything curl
+// keeps pointers to (mime body, header list) until the transfer is over.
+// Used by both the blocking HttpSession and the AsyncRequestEngine.
+class RequestBinding {
+public:
+    RequestBinding(CURL* curl, const HttpRequest& request, HttpResponse& response,
+                   const std::shared_ptr<CurlShare>& share);
+    ~RequestBinding();
+
+    RequestBinding(const RequestBinding&) = delete;
+    RequestBinding& operator=(const RequestBinding&) = delete;
+
+    // Read status code and error once the transfer has finished
+    void complete(CURLcode result);
+
+    // True if the transfer failed because the server does not speak h2c.
+    // The origin is then marked HTTP/1.1-only; rebind to retry.
+    bool rejectedHttp2(CURLcode result);
+
+private:
+    CURL* m_curl;
+    std::string m_url;
+    std::chrono::steady_clock::time_point m_deadline;
+    bool m_priorKnowledge;
+    HttpResponse& m_response;
+    std::shared_ptr<ResponseSink> m_sink;
+    bool m_sinkStarted;
+    std::unique_ptr<MimeBody> m_mime;
+    BodyCursor m_body;
+    UploadTimer m_uploadTimer;
+    curl_slist* m_headers;
+
+    static size_t writeCallback(char* contents, size_t size, size_t nmemb, void* userp);
+    static size_t headerCallback(char* buffer, size_t size, size_t nitems, void* userp);
+};
+
+// A long-lived curl easy handle. Reusing the handle keeps the connection to
+// the server open between requests (HTTP keep-alive). A session runs one
+// request at a time; use HttpSessionPool for concurrent callers.
+class HttpSession {
+public:
+    explicit HttpSession(std::shared_ptr<CurlShare> share = nullptr);
+    ~HttpSession();
+
+    HttpSession(const HttpSession&) = delete;
+    HttpSession& operator=(const HttpSession&) = delete;
+
+    // Send an in-memory POST request (blocks until completion)
+    HttpResponse post(const HttpRequest& request);
+
+private:
+    CURL* m_curl;
+    std::shared_ptr<CurlShare> m_share;
+
+};
+
+// Fixed set of sessions sharing one CurlShare. Callers borrow a session for
+// the duration of a request and give it back when the lease goes away.
+class HttpSessionPool {
+public:
+    class Lease {
+    public:
+        Lease(HttpSessionPool* pool, HttpSession* session) : m_pool(pool), m_session(session) {}
+        Lease(Lease&& other) noexcept : m_pool(other.m_pool), m_session(other.m_session) {
+            other.m_session = nullptr;
+        }
+        ~Lease() {
+            if (m_session) {
+                m_pool->release(m_session);
+            }
+        }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        Lease& operator=(Lease&&) = delete;
+
+        HttpSession* operator->() const { return m_session; }
+        HttpSession& operator*() const { return *m_session; }
+
+    private:
+        HttpSessionPool* m_pool;
+        HttpSession* m_session;
+    };
+
+    explicit HttpSessionPool(size_t size = 2);
+
+    // Borrow a session (blocks until one is free)
+    Lease acquire();
+
+    size_t size() const { return m_sessions.size(); }
+
+    const std::shared_ptr<CurlShare>& share() const { return m_share; }
+
+private:
+    std::shared_ptr<CurlShare> m_share;
+    std::vector<std::unique_ptr<HttpSession>> m_sessions;
+
+    std::vector<HttpSession*> m_idle;
+    std::mutex m_mutex;
+    std::condition_variable m_available;
+
+    void release(HttpSession* session);
+};
+
+// Initialize libcurl once per process (safe to call from any thread)
+void ensureCurlGlobalInit();
@@ -0,0 +1,403 @@
+#include "JsonMaskScanner.h"
+#include "Base64.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Nesting deeper than this is not a segmentation response
+const size_t kMaxDepth = 64;
+
+// Keys longer than this can't be "masks" and aren't kept in full
+const size_t kMaxKeyLength = 16;
+
+bool isWhitespace(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+bool isLiteralChar(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '-' || c == '+' || c == '.' ||
+           c == 'E';
+}
+
+bool isHexDigit(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+} // namespace
+
+JsonMaskScanner::JsonMaskScanner() {
+    reset();
+}
+
+void JsonMaskScanner::reset(size_t expected_bytes) {
+    m_state = State::Value;
+    m_stringKind = StringKind::Other;
+    m_unicodeDigits = 0;
+    m_stack.clear();
+    m_key.clear();
+    m_quadLength = 0;
+    m_padding = 0;
+    m_bytes.clear();
+    m_masks.clear();
+    m_resultCount = 0;
+    m_error.clear();
+
+    // Base64 turns 3 bytes into 4 characters, so the masks fit in 3/4 of
+    // the body; growing the buffer mid-response would copy it
+    m_bytes.reserve(expected_bytes / 4 * 3 + 3);
+}
+
+bool JsonMaskScanner::complete() const {
+    return m_state == State::Done;
+}
+
+const JsonMaskScanner::Mask* JsonMaskScanner::firstMask(size_t result) const {
+    for (const Mask& mask : m_masks) {
+        if (mask.result == result) {
+            return &mask;
+        }
+    }
+    return nullptr;
+}
+
+bool JsonMaskScanner::fail(const std::string& message) {
+    m_state = State::Failed;
+    m_error = message;
+    return false;
+}
+
+bool JsonMaskScanner::feed(const char* data, size_t size) {
+    size_t i = 0;
+    while (i < size) {
+        char c = data[i];
+
+        switch (m_state) {
+        case State::String: {
+            // Take the whole run up to the next quote or escape at once
+            size_t end = i;
+            while (end < size && data[end] != '"' && data[end] != '\\') {
+                end++;
+            }
+            if (m_stringKind == StringKind::Mask) {
+                if (!decodeBase64(data + i, end - i)) {
+                    return false;
+                }
+            } else if (m_stringKind == StringKind::Key && m_key.size() < kMaxKeyLength) {
+                m_key.append(data + i, std::min(end - i, kMaxKeyLength - m_key.size()));
+            }
+            i = end;
+            if (i == size) {
+                break;
+            }
+
+            if (data[i] == '\\') {
+                m_state = State::Escape;
+                i++;
+                break;
+            }
+
+            // Closing quote
+            i++;
+            if (m_stringKind == StringKind::Key) {
+                Container& object = m_stack.back();
+                object.keyIsMasks = m_key == "masks";
+                if (object.keyIsMasks) {
+                    // Element i of an enclosing array is result i
+                    size_t depth = m_stack.size();
+                    size_t result = depth >= 2 && !m_stack[depth - 2].isObject ? m_stack[depth - 2].index : 0;
+                    m_resultCount = std::max(m_resultCount, result + 1);
+                }
+                m_state = State::Colon;
+                break;
+            }
+            if (m_stringKind == StringKind::Mask && !endMask()) {
+                return false;
+            }
+            m_state = m_stack.empty() ? State::Done : State::AfterValue;
+            break;
+        }
+
+        case State::Escape:
+            if (m_unicodeDigits > 0) {
+                // \uXXXX: only skipped, keys and masks never need it
+                if (!isHexDigit(c)) {
+                    return fail("Invalid \\u escape");
+                }
+                if (--m_unicodeDigits == 0) {
+                    m_state = State::String;
+                }
+            } else if (c == 'u' && m_stringKind != StringKind::Mask) {
+                m_unicodeDigits = 4;
+            } else if (m_stringKind == StringKind::Mask) {
+                // JSON encoders may write '/' as "\/"; nothing else belongs in base64
+                if (c != '/') {
+                    return fail("Invalid escape in mask string");
+                }
+                if (!decodeBase64(&c, 1)) {
+                    return false;
+                }
+                m_state = State::String;
+            } else if (std::strchr("\"\\/bfnrt", c) && c != '\0') {
+                if (m_stringKind == StringKind::Key && m_key.size() < kMaxKeyLength) {
+                    m_key.push_back(c);
+                }
+                m_state = State::String;
+            } else {
+                return fail("Invalid escape");
+            }
+            i++;
+            break;
+
+        case State::Literal:
+            if (isLiteralChar(c)) {
+                i++;
+            } else {
+                // The delimiter is handled by the next state
+                m_state = m_stack.empty() ? State::Done : State::AfterValue;
+            }
+            break;
+
+        default:
+            if (isWhitespace(c)) {
+                i++;
+                break;
+            }
+
+            switch (m_state) {
+            case State::Value:
+                if (!beginValue(c)) {
+                    return false;
+                }
+                break;
+
+            case State::Key:
+                if (c == '"') {
+                    m_stringKind = StringKind::Key;
+                    m_key.clear();
+                    m_state = State::String;
+                } else if (c == '}') {
+                    if (!endContainer(c)) {
+                        return false;
+                    }
+                } else {
+                    return fail("Expected a key");
+                }
+                break;
+
+            case State::Colon:
+                if (c != ':') {
+                    return fail("Expected ':'");
+                }
+                m_state = State::Value;
+                break;
+
+            case State::AfterValue:
+                if (c == ',') {
+                    Container& container = m_stack.back();
+                    if (container.isObject) {
+                        container.keyIsMasks = false;
+                        m_state = State::Key;
+                    } else {
+                        container.index++;
+                        m_state = State::Value;
+                    }
+                } else if (!endContainer(c)) {
+                    return false;
+                }
+                break;
+
+            case State::Done:
+                return fail("Unexpected data after the JSON document");
+
+            default:
+                return false;
+            }
+            i++;
+            break;
+        }
+    }
+    return m_state != State::Failed;
+}
+
+bool JsonMaskScanner::beginValue(char c) {
+    if (c == '{' || c == '[') {
+        if (m_stack.size() >= kMaxDepth) {
+            return fail("JSON nested too deeply");
+        }
+        m_stack.push_back({c == '{', 0, false});
+        m_state = c == '{' ? State::Key : State::Value;
+        return true;
+    }
+
+    // Empty array
+    if (c == ']') {
+        return endContainer(c);
+    }
+
+    if (c == '"') {
+        // A string element of an array under "masks"
+        size_t depth = m_stack.size();
+        bool isMask = depth >= 2 && !m_stack[depth - 1].isObject && m_stack[depth - 2].isObject &&
+                      m_stack[depth - 2].keyIsMasks;
+        m_stringKind = isMask ? StringKind::Mask : StringKind::Other;
+        if (isMask) {
+            beginMask();
+        }
+        m_state = State::String;
+        return true;
+    }
+
+    if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n') {
+        m_state = State::Literal;
+        return true;
+    }
+
+    return fail(std::string("Unexpected character '") + c + "'");
+}
+
+bool JsonMaskScanner::endContainer(char c) {
+    if (m_stack.empty() || m_stack.back().isObject != (c == '}')) {
+        return fail(std::string("Unexpected '") + c + "'");
+    }
+
+    m_stack.pop_back();
+    m_state = m_stack.empty() ? State::Done : State::AfterValue;
+    return true;
+}
+
+void JsonMaskScanner::beginMask() {
+    size_t depth = m_stack.size();
+    size_t result = depth >= 3 && !m_stack[depth - 3].isObject ? m_stack[depth - 3].index : 0;
+
+    m_masks.push_back({result, m_bytes.size(), 0});
+    m_quadLength = 0;
+    m_padding = 0;
+}
+
+bool JsonMaskScanner::endMask() {
+    // Unpadded input may end in 2 or 3 symbols
+    if (m_quadLength == 1) {
+        return fail("Truncated base64 mask");
+    }
+    if (m_quadLength > 1) {
+        uint32_t bits = (m_quad[0] << 18) | (m_quad[1] << 12) | (m_quad[2] << 6);
+        m_bytes.push_back(static_cast<uint8_t>(bits >> 16));
+        if (m_quadLength == 3) {
+            m_bytes.push_back(static_cast<uint8_t>(bits >> 8));
+        }
+        m_quadLength = 0;
+    }
+
+    Mask& mask = m_masks.back();
+    mask.size = m_bytes.size() - mask.offset;
+    return true;
+}
+
+bool JsonMaskScanner::decodeBase64(const char* data, size_t size) {
+    size_t i = 0;
+
+    // Whole quads straight from the input, once no quad is carried over
+    while (m_quadLength > 0 && i < size) {
+        if (!pushSymbol(data[i++])) {
+            return false;
+        }
+    }
+    if (m_padding == 0 && size - i >= 4) {
+        size_t start = m_bytes.size();
+        m_bytes.resize(start + (size - i) / 4 * 3);
+
+        // Stops at padding or an invalid symbol; the slow path sorts those out
+        size_t consumed = base64::decodeBlocks(data + i, size - i, m_bytes.data() + start);
+        m_bytes.resize(start + consumed / 4 * 3);
+        i += consumed;
+    }
+
+    while (i < size) {
+        if (!pushSymbol(data[i++])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool JsonMaskScanner::pushSymbol(char symbol) {
+    int value = base64::symbolValue(symbol);
+    if (value < 0 && symbol != '=') {
+        return fail("Invalid base64 character in mask");
+    }
+
+    if (symbol == '=') {
+        if (m_quadLength < 2) {
+            return fail("Misplaced base64 padding");
+        }
+        m_padding++;
+        value = 0;
+    } else if (m_padding > 0) {
+        return fail("Base64 data after padding");
+    }
+
+    m_quad[m_quadLength++] = static_cast<uint8_t>(value);
+    if (m_quadLength == 4) {
+        uint32_t bits = (m_quad[0] << 18) | (m_quad[1] << 12) | (m_quad[2] << 6) | m_quad[3];
+        m_bytes.push_back(static_cast<uint8_t>(bits >> 16));
+        if (m_padding < 2) {
+            m_bytes.push_back(static_cast<uint8_t>(bits >> 8));
+        }
+        if (m_padding < 1) {
+            m_bytes.push_back(static_cast<uint8_t>(bits));
+        }
+        m_quadLength = 0;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// JsonMaskSink
+// ---------------------------------------------------------------------------
+
+bool JsonMaskSink::begin(long status_code, const std::string& content_type, curl_off_t content_length) {
+    if (status_code != 200 || content_type.compare(0, 16, "application/json") != 0) {
+        return false;
+    }
+    // -1 for compressed bodies (see ResponseSink::begin)
+    m_scanner.reset(content_length > 0 ? static_cast<size_t>(content_length) : 0);
+    return true;
+}
+
+bool JsonMaskSink::write(const char* data, size_t size) {
+    return m_scanner.feed(data, size);
+}
+
+// ---------------------------------------------------------------------------
+// JsonMaskSinkPool
+// ---------------------------------------------------------------------------
+
+JsonMaskSinkPool::JsonMaskSinkPool(size_t max_idle)
+    : m_state(std::make_shared<State>()) {
+    m_state->maxIdle = max_idle;
+}
+
+std::shared_ptr<ResponseSink> JsonMaskSinkPool::acquire() const {
+    std::unique_ptr<JsonMaskSink> sink;
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        if (!m_state->idle.empty()) {
+            sink = std::move(m_state->idle.back());
+            m_state->idle.pop_back();
+        }
+    }
+    if (!sink) {
+        sink.reset(new JsonMaskSink());
+    }
+
+    // The deleter holds the pool state, so late releases still have a home
+    std::shared_ptr<State> state = m_state;
+    return std::shared_ptr<ResponseSink>(sink.release(), [state](ResponseSink* released) {
+        std::unique_ptr<JsonMaskSink> owned(static_cast<JsonMaskSink*>(released));
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->idle.size() < state->maxIdle) {
+            state->idle.push_back(std::move(owned));
+        }
+    });
+}
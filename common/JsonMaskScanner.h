@@ -0,0 +1,141 @@
+#pragma once
+
+#include "HttpSession.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Incremental scanner for the JSON answers of the segmentation server:
+//
+//   {"masks": ["<base64 PNG>", ...]}
+//   {"results": [{"masks": [...]}, ...]}       (batch requests)
+//
+// The body is fed in whatever pieces the network delivers. The scanner
+// walks the JSON structure without building a DOM, and every string inside
+// an array under a "masks" key is base64-decoded straight into one
+// contiguous buffer as its characters arrive. Everything else is skipped.
+// When the last byte is in, the decoded masks are ready.
+//
+// A mask belongs to result i when its object is element i of an enclosing
+// array (the batch form), and to result 0 otherwise.
+class JsonMaskScanner {
+public:
+    // A decoded mask, as a slice of the scanner's buffer
+    struct Mask {
+        size_t result;
+        size_t offset;
+        size_t size;
+    };
+
+    JsonMaskScanner();
+
+    // Start a new document. expected_bytes, the length of the document as
+    // fed (not a compressed Content-Length), sizes the decode buffer up
+    // front; 0 if unknown, which keeps the capacity of earlier documents.
+    void reset(size_t expected_bytes = 0);
+
+    // Scan the next piece of the body. Returns false once the input turns
+    // out to be malformed; later calls are ignored.
+    bool feed(const char* data, size_t size);
+
+    // True once a whole, well-formed document has been scanned
+    bool complete() const;
+
+    const std::string& error() const { return m_error; }
+
+    size_t maskCount() const { return m_masks.size(); }
+    const Mask& mask(size_t index) const { return m_masks[index]; }
+    const uint8_t* data(const Mask& mask) const { return m_bytes.data() + mask.offset; }
+
+    // The first mask of a result, or nullptr if it has none
+    const Mask* firstMask(size_t result) const;
+
+    // Results seen (highest result index with a "masks" key + 1)
+    size_t resultCount() const { return m_resultCount; }
+
+private:
+    enum class State {
+        Value,        // expecting a value
+        AfterValue,   // expecting ',' or the end of the container
+        Key,          // expecting a key or the end of an object
+        Colon,        // expecting ':' after a key
+        String,       // inside a string
+        Escape,       // after a backslash inside a string
+        Literal,      // inside a number, true, false or null
+        Done,         // the top-level value is complete
+        Failed
+    };
+
+    // What the string being scanned is
+    enum class StringKind {
+        Key,
+        Mask,
+        Other
+    };
+
+    struct Container {
+        bool isObject;
+        size_t index;      // elements seen so far (arrays)
+        bool keyIsMasks;   // the current key is "masks" (objects)
+    };
+
+    State m_state;
+    StringKind m_stringKind;
+    int m_unicodeDigits;
+    std::vector<Container> m_stack;
+    std::string m_key;
+
+    // Base64 state of the mask being decoded
+    uint8_t m_quad[4];
+    int m_quadLength;
+    int m_padding;
+
+    std::vector<uint8_t> m_bytes;
+    std::vector<Mask> m_masks;
+    size_t m_resultCount;
+    std::string m_error;
+
+    bool fail(const std::string& message);
+    bool beginValue(char c);
+    bool endContainer(char c);
+    void beginMask();
+    bool endMask();
+    bool decodeBase64(const char* data, size_t size);
+    bool pushSymbol(char symbol);
+};
+
+// ResponseSink that runs a JsonMaskScanner over successful JSON responses;
+// other responses are left in HttpResponse::text
+class JsonMaskSink : public ResponseSink {
+public:
+    bool begin(long status_code, const std::string& content_type, curl_off_t content_length) override;
+    bool write(const char* data, size_t size) override;
+
+    const JsonMaskScanner& scanner() const { return m_scanner; }
+
+private:
+    JsonMaskScanner m_scanner;
+};
+
+// Hands out JsonMaskSinks for HttpRequest::make_sink. A sink returns to the
+// pool when its last reference is dropped (even after the pool itself is
+// gone), and its scanner keeps the decode buffer grown by earlier
+// responses, so steady-state responses decode without allocating.
+class JsonMaskSinkPool {
+public:
+    explicit JsonMaskSinkPool(size_t max_idle = 16);
+
+    std::shared_ptr<ResponseSink> acquire() const;
+
+private:
+    struct State {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<JsonMaskSink>> idle;
+        size_t maxIdle;
+    };
+
+    std::shared_ptr<State> m_state;
+};
@@ -0,0 +1,197 @@
+#include "MaskCodec.h"
+#include <algorithm>
+#include <cstring>
+
+namespace mask_codec {
+
+namespace {
+
+constexpr size_t kHeaderSize = 20;
+constexpr uint8_t kVersion = 1;
+
+uint32_t readU32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+void writeU32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+void writeVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+} // namespace
+
+bool MaskSetReader::parse(const uint8_t* data, size_t size) {
+    m_instances.clear();
+    m_error.clear();
+    m_byteSize = 0;
+
+    if (size < kHeaderSize || std::memcmp(data, "SGMK", 4) != 0) {
+        m_error = "not a binary mask response";
+        return false;
+    }
+    if (data[4] != kVersion) {
+        m_error = "unsupported mask format version " + std::to_string(data[4]);
+        return false;
+    }
+    if (data[5] > static_cast<uint8_t>(Encoding::RunLength)) {
+        m_error = "unknown mask encoding " + std::to_string(data[5]);
+        return false;
+    }
+
+    m_encoding = static_cast<Encoding>(data[5]);
+    m_width = readU32(data + 8);
+    m_height = readU32(data + 12);
+    uint32_t count = readU32(data + 16);
+
+    // Reject sizes that would overflow or are clearly bogus
+    if (m_width > 16384 || m_height > 16384) {
+        m_error = "mask dimensions out of range";
+        return false;
+    }
+
+    size_t offset = kHeaderSize;
+    for (uint32_t i = 0; i < count; i++) {
+        if (size - offset < 4) {
+            m_error = "truncated instance table";
+            return false;
+        }
+        size_t length = readU32(data + offset);
+        offset += 4;
+        if (size - offset < length) {
+            m_error = "truncated instance payload";
+            return false;
+        }
+        m_instances.push_back({data + offset, length});
+        offset += length;
+    }
+
+    m_byteSize = offset;
+    return true;
+}
+
+bool MaskSetReader::decodeInstance(size_t index, uint8_t* out, size_t stride) const {
+    if (index >= m_instances.size()) {
+        m_error = "instance index out of range";
+        return false;
+    }
+
+    if (m_encoding == Encoding::BitPacked) {
+        return decodeBitPacked(m_instances[index], out, stride);
+    }
+    return decodeRunLength(m_instances[index], out, stride);
+}
+
+bool MaskSetReader::decodeBitPacked(const Instance& instance, uint8_t* out, size_t stride) const {
+    size_t pixels = static_cast<size_t>(m_width) * m_height;
+    if (instance.size < (pixels + 7) / 8) {
+        m_error = "bit-packed mask too short";
+        return false;
+    }
+
+    size_t bit = 0;
+    for (uint32_t y = 0; y < m_height; y++) {
+        uint8_t* row = out + y * stride;
+        for (uint32_t x = 0; x < m_width; x++, bit++) {
+            row[x] = (instance.data[bit >> 3] & (0x80 >> (bit & 7))) ? 255 : 0;
+        }
+    }
+    return true;
+}
+
+bool MaskSetReader::decodeRunLength(const Instance& instance, uint8_t* out, size_t stride) const {
+    const size_t pixels = static_cast<size_t>(m_width) * m_height;
+    size_t pixel = 0;
+    uint8_t value = 0;
+
+    size_t pos = 0;
+    while (pos < instance.size) {
+        // Read one LEB128 run length
+        uint64_t run = 0;
+        int shift = 0;
+        uint8_t byte;
+        do {
+            if (pos >= instance.size || shift > 56) {
+                m_error = "malformed run length";
+                return false;
+            }
+            byte = instance.data[pos++];
+            run |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+
+        if (run > pixels - pixel) {
+            m_error = "runs exceed mask size";
+            return false;
+        }
+
+        // Fill the run row by row
+        while (run > 0) {
+            size_t y = pixel / m_width;
+            size_t x = pixel % m_width;
+            size_t count = std::min<uint64_t>(run, m_width - x);
+            std::memset(out + y * stride + x, value, count);
+            pixel += count;
+            run -= count;
+        }
+
+        value ^= 0xFF;
+    }
+
+    if (pixel != pixels) {
+        m_error = "runs do not cover the mask";
+        return false;
+    }
+    return true;
+}
+
+std::vector<uint8_t> encodeMaskSet(uint32_t width, uint32_t height,
+                                   const std::vector<const uint8_t*>& masks, Encoding encoding) {
+    std::vector<uint8_t> out = {'S', 'G', 'M', 'K', kVersion, static_cast<uint8_t>(encoding), 0, 0};
+    writeU32(out, width);
+    writeU32(out, height);
+    writeU32(out, static_cast<uint32_t>(masks.size()));
+
+    const size_t pixels = static_cast<size_t>(width) * height;
+    std::vector<uint8_t> payload;
+    for (const uint8_t* mask : masks) {
+        payload.clear();
+
+        if (encoding == Encoding::BitPacked) {
+            payload.assign((pixels + 7) / 8, 0);
+            for (size_t i = 0; i < pixels; i++) {
+                if (mask[i]) {
+                    payload[i >> 3] |= 0x80 >> (i & 7);
+                }
+            }
+        } else {
+            bool foreground = false;
+            size_t run = 0;
+            for (size_t i = 0; i < pixels; i++) {
+                if ((mask[i] != 0) != foreground) {
+                    writeVarint(payload, run);
+                    foreground = !foreground;
+                    run = 0;
+                }
+                run++;
+            }
+            writeVarint(payload, run);
+        }
+
+        writeU32(out, static_cast<uint32_t>(payload.size()));
+        out.insert(out.end(), payload.begin(), payload.end());
+    }
+
+    return out;
+}
+
+} // namespace mask_codec
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Compact binary mask response ("application/x-segmentation-masks").
+//
+// All integers are little-endian.
+//
+//   offset  size  field
+//        0     4  magic "SGMK"
+//        4     1  version (1)
+//        5     1  encoding: 0 = bit-packed, 1 = run-length
+//        6     2  reserved (0)
+//        8     4  width
+//       12     4  height
+//       16     4  instance count
+//       20        per instance: uint32 payload size, then the payload
+//
+// Bit-packed payloads hold ceil(width * height / 8) bytes, row-major, most
+// significant bit first. Run-length payloads are LEB128 varints giving
+// alternating background/foreground run lengths in row-major order,
+// starting with a (possibly empty) background run; the runs must add up
+// to width * height. Decoded pixels are 0 (background) or 255 (mask).
+//
+// A batch response carries one mask set per uploaded frame, back to back,
+// in upload order.
+namespace mask_codec {
+
+constexpr const char* kContentType = "application/x-segmentation-masks";
+
+enum class Encoding : uint8_t {
+    BitPacked = 0,
+    RunLength = 1
+};
+
+// Validates a binary mask response and decodes its instances on demand
+class MaskSetReader {
+public:
+    // Parse and validate the header and instance table. The data must stay
+    // alive while the reader is used.
+    bool parse(const uint8_t* data, size_t size);
+
+    uint32_t width() const { return m_width; }
+    uint32_t height() const { return m_height; }
+    size_t instanceCount() const { return m_instances.size(); }
+    Encoding encoding() const { return m_encoding; }
+
+    // Bytes the parsed mask set occupies; the next set of a batch starts there
+    size_t byteSize() const { return m_byteSize; }
+
+    // Decode instance i into an 8-bit buffer with the given row stride
+    bool decodeInstance(size_t index, uint8_t* out, size_t stride) const;
+
+    // Why the last parse() or decodeInstance() failed
+    const std::string& error() const { return m_error; }
+
+private:
+    struct Instance {
+        const uint8_t* data;
+        size_t size;
+    };
+
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    Encoding m_encoding = Encoding::BitPacked;
+    size_t m_byteSize = 0;
+    std::vector<Instance> m_instances;
+    mutable std::string m_error;
+
+    bool decodeBitPacked(const Instance& instance, uint8_t* out, size_t stride) const;
+    bool decodeRunLength(const Instance& instance, uint8_t* out, size_t stride) const;
+};
+
+// Encode masks (each width * height bytes, non-zero = foreground). Used by
+// stand-in servers and the round-trip checks in
+// SegmentationClient/tests/mask_codec_test.cpp.
+std::vector<uint8_t> encodeMaskSet(uint32_t width, uint32_t height,
+                                   const std::vector<const uint8_t*>& masks, Encoding encoding);
+
+} // namespace mask_codec
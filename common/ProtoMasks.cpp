@@ -0,0 +1,95 @@
+#include "ProtoMasks.h"
+#include <cstring>
+
+namespace proto_masks {
+
+namespace {
+
+constexpr size_t kHeaderSize = 28;
+constexpr uint8_t kVersion = 1;
+
+uint16_t readU16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t readU32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+float readFloat(const uint8_t* p) {
+    uint32_t bits = readU32(p);
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+} // namespace
+
+bool ProtoSetReader::parse(const uint8_t* data, size_t size) {
+    m_instances.clear();
+    m_prototypes = nullptr;
+    m_error.clear();
+
+    if (size < kHeaderSize || std::memcmp(data, "YPRT", 4) != 0) {
+        m_error = "not a prototype response";
+        return false;
+    }
+    if (data[4] != kVersion) {
+        m_error = "unsupported prototype format version " + std::to_string(data[4]);
+        return false;
+    }
+    if (data[5] > static_cast<uint8_t>(PrototypeType::Int8)) {
+        m_error = "unknown prototype type " + std::to_string(data[5]);
+        return false;
+    }
+
+    m_type = static_cast<PrototypeType>(data[5]);
+    m_count = readU16(data + 6);
+    m_protoWidth = readU16(data + 8);
+    m_protoHeight = readU16(data + 10);
+    m_imageWidth = readU32(data + 12);
+    m_imageHeight = readU32(data + 16);
+    m_scale = readFloat(data + 20);
+    uint32_t count = readU32(data + 24);
+
+    // Reject sizes that would overflow or are clearly bogus
+    if (m_count == 0 || m_count > 256 || m_protoWidth == 0 || m_protoHeight == 0 ||
+        m_imageWidth == 0 || m_imageHeight == 0 || m_imageWidth > 16384 || m_imageHeight > 16384) {
+        m_error = "prototype dimensions out of range";
+        return false;
+    }
+
+    size_t instanceSize = (5 + static_cast<size_t>(m_count)) * 4;
+    size_t valueSize = m_type == PrototypeType::Float16 ? 2 : 1;
+    size_t prototypeSize = static_cast<size_t>(m_count) * m_protoWidth * m_protoHeight * valueSize;
+    if ((size - kHeaderSize) / instanceSize < count ||
+        size - kHeaderSize - count * instanceSize != prototypeSize) {
+        m_error = "prototype response size mismatch";
+        return false;
+    }
+
+    const uint8_t* p = data + kHeaderSize;
+    for (uint32_t i = 0; i < count; i++) {
+        Instance instance;
+        for (int k = 0; k < 4; k++) {
+            instance.box[k] = readFloat(p + 4 * k);
+        }
+        instance.score = readFloat(p + 16);
+        instance.coefficients = p + 20;
+        m_instances.push_back(instance);
+        p += instanceSize;
+    }
+
+    m_prototypes = p;
+    return true;
+}
+
+void ProtoSetReader::coefficients(size_t index, float* out) const {
+    const uint8_t* p = m_instances[index].coefficients;
+    for (uint32_t k = 0; k < m_count; k++) {
+        out[k] = readFloat(p + 4 * k);
+    }
+}
+
+} // namespace proto_masks
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// YOLOv8-seg prototype response ("application/x-yolo-prototypes").
+//
+// Instead of one rasterized mask per detection, the server sends the
+// model's mask prototypes once plus each detection's box and mask
+// coefficients; the client assembles the masks (mask = sigmoid(coefficients
+// . prototypes), cropped to the box, upsampled to the image).
+//
+// All integers and floats are little-endian (floats IEEE 754 binary32).
+//
+//   offset  size  field
+//        0     4  magic "YPRT"
+//        4     1  version (1)
+//        5     1  prototype type: 0 = float16, 1 = int8
+//        6     2  prototype count C (32 for YOLOv8)
+//        8     2  prototype width
+//       10     2  prototype height
+//       12     4  image width
+//       16     4  image height
+//       20     4  float: int8 scale (value = q * scale), 0 for float16
+//       24     4  instance count N
+//       28        per instance: float x1, y1, x2, y2 (box in image pixels),
+//                 float score, float coefficients[C]
+//                 then C prototype planes, width * height values each,
+//                 row-major
+//
+// The prototype planes cover exactly the image: servers crop the letterbox
+// padding away before sending, so prototype pixel (x, y) lies at image
+// pixel (x * image width / prototype width, ...).
+namespace proto_masks {
+
+constexpr const char* kContentType = "application/x-yolo-prototypes";
+
+enum class PrototypeType : uint8_t {
+    Float16 = 0,
+    Int8 = 1
+};
+
+// Validates a prototype response and gives access to its parts
+class ProtoSetReader {
+public:
+    struct Instance {
+        float box[4];    // x1, y1, x2, y2 in image pixels
+        float score;
+        const uint8_t* coefficients;  // C little-endian floats, unaligned
+    };
+
+    // Parse and validate the whole response. The data must stay alive
+    // while the reader is used.
+    bool parse(const uint8_t* data, size_t size);
+
+    PrototypeType prototypeType() const { return m_type; }
+    uint32_t prototypeCount() const { return m_count; }
+    uint32_t prototypeWidth() const { return m_protoWidth; }
+    uint32_t prototypeHeight() const { return m_protoHeight; }
+    uint32_t imageWidth() const { return m_imageWidth; }
+    uint32_t imageHeight() const { return m_imageHeight; }
+    float int8Scale() const { return m_scale; }
+
+    size_t instanceCount() const { return m_instances.size(); }
+    const Instance& instance(size_t index) const { return m_instances[index]; }
+
+    // Copy an instance's coefficients into prototypeCount() floats
+    void coefficients(size_t index, float* out) const;
+
+    // The prototype planes (prototypeCount() x height x width values)
+    const uint8_t* prototypes() const { return m_prototypes; }
+
+    const std::string& error() const { return m_error; }
+
+private:
+    PrototypeType m_type = PrototypeType::Float16;
+    uint32_t m_count = 0;
+    uint32_t m_protoWidth = 0;
+    uint32_t m_protoHeight = 0;
+    uint32_t m_imageWidth = 0;
+    uint32_t m_imageHeight = 0;
+    float m_scale = 0.0f;
+    std::vector<Instance> m_instances;
+    const uint8_t* m_prototypes = nullptr;
+    std::string m_error;
+};
+
+} // namespace proto_masks
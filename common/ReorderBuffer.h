@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+// Puts results that arrive out of order back into sequence order.
+//
+// Sequences are expected to be consecutive, starting at first_sequence.
+// A result is released as soon as every earlier sequence has been
+// released. So that one lost answer can't stall the stream, a missing
+// sequence is given up on once max_held later results are waiting behind
+// it; if it turns up after that it is dropped as late.
+template <typename T>
+class ReorderBuffer {
+public:
+    using Entry = std::pair<uint32_t, T>;
+
+    explicit ReorderBuffer(uint32_t first_sequence = 1, size_t max_held = 8)
+        : m_next(first_sequence), m_maxHeld(max_held == 0 ? 1 : max_held) {
+    }
+
+    // Add the result for a sequence and append everything that is now in
+    // order to ready. Returns false if the result came too late to be used.
+    bool push(uint32_t sequence, T value, std::vector<Entry>& ready) {
+        if (sequence < m_next) {
+            m_late++;
+            return false;
+        }
+
+        m_held.emplace(sequence, std::move(value));
+        release(ready);
+
+        // Skip over gaps while too much is waiting on them
+        while (m_held.size() > m_maxHeld) {
+            m_skipped += m_held.begin()->first - m_next;
+            m_next = m_held.begin()->first;
+            release(ready);
+        }
+        return true;
+    }
+
+    // Sequence the next released result must have
+    uint32_t nextSequence() const { return m_next; }
+
+    size_t held() const { return m_held.size(); }
+
+    // Sequences given up on, and results that arrived after that
+    uint64_t skipped() const { return m_skipped; }
+    uint64_t late() const { return m_late; }
+
+private:
+    uint32_t m_next;
+    size_t m_maxHeld;
+    std::map<uint32_t, T> m_held;
+    uint64_t m_skipped = 0;
+    uint64_t m_late = 0;
+
+    void release(std::vector<Entry>& ready) {
+        auto it = m_held.begin();
+        while (it != m_held.end() && it->first == m_next) {
+            ready.emplace_back(it->first, std::move(it->second));
+            it = m_held.erase(it);
+            m_next++;
+        }
+    }
+};
@@ -0,0 +1,449 @@
+#include "ShmTransport.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t kRingHeaderSize = 64;
+constexpr size_t kDescriptorSize = 40;
+constexpr uint32_t kRingVersion = 1;
+
+// Longest the reader waits for data before looking for expired frames
+constexpr int kExpiryCheckMs = 50;
+
+bool hasDeadline(ShmSession::Deadline deadline) {
+    return deadline.time_since_epoch().count() != 0;
+}
+
+struct Descriptor {
+    ShmMessageType type = ShmMessageType::Frame;
+    uint32_t slot = 0;
+    uint32_t sequence = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t size = 0;
+    uint64_t timestamp_us = 0;
+};
+
+void putLE(uint8_t* out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+uint64_t getLE(const uint8_t* in, int bytes) {
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+void encodeDescriptor(const Descriptor& descriptor, uint8_t* out) {
+    std::memcpy(out, "SGSD", 4);
+    putLE(out + 4, static_cast<uint32_t>(descriptor.type), 4);
+    putLE(out + 8, descriptor.slot, 4);
+    putLE(out + 12, descriptor.sequence, 4);
+    putLE(out + 16, descriptor.width, 4);
+    putLE(out + 20, descriptor.height, 4);
+    putLE(out + 24, descriptor.size, 4);
+    putLE(out + 28, 0, 4);
+    putLE(out + 32, descriptor.timestamp_us, 8);
+}
+
+bool decodeDescriptor(const uint8_t* in, size_t size, Descriptor& descriptor) {
+    if (size != kDescriptorSize || std::memcmp(in, "SGSD", 4) != 0) {
+        return false;
+    }
+    descriptor.type = static_cast<ShmMessageType>(getLE(in + 4, 4));
+    descriptor.slot = static_cast<uint32_t>(getLE(in + 8, 4));
+    descriptor.sequence = static_cast<uint32_t>(getLE(in + 12, 4));
+    descriptor.width = static_cast<uint32_t>(getLE(in + 16, 4));
+    descriptor.height = static_cast<uint32_t>(getLE(in + 20, 4));
+    descriptor.size = static_cast<uint32_t>(getLE(in + 24, 4));
+    descriptor.timestamp_us = getLE(in + 32, 8);
+    return true;
+}
+
+} // namespace
+
+ShmSession::ShmSession(size_t slot_count, size_t frame_size, size_t result_size)
+    : m_slotCount(slot_count == 0 ? 1 : slot_count),
+      m_frameSize(frame_size),
+      m_resultSize(result_size),
+      m_socket(-1),
+      m_shm(-1),
+      m_ring(nullptr),
+      m_ringSize(0),
+      m_connected(false),
+      m_nextSequence(1) {
+}
+
+ShmSession::~ShmSession() {
+    close();
+}
+
+bool ShmSession::createRing() {
+    // Unique name, unlinked right away: the segment lives as long as
+    // someone maps it or holds its descriptor
+    static std::atomic<unsigned> counter(0);
+    std::string name = "/segmentation-ring-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+
+    m_shm = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (m_shm < 0) {
+        std::cerr << "shm_open failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    shm_unlink(name.c_str());
+
+    m_ringSize = kRingHeaderSize + m_slotCount * (m_frameSize + m_resultSize);
+    if (ftruncate(m_shm, static_cast<off_t>(m_ringSize)) != 0) {
+        std::cerr << "Sizing shared memory ring failed: " << std::strerror(errno) << std::endl;
+        destroyRing();
+        return false;
+    }
+
+    void* ring = mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_shm, 0);
+    if (ring == MAP_FAILED) {
+        std::cerr << "Mapping shared memory ring failed: " << std::strerror(errno) << std::endl;
+        destroyRing();
+        return false;
+    }
+    m_ring = static_cast<uint8_t*>(ring);
+
+    std::memcpy(m_ring, "SGRG", 4);
+    putLE(m_ring + 4, kRingVersion, 4);
+    putLE(m_ring + 8, m_slotCount, 4);
+    putLE(m_ring + 12, m_frameSize, 4);
+    putLE(m_ring + 16, m_resultSize, 4);
+    return true;
+}
+
+void ShmSession::destroyRing() {
+    if (m_ring) {
+        munmap(m_ring, m_ringSize);
+        m_ring = nullptr;
+    }
+    if (m_shm >= 0) {
+        ::close(m_shm);
+        m_shm = -1;
+    }
+}
+
+uint8_t* ShmSession::frameArea(uint32_t slot) const {
+    return m_ring + kRingHeaderSize + slot * (m_frameSize + m_resultSize);
+}
+
+uint8_t* ShmSession::resultArea(uint32_t slot) const {
+    return frameArea(slot) + m_frameSize;
+}
+
+bool ShmSession::connect(const std::string& socket_path) {
+    close();
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << socket_path << std::endl;
+        return false;
+    }
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    if (!createRing()) {
+        return false;
+    }
+
+    m_socket = ::socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (m_socket < 0 || ::connect(m_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        std::cerr << "Connecting to " << socket_path << " failed: " << std::strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+
+    // Hello: hand the ring to the server along with the descriptor
+    uint8_t hello[kDescriptorSize];
+    Descriptor descriptor;
+    descriptor.type = ShmMessageType::Hello;
+    descriptor.size = static_cast<uint32_t>(m_ringSize);
+    encodeDescriptor(descriptor, hello);
+
+    iovec part{hello, sizeof(hello)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr message{};
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr* rights = CMSG_FIRSTHDR(&message);
+    rights->cmsg_level = SOL_SOCKET;
+    rights->cmsg_type = SCM_RIGHTS;
+    rights->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(rights), &m_shm, sizeof(int));
+
+    if (::sendmsg(m_socket, &message, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(hello))) {
+        std::cerr << "Sending the ring to " << socket_path << " failed: " << std::strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_freeSlots.clear();
+        for (uint32_t i = 0; i < m_slotCount; i++) {
+            m_freeSlots.push_back(i);
+        }
+        m_connected = true;
+    }
+    m_readerThread = std::thread(&ShmSession::readLoop, this);
+    return true;
+}
+
+void ShmSession::close() {
+    if (m_socket >= 0) {
+        // Wakes the reader thread out of recv()
+        ::shutdown(m_socket, SHUT_RDWR);
+    }
+    if (m_readerThread.joinable()) {
+        m_readerThread.join();
+    }
+    if (m_socket >= 0) {
+        ::close(m_socket);
+        m_socket = -1;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_connected = false;
+    }
+    failPending("Local transport closed");
+    destroyRing();
+}
+
+bool ShmSession::isConnected() const {
+    return m_connected;
+}
+
+bool ShmSession::acquireSlot(Slot& slot, Deadline deadline) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto slotFree = [this] { return !m_connected || !m_freeSlots.empty(); };
+    if (!hasDeadline(deadline)) {
+        m_slotFree.wait(lock, slotFree);
+    } else if (!m_slotFree.wait_until(lock, deadline, slotFree)) {
+        // A server that stopped answering must not block the caller
+        return false;
+    }
+    if (!m_connected) {
+        return false;
+    }
+
+    slot.index = m_freeSlots.front();
+    slot.frame = frameArea(slot.index);
+    slot.capacity = m_frameSize;
+    m_freeSlots.pop_front();
+    return true;
+}
+
+void ShmSession::releaseSlot(const Slot& slot) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_freeSlots.push_back(slot.index);
+    }
+    m_slotFree.notify_one();
+}
+
+uint32_t ShmSession::submit(const Slot& slot, uint32_t width, uint32_t height, uint64_t timestamp_us,
+                            Callback callback, Deadline deadline) {
+    if (static_cast<size_t>(width) * height > slot.capacity) {
+        std::cerr << "Frame " << width << "x" << height << " does not fit a ring slot" << std::endl;
+        releaseSlot(slot);
+        return 0;
+    }
+
+    Descriptor descriptor;
+    descriptor.type = ShmMessageType::Frame;
+    descriptor.slot = slot.index;
+    descriptor.width = width;
+    descriptor.height = height;
+    descriptor.size = width * height;
+    descriptor.timestamp_us = timestamp_us;
+    {
+        // Register before sending so a fast answer always finds its frame
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_connected) {
+            m_freeSlots.push_back(slot.index);
+            return 0;
+        }
+        descriptor.sequence = m_nextSequence++;
+        if (descriptor.sequence == 0) {
+            descriptor.sequence = m_nextSequence++;
+        }
+        m_pending[descriptor.sequence] = {slot.index, std::move(callback), deadline};
+    }
+
+    uint8_t packet[kDescriptorSize];
+    encodeDescriptor(descriptor, packet);
+    if (::send(m_socket, packet, sizeof(packet), MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(packet))) {
+        std::cerr << "Local transport send failed: " << std::strerror(errno) << std::endl;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending.erase(descriptor.sequence);
+            m_freeSlots.push_back(slot.index);
+        }
+        m_slotFree.notify_one();
+        return 0;
+    }
+    return descriptor.sequence;
+}
+
+void ShmSession::readLoop() {
+    std::string reason = "Local transport closed by server";
+    uint8_t packet[kDescriptorSize + 1];
+
+    while (true) {
+        int waitMs = expirePending();
+        if (allSlotsExpired()) {
+            reason = "Local transport stalled: every slot is held by an expired frame";
+            std::cerr << reason << std::endl;
+            break;
+        }
+
+        pollfd readable{m_socket, POLLIN, 0};
+        int ready = ::poll(&readable, 1, waitMs);
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+
+        ssize_t received = ::recv(m_socket, packet, sizeof(packet), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            break;
+        }
+
+        Descriptor descriptor;
+        if (!decodeDescriptor(packet, static_cast<size_t>(received), descriptor)) {
+            reason = "Local transport protocol error";
+            std::cerr << reason << std::endl;
+            break;
+        }
+        if (descriptor.type != ShmMessageType::Result && descriptor.type != ShmMessageType::Error) {
+            continue;
+        }
+
+        Pending pending;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_pending.find(descriptor.sequence);
+            if (it == m_pending.end() || it->second.slot != descriptor.slot) {
+                continue;
+            }
+            pending = std::move(it->second);
+            m_pending.erase(it);
+        }
+
+        ShmResult result;
+        result.sequence = descriptor.sequence;
+        result.timestamp_us = descriptor.timestamp_us;
+        size_t size = std::min<size_t>(descriptor.size, m_resultSize);
+        const uint8_t* data = resultArea(pending.slot);
+        if (descriptor.type == ShmMessageType::Result) {
+            result.data = data;
+            result.size = size;
+        } else {
+            result.error.assign(reinterpret_cast<const char*>(data), size);
+        }
+
+        if (pending.callback) {
+            pending.callback(result);
+        }
+
+        // Only now may the slot be overwritten
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_freeSlots.push_back(pending.slot);
+        }
+        m_slotFree.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_connected = false;
+    }
+    failPending(reason);
+}
+
+int ShmSession::expirePending() {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::pair<uint32_t, Callback>> expired;
+    int waitMs = kExpiryCheckMs;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& entry : m_pending) {
+            Pending& pending = entry.second;
+            if (!pending.callback || !hasDeadline(pending.deadline)) {
+                continue;
+            }
+            if (pending.deadline <= now) {
+                // The slot stays with the server until it answers
+                expired.emplace_back(entry.first, std::move(pending.callback));
+                pending.callback = nullptr;
+                continue;
+            }
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(pending.deadline - now).count();
+            waitMs = std::min<int>(waitMs, static_cast<int>(remaining) + 1);
+        }
+    }
+
+    for (auto& entry : expired) {
+        ShmResult result;
+        result.sequence = entry.first;
+        result.error = "Deadline exceeded";
+        result.expired = true;
+        entry.second(result);
+    }
+    return waitMs;
+}
+
+bool ShmSession::allSlotsExpired() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_pending.size() < m_slotCount) {
+        return false;
+    }
+    for (const auto& entry : m_pending) {
+        if (entry.second.callback) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ShmSession::failPending(const std::string& reason) {
+    std::map<uint32_t, Pending> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        pending.swap(m_pending);
+    }
+    m_slotFree.notify_all();
+
+    for (auto& entry : pending) {
+        ShmResult result;
+        result.sequence = entry.first;
+        result.error = reason;
+        if (entry.second.callback) {
+            entry.second.callback(result);
+        }
+    }
+}
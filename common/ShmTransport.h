@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Local transport for a segmentation server on the same machine.
+//
+// Frames are written as raw 8-bit pixels straight into a POSIX shared
+// memory ring; only 40-byte descriptors travel over a Unix domain socket
+// (SOCK_SEQPACKET). The server writes its masks, in the binary format of
+// MaskCodec.h, into the same slot and answers with a descriptor, possibly
+// out of order. Nothing is encoded, copied through the kernel or parsed as
+// text on the way.
+//
+// Shared memory layout:
+//
+//   offset  size  field
+//        0     4  magic "SGRG"
+//        4     4  version (1)
+//        8     4  slot count
+//       12     4  frame area size per slot
+//       16     4  result area size per slot
+//       20    44  reserved
+//       64        slots: frame area followed by result area
+//
+// Descriptors (all little-endian):
+//
+//   offset  size  field
+//        0     4  magic "SGSD"
+//        4     4  type (ShmMessageType)
+//        8     4  slot index
+//       12     4  sequence ID
+//       16     4  frame width
+//       20     4  frame height
+//       24     4  Result: mask bytes in the result area; Error: message bytes
+//       28     4  reserved (0)
+//       32     8  capture timestamp in microseconds
+//
+// The Hello descriptor is sent once after connecting and carries the shared
+// memory file descriptor (SCM_RIGHTS). The segment is unlinked as soon as
+// it is created, so it disappears with the last process that maps it.
+
+enum class ShmMessageType : uint32_t {
+    Hello = 1,
+    Frame = 2,
+    Result = 3,
+    Error = 4
+};
+
+// A frame's answer. data points into shared memory and is only valid
+// during the callback.
+struct ShmResult {
+    uint32_t sequence = 0;
+    uint64_t timestamp_us = 0;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    std::string error;
+    bool expired = false;   // failed at the frame's deadline, not by the server
+};
+
+class ShmSession {
+public:
+    // Invoked on the reader thread. When the connection drops, every
+    // unanswered frame gets a result with an error.
+    using Callback = std::function<void(const ShmResult& result)>;
+    using Deadline = std::chrono::steady_clock::time_point;
+
+    // A slot reserved for the caller to write one frame into
+    struct Slot {
+        uint32_t index = 0;
+        uint8_t* frame = nullptr;
+        size_t capacity = 0;
+    };
+
+    explicit ShmSession(size_t slot_count = 4, size_t frame_size = 4 << 20, size_t result_size = 1 << 20);
+    ~ShmSession();
+
+    ShmSession(const ShmSession&) = delete;
+    ShmSession& operator=(const ShmSession&) = delete;
+
+    // Create the ring, connect to the server's socket and hand it the ring
+    bool connect(const std::string& socket_path);
+
+    // Close the connection; unanswered frames fail
+    void close();
+
+    bool isConnected() const;
+
+    // Reserve a free slot, blocking while all slots are in flight. Returns
+    // false if the session is not connected or no slot came free before the
+    // deadline.
+    bool acquireSlot(Slot& slot, Deadline deadline = Deadline());
+
+    // Give a slot back without sending it
+    void releaseSlot(const Slot& slot);
+
+    // Send the width x height frame written into the slot (rows packed
+    // without padding). The slot is busy until the answer has been handed to
+    // the callback. Returns the sequence ID, or 0 if sending failed (the
+    // callback is not invoked in that case). A frame still unanswered at its
+    // deadline gets a result with expired set; its slot stays busy until the
+    // server answers, since the server may still write into it. Once every
+    // slot is held by an expired frame the server is taken to have stalled
+    // and the session disconnects, so the caller can reconnect.
+    uint32_t submit(const Slot& slot, uint32_t width, uint32_t height, uint64_t timestamp_us,
+                    Callback callback, Deadline deadline = Deadline());
+
+private:
+    struct Pending {
+        uint32_t slot;
+        Callback callback;   // gone once expired
+        Deadline deadline;
+    };
+
+    const size_t m_slotCount;
+    const size_t m_frameSize;
+    const size_t m_resultSize;
+
+    int m_socket;
+    int m_shm;
+    uint8_t* m_ring;
+    size_t m_ringSize;
+
+    std::atomic<bool> m_connected;
+    std::thread m_readerThread;
+    uint32_t m_nextSequence;
+
+    // Free slots and unanswered frames by sequence ID
+    std::deque<uint32_t> m_freeSlots;
+    std::map<uint32_t, Pending> m_pending;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_slotFree;
+
+    bool createRing();
+    void destroyRing();
+    uint8_t* frameArea(uint32_t slot) const;
+    uint8_t* resultArea(uint32_t slot) const;
+
+    void readLoop();
+    void failPending(const std::string& reason);
+
+    // Fails frames past their deadline; returns how long the reader may
+    // wait for data before the next one is due, in milliseconds
+    int expirePending();
+
+    // True if no slot can come free short of the server answering frames
+    // nobody waits for anymore
+    bool allSlotsExpired() const;
+};
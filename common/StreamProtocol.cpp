@@ -0,0 +1,80 @@
+#include "StreamProtocol.h"
+#include <cstring>
+
+namespace {
+
+void putLE(uint8_t* out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+uint64_t getLE(const uint8_t* in, int bytes) {
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+} // namespace
+
+void encodeStreamHeader(StreamMessageType type, uint32_t sequence, uint64_t timestamp_us,
+                        uint32_t payload_size, uint8_t* out) {
+    std::memcpy(out, "SGST", 4);
+    out[4] = static_cast<uint8_t>(type);
+    out[5] = 0;
+    putLE(out + 6, 0, 2);
+    putLE(out + 8, sequence, 4);
+    putLE(out + 12, timestamp_us, 8);
+    putLE(out + 20, payload_size, 4);
+}
+
+bool StreamDecoder::feed(const uint8_t* data, size_t size, std::vector<StreamMessage>& out) {
+    if (!m_error.empty()) {
+        return false;
+    }
+
+    m_buffer.insert(m_buffer.end(), data, data + size);
+
+    size_t offset = 0;
+    while (m_buffer.size() - offset >= kStreamHeaderSize) {
+        const uint8_t* header = m_buffer.data() + offset;
+        if (std::memcmp(header, "SGST", 4) != 0) {
+            m_error = "bad stream magic";
+            return false;
+        }
+
+        uint8_t type = header[4];
+        if (type < static_cast<uint8_t>(StreamMessageType::Frame) ||
+            type > static_cast<uint8_t>(StreamMessageType::Error)) {
+            m_error = "unknown stream message type " + std::to_string(type);
+            return false;
+        }
+
+        uint32_t payloadSize = static_cast<uint32_t>(getLE(header + 20, 4));
+        if (payloadSize > kMaxStreamPayload) {
+            m_error = "stream payload too large";
+            return false;
+        }
+
+        // Wait for the rest of the payload
+        if (m_buffer.size() - offset - kStreamHeaderSize < payloadSize) {
+            break;
+        }
+
+        StreamMessage message;
+        message.type = static_cast<StreamMessageType>(type);
+        message.sequence = static_cast<uint32_t>(getLE(header + 8, 4));
+        message.timestamp_us = getLE(header + 12, 8);
+        const uint8_t* payload = header + kStreamHeaderSize;
+        message.payload.assign(payload, payload + payloadSize);
+        out.push_back(std::move(message));
+
+        offset += kStreamHeaderSize + payloadSize;
+    }
+
+    // Drop consumed bytes, keep the partial message
+    m_buffer.erase(m_buffer.begin(), m_buffer.begin() + offset);
+    return true;
+}
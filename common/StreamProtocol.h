@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Length-prefixed framing for the persistent streaming session.
+//
+// Every message is a fixed 24-byte header followed by the payload. All
+// integers are little-endian.
+//
+//   offset  size  field
+//        0     4  magic "SGST"
+//        4     1  message type (StreamMessageType)
+//        5     1  flags (0)
+//        6     2  reserved (0)
+//        8     4  sequence ID, chosen by the client per frame
+//       12     8  capture timestamp in microseconds
+//       20     4  payload size
+//
+// Frame messages (client -> server) carry an encoded image (PNG/JPEG).
+// Result messages (server -> client) carry masks in the binary format of
+// MaskCodec.h and echo the frame's sequence ID and timestamp; they may
+// arrive in any order. Error messages carry a UTF-8 description.
+
+constexpr size_t kStreamHeaderSize = 24;
+
+// Upper bound for a single payload; anything larger is a protocol error
+constexpr uint32_t kMaxStreamPayload = 64u << 20;
+
+enum class StreamMessageType : uint8_t {
+    Frame = 1,
+    Result = 2,
+    Error = 3
+};
+
+struct StreamMessage {
+    StreamMessageType type = StreamMessageType::Error;
+    uint32_t sequence = 0;
+    uint64_t timestamp_us = 0;
+    std::vector<uint8_t> payload;
+
+    // Not on the wire: an Error the client raised because the frame's
+    // deadline passed before its answer came
+    bool expired = false;
+};
+
+// Serialize a message header into out[0..kStreamHeaderSize)
+void encodeStreamHeader(StreamMessageType type, uint32_t sequence, uint64_t timestamp_us,
+                        uint32_t payload_size, uint8_t* out);
+
+// Incremental decoder: feed it bytes as they arrive from the socket
+class StreamDecoder {
+public:
+    // Append received bytes; every completed message is appended to out.
+    // Returns false on a protocol error, after which the stream is unusable.
+    bool feed(const uint8_t* data, size_t size, std::vector<StreamMessage>& out);
+
+    const std::string& error() const { return m_error; }
+
+private:
+    std::vector<uint8_t> m_buffer;
+    std::string m_error;
+};
@@ -0,0 +1,311 @@
+#include "StreamingSession.h"
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+// Longest the reader waits for data before looking for expired frames,
+// which bounds how late a frame registered meanwhile is failed
+const int kExpiryCheckMs = 50;
+
+bool hasDeadline(StreamingSession::Deadline deadline) {
+    return deadline.time_since_epoch().count() != 0;
+}
+
+} // namespace
+
+StreamingSession::StreamingSession(size_t max_in_flight)
+    : m_maxInFlight(max_in_flight == 0 ? 1 : max_in_flight),
+      m_socket(-1),
+      m_connected(false),
+      m_nextSequence(1) {
+}
+
+StreamingSession::~StreamingSession() {
+    close();
+}
+
+bool StreamingSession::connect(const std::string& host, int port) {
+    close();
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    int rc = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses);
+    if (rc != 0) {
+        std::cerr << "Stream resolve failed for " << host << ": " << gai_strerror(rc) << std::endl;
+        return false;
+    }
+
+    int fd = -1;
+    for (addrinfo* a = addresses; a != nullptr; a = a->ai_next) {
+        fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (::connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+            break;
+        }
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+
+    if (fd < 0) {
+        std::cerr << "Stream connect to " << host << ":" << port << " failed" << std::endl;
+        return false;
+    }
+
+    // Frames are written as soon as they are encoded; don't let Nagle hold them
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+
+    m_socket = fd;
+    m_connected = true;
+    m_readerThread = std::thread(&StreamingSession::readLoop, this);
+    return true;
+}
+
+void StreamingSession::close() {
+    if (m_socket >= 0) {
+        // Wakes the reader thread out of recv()
+        ::shutdown(m_socket, SHUT_RDWR);
+    }
+    if (m_readerThread.joinable()) {
+        m_readerThread.join();
+    }
+    if (m_socket >= 0) {
+        ::close(m_socket);
+        m_socket = -1;
+    }
+    m_connected = false;
+    failPending("Stream closed");
+}
+
+bool StreamingSession::isConnected() const {
+    return m_connected;
+}
+
+size_t StreamingSession::inFlight() const {
+    std::lock_guard<std::mutex> lock(m_pendingMutex);
+    return m_pending.size();
+}
+
+uint32_t StreamingSession::sendFrame(const uint8_t* payload, size_t size, uint64_t timestamp_us, Callback callback,
+                                     Deadline deadline) {
+    if (size > kMaxStreamPayload) {
+        std::cerr << "Stream frame too large: " << size << " bytes" << std::endl;
+        return 0;
+    }
+
+    uint32_t sequence;
+    {
+        std::unique_lock<std::mutex> lock(m_pendingMutex);
+        auto windowOpen = [this] { return !m_connected || m_pending.size() < m_maxInFlight; };
+        if (!hasDeadline(deadline)) {
+            m_windowOpen.wait(lock, windowOpen);
+        } else if (!m_windowOpen.wait_until(lock, deadline, windowOpen)) {
+            // A server that stopped answering must not block the caller
+            return 0;
+        }
+        if (!m_connected) {
+            return 0;
+        }
+
+        sequence = m_nextSequence++;
+        if (sequence == 0) {
+            // 0 is reserved for "not sent"
+            sequence = m_nextSequence++;
+        }
+        // Register before sending so a fast answer always finds its frame
+        m_pending.emplace(sequence, Pending{std::move(callback), deadline});
+    }
+
+    uint8_t header[kStreamHeaderSize];
+    encodeStreamHeader(StreamMessageType::Frame, sequence, timestamp_us, static_cast<uint32_t>(size), header);
+
+    bool sent;
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        sent = sendAll(header, payload, size);
+    }
+
+    if (!sent) {
+        std::cerr << "Stream send failed" << std::endl;
+        // The reader thread notices the broken connection and fails the frame
+        ::shutdown(m_socket, SHUT_RDWR);
+    }
+    return sequence;
+}
+
+bool StreamingSession::sendAll(const uint8_t* header, const uint8_t* payload, size_t size) {
+    iovec parts[2];
+    parts[0].iov_base = const_cast<uint8_t*>(header);
+    parts[0].iov_len = kStreamHeaderSize;
+    parts[1].iov_base = const_cast<uint8_t*>(payload);
+    parts[1].iov_len = size;
+
+    iovec* next = parts;
+    int remaining = size > 0 ? 2 : 1;
+    while (remaining > 0) {
+        msghdr message{};
+        message.msg_iov = next;
+        message.msg_iovlen = remaining;
+        ssize_t written = ::sendmsg(m_socket, &message, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        // Advance past what was written
+        size_t done = static_cast<size_t>(written);
+        while (remaining > 0 && done >= next->iov_len) {
+            done -= next->iov_len;
+            next++;
+            remaining--;
+        }
+        if (remaining > 0) {
+            next->iov_base = static_cast<uint8_t*>(next->iov_base) + done;
+            next->iov_len -= done;
+        }
+    }
+    return true;
+}
+
+void StreamingSession::readLoop() {
+    StreamDecoder decoder;
+    std::vector<StreamMessage> messages;
+    std::vector<uint8_t> buffer(64 * 1024);
+    std::string reason = "Stream closed by server";
+
+    while (true) {
+        pollfd readable{m_socket, POLLIN, 0};
+        int ready = ::poll(&readable, 1, expirePending());
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+
+        ssize_t received = ::recv(m_socket, buffer.data(), buffer.size(), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            break;
+        }
+
+        messages.clear();
+        if (!decoder.feed(buffer.data(), static_cast<size_t>(received), messages)) {
+            reason = "Stream protocol error: " + decoder.error();
+            std::cerr << reason << std::endl;
+            break;
+        }
+
+        for (StreamMessage& message : messages) {
+            if (message.type == StreamMessageType::Frame) {
+                continue;
+            }
+
+            Callback callback;
+            {
+                std::lock_guard<std::mutex> lock(m_pendingMutex);
+                auto it = m_pending.find(message.sequence);
+                if (it == m_pending.end()) {
+                    // Late answer for a frame that was already failed
+                    continue;
+                }
+                callback = std::move(it->second.callback);
+                m_pending.erase(it);
+            }
+            m_windowOpen.notify_one();
+
+            if (callback) {
+                callback(std::move(message));
+            }
+        }
+    }
+
+    {
+        // Under the lock so sendFrame can't register a frame after failPending
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        m_connected = false;
+    }
+    failPending(reason);
+}
+
+int StreamingSession::expirePending() {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::pair<uint32_t, Callback>> expired;
+    int waitMs = kExpiryCheckMs;
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        for (auto it = m_pending.begin(); it != m_pending.end();) {
+            Pending& pending = it->second;
+            if (!hasDeadline(pending.deadline)) {
+                ++it;
+                continue;
+            }
+            if (pending.deadline <= now) {
+                // Frees its window place; a late answer finds no entry
+                expired.emplace_back(it->first, std::move(pending.callback));
+                it = m_pending.erase(it);
+                continue;
+            }
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(pending.deadline - now).count();
+            waitMs = std::min<int>(waitMs, static_cast<int>(remaining) + 1);
+            ++it;
+        }
+    }
+    if (!expired.empty()) {
+        m_windowOpen.notify_all();
+    }
+
+    for (auto& entry : expired) {
+        if (!entry.second) {
+            continue;
+        }
+        StreamMessage error;
+        error.type = StreamMessageType::Error;
+        error.sequence = entry.first;
+        error.expired = true;
+        static const std::string reason = "Deadline exceeded";
+        error.payload.assign(reason.begin(), reason.end());
+        entry.second(std::move(error));
+    }
+    return waitMs;
+}
+
+void StreamingSession::failPending(const std::string& reason) {
+    std::map<uint32_t, Pending> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        pending.swap(m_pending);
+    }
+    m_windowOpen.notify_all();
+
+    for (auto& entry : pending) {
+        StreamMessage error;
+        error.type = StreamMessageType::Error;
+        error.sequence = entry.first;
+        error.payload.assign(reason.begin(), reason.end());
+        if (entry.second.callback) {
+            entry.second.callback(std::move(error));
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "StreamProtocol.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Client side of the persistent streaming protocol (see StreamProtocol.h).
+// Frames are pushed over one long-lived TCP connection without waiting for
+// earlier answers; a reader thread matches each Result/Error message to
+// its frame by sequence ID, whatever order the server answers in.
+class StreamingSession {
+public:
+    // Invoked on the reader thread with the Result or Error for a frame.
+    // When the connection drops, every unanswered frame gets an Error.
+    using Callback = std::function<void(StreamMessage&&)>;
+    using Deadline = std::chrono::steady_clock::time_point;
+
+    // At most max_in_flight frames may be unanswered; sendFrame blocks
+    // beyond that
+    explicit StreamingSession(size_t max_in_flight = 8);
+    ~StreamingSession();
+
+    StreamingSession(const StreamingSession&) = delete;
+    StreamingSession& operator=(const StreamingSession&) = delete;
+
+    // Connect and start the reader thread
+    bool connect(const std::string& host, int port);
+
+    // Close the connection; unanswered frames fail with an Error
+    void close();
+
+    bool isConnected() const;
+
+    // Push one frame. Returns its sequence ID, or 0 if the session is not
+    // connected or the window stayed full until the deadline (the callback
+    // is not invoked in that case). A frame still unanswered at its
+    // deadline gets an Error with expired set and leaves the window, so
+    // answers the server never sends can't close it; a late answer is
+    // dropped.
+    uint32_t sendFrame(const uint8_t* payload, size_t size, uint64_t timestamp_us, Callback callback,
+                       Deadline deadline = Deadline());
+
+    size_t inFlight() const;
+
+private:
+    const size_t m_maxInFlight;
+
+    int m_socket;
+    std::atomic<bool> m_connected;
+    std::thread m_readerThread;
+
+    std::atomic<uint32_t> m_nextSequence;
+    std::mutex m_sendMutex;
+
+    // Unanswered frames by sequence ID
+    struct Pending {
+        Callback callback;
+        Deadline deadline;
+    };
+    std::map<uint32_t, Pending> m_pending;
+    mutable std::mutex m_pendingMutex;
+    std::condition_variable m_windowOpen;
+
+    void readLoop();
+    void failPending(const std::string& reason);
+
+    // Fails frames past their deadline; returns how long the reader may
+    // wait for data before the next one is due, in milliseconds
+    int expirePending();
+    bool sendAll(const uint8_t* header, const uint8_t* payload, size_t size);
+};
@@ -0,0 +1,249 @@
+#include "TileDelta.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace tile_delta {
+
+namespace {
+
+constexpr size_t kHeaderSize = 44;
+constexpr uint8_t kVersion = 1;
+
+// Sent frames kept for their acknowledgement
+constexpr size_t kMaxPending = 16;
+
+void writeU16(uint8_t* p, uint16_t value) {
+    p[0] = static_cast<uint8_t>(value);
+    p[1] = static_cast<uint8_t>(value >> 8);
+}
+
+void writeU32(uint8_t* p, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+void writeU64(uint8_t* p, uint64_t value) {
+    writeU32(p, static_cast<uint32_t>(value));
+    writeU32(p + 4, static_cast<uint32_t>(value >> 32));
+}
+
+size_t tileCount(int width, int height, int tile_size) {
+    size_t tilesX = (width + tile_size - 1) / tile_size;
+    size_t tilesY = (height + tile_size - 1) / tile_size;
+    return tilesX * tilesY;
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------------
+// TileDeltaEncoder
+// ---------------------------------------------------------------------------
+
+TileDeltaEncoder::TileDeltaEncoder(int tile_size, size_t keyframe_interval, int change_threshold)
+    : m_tileSize(std::min(std::max(tile_size, 8), 1024)),
+      m_keyframeInterval(std::max<size_t>(keyframe_interval, 1)),
+      m_changeThreshold(std::max(change_threshold, 0)),
+      m_sessionId(std::mt19937_64(std::random_device()())()),
+      m_nextId(1),
+      m_sinceKeyframe(0),
+      m_forceKeyframe(false),
+      m_referenceId(0),
+      m_haveReference(false) {
+}
+
+uint32_t TileDeltaEncoder::encode(const uint8_t* pixels, int width, int height, size_t stride,
+                                  std::vector<uint8_t>& out) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint32_t frameId = m_nextId++;
+    size_t frameSize = static_cast<size_t>(width) * height;
+    m_stats.frameBytes += frameSize;
+
+    bool keyframe = m_forceKeyframe || !m_haveReference || m_reference.width != width ||
+                    m_reference.height != height || m_sinceKeyframe + 1 >= m_keyframeInterval;
+
+    Frame rebuilt;
+    rebuilt.pixels = takeBuffer(frameSize);
+    rebuilt.width = width;
+    rebuilt.height = height;
+
+    std::vector<uint8_t> tileMap;
+    if (keyframe) {
+        for (int y = 0; y < height; y++) {
+            std::memcpy(rebuilt.pixels.data() + static_cast<size_t>(y) * width, pixels + y * stride, width);
+        }
+        m_forceKeyframe = false;
+        m_sinceKeyframe = 0;
+        m_stats.keyframes++;
+    } else {
+        // Start from the reference and replace the tiles that changed
+        std::memcpy(rebuilt.pixels.data(), m_reference.pixels.data(), frameSize);
+        tileMap.assign((tileCount(width, height, m_tileSize) + 7) / 8, 0);
+        m_payload.clear();
+
+        size_t tile = 0;
+        for (int ty = 0; ty < height; ty += m_tileSize) {
+            int th = std::min(m_tileSize, height - ty);
+            for (int tx = 0; tx < width; tx += m_tileSize, tile++) {
+                int tw = std::min(m_tileSize, width - tx);
+                if (!tileChanged(pixels, stride, tx, ty, tw, th)) {
+                    continue;
+                }
+
+                tileMap[tile / 8] |= static_cast<uint8_t>(1 << (tile % 8));
+                for (int y = ty; y < ty + th; y++) {
+                    const uint8_t* row = pixels + y * stride + tx;
+                    m_payload.insert(m_payload.end(), row, row + tw);
+                    std::memcpy(rebuilt.pixels.data() + static_cast<size_t>(y) * width + tx, row, tw);
+                }
+                m_stats.tilesSent++;
+            }
+        }
+        m_stats.tilesTotal += tile;
+        m_sinceKeyframe++;
+        m_stats.deltas++;
+    }
+
+    const std::vector<uint8_t>& payload = keyframe ? rebuilt.pixels : m_payload;
+    uint32_t baseId = keyframe ? 0 : m_referenceId;
+
+    // Header and tile map, then the payload, compressed where it helps
+    out.assign(kHeaderSize, 0);
+    std::memcpy(out.data(), "TDLT", 4);
+    out[4] = kVersion;
+    out[5] = static_cast<uint8_t>(keyframe ? FrameKind::Keyframe : FrameKind::Delta);
+    writeU16(out.data() + 8, static_cast<uint16_t>(m_tileSize));
+    writeU32(out.data() + 12, static_cast<uint32_t>(width));
+    writeU32(out.data() + 16, static_cast<uint32_t>(height));
+    writeU64(out.data() + 20, m_sessionId);
+    writeU32(out.data() + 28, frameId);
+    writeU32(out.data() + 32, baseId);
+    writeU32(out.data() + 40, static_cast<uint32_t>(payload.size()));
+    out.insert(out.end(), tileMap.begin(), tileMap.end());
+
+    size_t payloadStart = out.size();
+    Compression compression = Compression::None;
+#ifdef HAVE_ZLIB
+    if (!payload.empty()) {
+        // Level 1: most of the gain for a fraction of the time
+        uLongf compressedSize = compressBound(payload.size());
+        out.resize(payloadStart + compressedSize);
+        if (compress2(out.data() + payloadStart, &compressedSize, payload.data(), payload.size(), 1) == Z_OK &&
+            compressedSize < payload.size()) {
+            out.resize(payloadStart + compressedSize);
+            compression = Compression::Zlib;
+        } else {
+            out.resize(payloadStart);
+        }
+    }
+#endif
+    if (compression == Compression::None) {
+        out.insert(out.end(), payload.begin(), payload.end());
+    }
+    out[6] = static_cast<uint8_t>(compression);
+    writeU32(out.data() + 36, static_cast<uint32_t>(out.size() - payloadStart));
+    m_stats.sentBytes += out.size();
+
+    // Kept until the server answers; the oldest unanswered one goes first
+    m_pending[frameId] = std::move(rebuilt);
+    if (m_pending.size() > kMaxPending) {
+        recycle(m_pending.begin()->second);
+        m_pending.erase(m_pending.begin());
+    }
+    return frameId;
+}
+
+void TileDeltaEncoder::acknowledge(uint32_t frame_id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_pending.find(frame_id);
+    if (it == m_pending.end()) {
+        return;
+    }
+
+    if (!m_haveReference || frame_id > m_referenceId) {
+        recycle(m_reference);
+        m_reference = std::move(it->second);
+        m_referenceId = frame_id;
+        m_haveReference = true;
+    }
+
+    // Older frames can no longer become the reference
+    for (auto older = m_pending.begin(); older != m_pending.end() && older->first <= frame_id;) {
+        recycle(older->second);
+        older = m_pending.erase(older);
+    }
+}
+
+void TileDeltaEncoder::reject(uint32_t frame_id, bool resynchronize) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_pending.find(frame_id);
+    if (it != m_pending.end()) {
+        recycle(it->second);
+        m_pending.erase(it);
+    }
+    if (resynchronize) {
+        m_forceKeyframe = true;
+    }
+}
+
+TileDeltaEncoder::Stats TileDeltaEncoder::stats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+std::string TileDeltaEncoder::summary() const {
+    Stats current = stats();
+    std::ostringstream out;
+    out << "Delta uploads: " << current.keyframes << " keyframes, " << current.deltas << " deltas";
+    if (current.tilesTotal > 0) {
+        out << " (" << 100 * current.tilesSent / current.tilesTotal << "% of tiles sent)";
+    }
+    if (current.sentBytes > 0) {
+        out << ", " << current.frameBytes / 1024 << " KB of frames in " << current.sentBytes / 1024
+            << " KB (" << static_cast<double>(current.frameBytes) / current.sentBytes << "x)";
+    }
+    return out.str();
+}
+
+bool TileDeltaEncoder::tileChanged(const uint8_t* pixels, size_t stride, int x, int y, int w, int h) const {
+    // Camera noise moves a few pixels a little; count the ones that moved a lot
+    size_t limit = static_cast<size_t>(w) * h / 64;
+    size_t changed = 0;
+    for (int row = y; row < y + h; row++) {
+        const uint8_t* current = pixels + row * stride + x;
+        const uint8_t* reference = m_reference.pixels.data() + static_cast<size_t>(row) * m_reference.width + x;
+        for (int i = 0; i < w; i++) {
+            changed += std::abs(current[i] - reference[i]) > m_changeThreshold;
+        }
+        if (changed > limit) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<uint8_t> TileDeltaEncoder::takeBuffer(size_t size) {
+    std::vector<uint8_t> buffer;
+    if (!m_spare.empty()) {
+        buffer = std::move(m_spare.back());
+        m_spare.pop_back();
+    }
+    buffer.resize(size);
+    return buffer;
+}
+
+void TileDeltaEncoder::recycle(Frame& frame) {
+    if (frame.pixels.capacity() > 0 && m_spare.size() < kMaxPending) {
+        m_spare.push_back(std::move(frame.pixels));
+    }
+    frame.pixels = std::vector<uint8_t>();
+}
+
+} // namespace tile_delta
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Tile-delta frame uploads ("application/x-tile-delta").
+//
+// Fixed cameras see mostly the same picture from frame to frame. Instead of
+// the whole frame, an upload can carry only the tiles that changed since a
+// reference frame the server already has, plus a map of which tiles those
+// are. Keyframes carry the whole frame and are sent periodically, and
+// whenever the server has lost the reference, to resynchronize.
+//
+// All integers are little-endian.
+//
+//   offset  size  field
+//        0     4  magic "TDLT"
+//        4     1  version (1)
+//        5     1  kind: 0 = keyframe, 1 = delta
+//        6     1  compression: 0 = none, 1 = zlib
+//        7     1  reserved (0)
+//        8     2  tile size (square tiles, edge tiles are cut short)
+//       10     2  reserved (0)
+//       12     4  width
+//       16     4  height
+//       20     8  session ID (random per client, keys the server's frames)
+//       28     4  frame ID
+//       32     4  base frame ID (deltas: the reference frame)
+//       36     4  payload size (as sent)
+//       40     4  raw payload size (after decompression)
+//       44        deltas: tile map, one bit per tile in row-major tile
+//                 order (least significant bit first), set = tile sent
+//                 then the payload: 8-bit pixels of the frame (keyframes)
+//                 or of the sent tiles in tile order, row by row
+//
+// The server rebuilds every frame (reference plus sent tiles), remembers
+// the last few per session by frame ID, and answers a delta whose base
+// frame it doesn't have with 409 Conflict.
+//
+// Unsent tiles are only "unchanged" up to the change threshold, so both
+// sides use the rebuilt frame, not the camera frame, as the next reference.
+namespace tile_delta {
+
+constexpr const char* kContentType = "application/x-tile-delta";
+
+// Status code of a delta whose base frame the server doesn't have
+constexpr long kMissingBaseStatus = 409;
+
+enum class FrameKind : uint8_t {
+    Keyframe = 0,
+    Delta = 1
+};
+
+enum class Compression : uint8_t {
+    None = 0,
+    Zlib = 1
+};
+
+// Client side: encodes frames against the newest frame the server has
+// acknowledged. Thread-safe.
+class TileDeltaEncoder {
+public:
+    struct Stats {
+        size_t keyframes = 0;
+        size_t deltas = 0;
+        size_t tilesSent = 0;
+        size_t tilesTotal = 0;   // tiles of all delta frames
+        size_t frameBytes = 0;   // raw size of all frames
+        size_t sentBytes = 0;    // encoded size of all uploads
+    };
+
+    // tile_size: tile edge in pixels. A tile counts as changed when more
+    // than 1/64 of its pixels differ from the reference by more than
+    // change_threshold. Every keyframe_interval-th frame is a keyframe.
+    explicit TileDeltaEncoder(int tile_size = 32, size_t keyframe_interval = 100, int change_threshold = 12);
+
+    // Encode an 8-bit frame (rows stride bytes apart) into out. Returns
+    // the frame's ID for acknowledge() / reject().
+    uint32_t encode(const uint8_t* pixels, int width, int height, size_t stride, std::vector<uint8_t>& out);
+
+    // The server answered the frame: it becomes the reference if it is the
+    // newest acknowledged one
+    void acknowledge(uint32_t frame_id);
+
+    // The upload failed. resynchronize: the server lost the reference (409),
+    // so the next frame is a keyframe.
+    void reject(uint32_t frame_id, bool resynchronize);
+
+    Stats stats() const;
+    std::string summary() const;
+
+private:
+    struct Frame {
+        std::vector<uint8_t> pixels;   // width * height, dense
+        int width = 0;
+        int height = 0;
+    };
+
+    int m_tileSize;
+    size_t m_keyframeInterval;
+    int m_changeThreshold;
+    uint64_t m_sessionId;
+
+    mutable std::mutex m_mutex;
+    uint32_t m_nextId;
+    size_t m_sinceKeyframe;
+    bool m_forceKeyframe;
+
+    // Newest acknowledged frame, as the server rebuilt it
+    Frame m_reference;
+    uint32_t m_referenceId;
+    bool m_haveReference;
+
+    // Rebuilt frames sent but not answered yet, and spare buffers
+    std::map<uint32_t, Frame> m_pending;
+    std::vector<std::vector<uint8_t>> m_spare;
+
+    std::vector<uint8_t> m_payload;
+    Stats m_stats;
+
+    bool tileChanged(const uint8_t* pixels, size_t stride, int x, int y, int w, int h) const;
+    std::vector<uint8_t> takeBuffer(size_t size);
+    void recycle(Frame& frame);
+};
+
+} // namespace tile_delta
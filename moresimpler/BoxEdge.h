@@ -0,0 +1,13 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+// A box edge or scanline crossing from a server response, in image pixels,
+// as an int in [0, limit]. Clamped before the conversion, so values far
+// outside the image can't overflow it; the caller rejects NaN and
+// infinities first. Round (std::floor / std::ceil) the value beforehand to
+// choose the direction; otherwise it goes to the nearest pixel.
+inline int boxEdge(double value, int limit) {
+    return static_cast<int>(std::lround(std::min(std::max(value, 0.0), static_cast<double>(limit))));
+}
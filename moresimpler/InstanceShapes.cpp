@@ -0,0 +1,330 @@
+#include "InstanceShapes.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <nlohmann/json.hpp>
+
+#include "BoxEdge.h"
+
+namespace instance_shapes {
+
+namespace {
+
+struct Edge {
+    cv::Point2f top;
+    cv::Point2f bottom;
+};
+
+// Where an edge crosses the horizontal line y (top.y <= y < bottom.y).
+// Queries and the rasterizer both go through here, so they agree exactly.
+double crossingX(const Edge& edge, double y) {
+    return edge.top.x + (y - edge.top.y) * (edge.bottom.x - edge.top.x) / (edge.bottom.y - edge.top.y);
+}
+
+// The edge from a to b, top end first; false for horizontal edges, which
+// never cross a scanline
+bool makeEdge(const cv::Point2f& a, const cv::Point2f& b, Edge& edge) {
+    if (a.y == b.y) {
+        return false;
+    }
+    edge = a.y < b.y ? Edge{a, b} : Edge{b, a};
+    return true;
+}
+
+void rasterizePolygons(const InstanceShape& shape, cv::Mat& mask) {
+    // Edge table sorted by top, swept from top to bottom with an active list
+    std::vector<Edge> edges;
+    for (const auto& ring : shape.polygons) {
+        for (size_t i = 0; i < ring.size(); i++) {
+            Edge edge;
+            if (makeEdge(ring[i], ring[(i + 1) % ring.size()], edge)) {
+                edges.push_back(edge);
+            }
+        }
+    }
+    std::sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b) {
+        return a.top.y < b.top.y;
+    });
+
+    std::vector<Edge> active;
+    std::vector<double> crossings;
+    size_t next = 0;
+    int x_begin = shape.box.x;
+    int x_end = shape.box.x + shape.box.width;
+    for (int y = shape.box.y; y < shape.box.y + shape.box.height; y++) {
+        double center = y + 0.5;
+        while (next < edges.size() && edges[next].top.y <= center) {
+            active.push_back(edges[next++]);
+        }
+        active.erase(std::remove_if(active.begin(), active.end(), [center](const Edge& edge) {
+            return edge.bottom.y <= center;
+        }), active.end());
+
+        crossings.clear();
+        for (const Edge& edge : active) {
+            crossings.push_back(crossingX(edge, center));
+        }
+        std::sort(crossings.begin(), crossings.end());
+
+        // Even-odd: pixel centres between the 1st and 2nd crossing, the 3rd
+        // and 4th, ... are inside
+        uchar* row = mask.ptr<uchar>(y);
+        for (size_t k = 0; k + 1 < crossings.size(); k += 2) {
+            int from = std::max(x_begin, boxEdge(std::ceil(crossings[k] - 0.5), mask.cols));
+            int to = std::min(x_end, boxEdge(std::ceil(crossings[k + 1] - 0.5), mask.cols));
+            if (from < to) {
+                std::fill(row + from, row + to, uchar(255));
+            }
+        }
+    }
+}
+
+void rasterizeRuns(const InstanceShape& shape, cv::Mat& mask) {
+    const uint32_t height = shape.rle_height;
+    const cv::Rect& box = shape.box;
+    uint32_t start = 0;
+    for (size_t i = 0; i < shape.run_ends.size(); i++) {
+        uint32_t end = shape.run_ends[i];
+
+        // Odd runs are foreground; split them at column boundaries
+        for (uint32_t index = start; i % 2 == 1 && index < end;) {
+            int x = static_cast<int>(index / height);
+            int y = static_cast<int>(index % height);
+            int length = static_cast<int>(std::min(end - index, height - y));
+            index += length;
+            if (x < box.x || x >= box.x + box.width) {
+                continue;
+            }
+            int from = std::max(y, box.y);
+            int to = std::min(y + length, box.y + box.height);
+            for (int row = from; row < to; row++) {
+                mask.ptr<uchar>(row)[x] = 255;
+            }
+        }
+        start = end;
+    }
+}
+
+// COCO's compressed RLE string (pycocotools rleToString): each count as
+// 5-bit groups in printable characters, from the third count on as the
+// difference to the count two before
+bool decodeCocoString(const std::string& text, std::vector<int64_t>& counts) {
+    size_t p = 0;
+    while (p < text.size()) {
+        int64_t value = 0;
+        int shift = 0;
+        bool more = true;
+        while (more) {
+            if (p >= text.size() || shift > 30) {
+                return false;
+            }
+            int64_t c = text[p++] - 48;
+            value |= (c & 0x1f) << shift;
+            more = (c & 0x20) != 0;
+            shift += 5;
+            if (!more && (c & 0x10)) {
+                value |= -(int64_t(1) << shift);
+            }
+        }
+        if (counts.size() > 2) {
+            value += counts[counts.size() - 2];
+        }
+        counts.push_back(value);
+    }
+    return true;
+}
+
+cv::Rect parseBox(const nlohmann::json& instance, cv::Size image_size) {
+    cv::Rect image_rect(0, 0, image_size.width, image_size.height);
+    if (!instance.contains("box")) {
+        return image_rect;
+    }
+    auto box = instance["box"].get<std::vector<double>>();
+    if (box.size() != 4) {
+        throw std::runtime_error("box needs four values");
+    }
+    for (double value : box) {
+        if (!std::isfinite(value)) {
+            throw std::runtime_error("box coordinate is not a number");
+        }
+    }
+    int x0 = boxEdge(std::floor(box[0]), image_size.width);
+    int y0 = boxEdge(std::floor(box[1]), image_size.height);
+    int x1 = boxEdge(std::ceil(box[2]), image_size.width);
+    int y1 = boxEdge(std::ceil(box[3]), image_size.height);
+    return cv::Rect(x0, y0, std::max(0, x1 - x0), std::max(0, y1 - y0));
+}
+
+// A polygon vertex coordinate; anything a float can't hold is rejected, so
+// edges and their crossings stay finite
+float parseVertex(double value) {
+    if (!std::isfinite(value) || std::abs(value) > std::numeric_limits<float>::max()) {
+        throw std::runtime_error("polygon coordinate out of range");
+    }
+    return static_cast<float>(value);
+}
+
+} // namespace
+
+bool InstanceShape::contains(int x, int y) const {
+    if (!box.contains(cv::Point(x, y))) {
+        return false;
+    }
+
+    if (!bitmap.empty()) {
+        return bitmap.at<uchar>(y, x) != 0;
+    }
+
+    if (!run_ends.empty()) {
+        // The run holding the pixel; odd runs are foreground
+        uint32_t index = static_cast<uint32_t>(x) * rle_height + y;
+        size_t run = std::upper_bound(run_ends.begin(), run_ends.end(), index) - run_ends.begin();
+        return run % 2 == 1 && run < run_ends.size();
+    }
+
+    // Even-odd crossing test of the pixel centre
+    double px = x + 0.5;
+    double py = y + 0.5;
+    bool inside = false;
+    for (const auto& ring : polygons) {
+        for (size_t i = 0; i < ring.size(); i++) {
+            Edge edge;
+            if (makeEdge(ring[i], ring[(i + 1) % ring.size()], edge) &&
+                edge.top.y <= py && py < edge.bottom.y && px < crossingX(edge, py)) {
+                inside = !inside;
+            }
+        }
+    }
+    return inside;
+}
+
+void InstanceShape::rasterize(cv::Mat& mask) const {
+    if (box.empty()) {
+        return;
+    }
+    if (!bitmap.empty()) {
+        mask(box).setTo(255, bitmap(box));
+    } else if (!run_ends.empty()) {
+        rasterizeRuns(*this, mask);
+    } else {
+        rasterizePolygons(*this, mask);
+    }
+}
+
+bool InstanceShapeSet::parse(const std::string& text) {
+    shapes.clear();
+    error_message.clear();
+
+    try {
+        auto j = nlohmann::json::parse(text);
+        int width = j.at("width").get<int>();
+        int height = j.at("height").get<int>();
+        if (width <= 0 || height <= 0 || width > 16384 || height > 16384) {
+            error_message = "image size out of range";
+            return false;
+        }
+        image_size = cv::Size(width, height);
+
+        for (const auto& instance : j.at("instances")) {
+            InstanceShape shape;
+            shape.box = parseBox(instance, image_size);
+            shape.score = instance.value("score", 0.0f);
+
+            if (instance.contains("rle")) {
+                const auto& rle = instance["rle"];
+                auto size = rle.at("size").get<std::vector<int>>();
+                if (size.size() != 2 || size[0] != height || size[1] != width) {
+                    error_message = "RLE size does not match the image";
+                    return false;
+                }
+
+                std::vector<int64_t> counts;
+                if (rle.at("counts").is_string()) {
+                    if (!decodeCocoString(rle["counts"].get<std::string>(), counts)) {
+                        error_message = "corrupt RLE string";
+                        return false;
+                    }
+                } else {
+                    counts = rle["counts"].get<std::vector<int64_t>>();
+                }
+
+                int64_t total = 0;
+                for (int64_t count : counts) {
+                    total += count;
+                    if (count < 0 || total > static_cast<int64_t>(width) * height) {
+                        error_message = "RLE runs exceed the image";
+                        return false;
+                    }
+                    shape.run_ends.push_back(static_cast<uint32_t>(total));
+                }
+                shape.rle_height = height;
+            } else {
+                for (const auto& flat : instance.at("polygons")) {
+                    auto values = flat.get<std::vector<double>>();
+                    if (values.size() < 6 || values.size() % 2 != 0) {
+                        continue;
+                    }
+                    std::vector<cv::Point2f> ring;
+                    for (size_t i = 0; i < values.size(); i += 2) {
+                        ring.emplace_back(parseVertex(values[i]), parseVertex(values[i + 1]));
+                    }
+                    shape.polygons.push_back(std::move(ring));
+                }
+            }
+            shapes.push_back(std::move(shape));
+        }
+    } catch (const std::exception& e) {
+        shapes.clear();
+        error_message = e.what();
+        return false;
+    }
+    return true;
+}
+
+void InstanceShapeSet::assign(const std::vector<cv::Mat>& masks, cv::Size size) {
+    shapes.clear();
+    error_message.clear();
+    image_size = size;
+
+    for (const auto& mask : masks) {
+        InstanceShape shape;
+        if (mask.channels() > 1) {
+            cv::cvtColor(mask, shape.bitmap, cv::COLOR_BGR2GRAY);
+        } else {
+            shape.bitmap = mask;
+        }
+        if (shape.bitmap.size() != size) {
+            cv::resize(shape.bitmap, shape.bitmap, size, 0, 0, cv::INTER_NEAREST);
+        }
+
+        std::vector<cv::Point> points;
+        cv::findNonZero(shape.bitmap, points);
+        shape.box = cv::boundingRect(points);
+        shapes.push_back(std::move(shape));
+    }
+}
+
+int InstanceShapeSet::instanceAt(int x, int y) const {
+    for (size_t i = 0; i < shapes.size(); i++) {
+        if (shapes[i].contains(x, y)) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+cv::Mat InstanceShapeSet::rasterize(size_t index) const {
+    cv::Mat mask = cv::Mat::zeros(image_size, CV_8UC1);
+    shapes[index].rasterize(mask);
+    return mask;
+}
+
+cv::Mat InstanceShapeSet::rasterize() const {
+    cv::Mat mask = cv::Mat::zeros(image_size, CV_8UC1);
+    for (const auto& shape : shapes) {
+        shape.rasterize(mask);
+    }
+    return mask;
+}
+
+} // namespace instance_shapes
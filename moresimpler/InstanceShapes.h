@@ -0,0 +1,76 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+// Instance masks as shapes instead of pixels
+// ("application/x-instance-shapes+json").
+//
+// A keypoint filter only asks "is this point on a person?", and a person is
+// a handful of polygon vertices or a few hundred run lengths, a fraction of
+// a PNG mask. The server sends per instance its bounding box and either
+// simplified polygons or COCO-style RLE:
+//
+//   {"width": W, "height": H,
+//    "instances": [
+//      {"box": [x0, y0, x1, y1], "score": 0.91,
+//       "polygons": [[x, y, x, y, ...], ...]},
+//      {"box": [x0, y0, x1, y1], "score": 0.87,
+//       "rle": {"size": [H, W], "counts": "<COCO string>" or [n, n, ...]}}]}
+//
+// Polygon vertices are in image pixels (pixel centres at +0.5); several
+// rings combine even-odd, so a ring inside another is a hole. RLE runs go
+// down the columns (column-major, like pycocotools) and alternate
+// background and foreground, starting with background.
+//
+// Point queries work on the shapes directly; masks are only rasterized
+// when asked for. A pixel belongs to an instance when its centre does, the
+// same rule for queries and rasterization.
+namespace instance_shapes {
+
+constexpr const char* kContentType = "application/x-instance-shapes+json";
+
+struct InstanceShape {
+    cv::Rect box;       // pixel bounds, clipped to the image
+    float score = 0.0f;
+
+    // Exactly one of the three is set
+    std::vector<std::vector<cv::Point2f>> polygons;
+    std::vector<uint32_t> run_ends;   // RLE: where each run ends, column-major
+    int rle_height = 0;
+    cv::Mat bitmap;                   // decoded mask from servers without shapes
+
+    // Whether pixel (x, y) belongs to the instance
+    bool contains(int x, int y) const;
+
+    // Set the instance's pixels of a CV_8UC1 image-sized mask to 255
+    void rasterize(cv::Mat& mask) const;
+};
+
+class InstanceShapeSet {
+public:
+    // Parse a shapes response; false with error() on malformed input
+    bool parse(const std::string& text);
+
+    // Wrap full-image masks decoded from a regular response
+    void assign(const std::vector<cv::Mat>& masks, cv::Size image_size);
+
+    cv::Size imageSize() const { return image_size; }
+    const std::vector<InstanceShape>& instances() const { return shapes; }
+    const std::string& error() const { return error_message; }
+
+    // Index of the first instance containing pixel (x, y), or -1
+    int instanceAt(int x, int y) const;
+
+    // One instance's mask, or all of them combined (CV_8UC1, 0/255)
+    cv::Mat rasterize(size_t index) const;
+    cv::Mat rasterize() const;
+
+private:
+    cv::Size image_size;
+    std::vector<InstanceShape> shapes;
+    std::string error_message;
+};
+
+} // namespace instance_shapes
@@ -0,0 +1,86 @@
+#include "ProtoMaskAssembler.h"
+#include <algorithm>
+#include <cmath>
+
+#include "BoxEdge.h"
+
+std::vector<cv::Mat> ProtoMaskAssembler::assemble(const proto_masks::ProtoSetReader& reader) {
+    std::vector<cv::Mat> masks;
+    int count = static_cast<int>(reader.instanceCount());
+    if (count == 0) {
+        return masks;
+    }
+
+    int channels = static_cast<int>(reader.prototypeCount());
+    int proto_width = static_cast<int>(reader.prototypeWidth());
+    int proto_height = static_cast<int>(reader.prototypeHeight());
+    int width = static_cast<int>(reader.imageWidth());
+    int height = static_cast<int>(reader.imageHeight());
+
+    // Prototypes as floats, one plane per row (vectorized conversion)
+    uchar* raw = const_cast<uchar*>(reader.prototypes());
+    if (reader.prototypeType() == proto_masks::PrototypeType::Float16) {
+        cv::Mat(channels, proto_width * proto_height, CV_16FC1, raw).convertTo(prototypes, CV_32F);
+    } else {
+        cv::Mat(channels, proto_width * proto_height, CV_8SC1, raw).convertTo(prototypes, CV_32F, reader.int8Scale());
+    }
+
+    coefficients.create(count, channels, CV_32F);
+    for (int i = 0; i < count; i++) {
+        reader.coefficients(i, coefficients.ptr<float>(i));
+    }
+
+    // Every instance's mask logits in one matrix multiply
+    cv::gemm(coefficients, prototypes, 1.0, cv::noArray(), 0.0, logits);
+
+    double scale_x = static_cast<double>(proto_width) / width;
+    double scale_y = static_cast<double>(proto_height) / height;
+
+    for (int i = 0; i < count; i++) {
+        cv::Mat mask = cv::Mat::zeros(height, width, CV_8UC1);
+        masks.push_back(mask);
+
+        // The box in image pixels, clipped to the image; a box with NaN or
+        // infinite edges leaves its mask empty
+        const float* box = reader.instance(i).box;
+        if (!std::isfinite(box[0]) || !std::isfinite(box[1]) ||
+            !std::isfinite(box[2]) || !std::isfinite(box[3])) {
+            continue;
+        }
+        int x0 = boxEdge(box[0], width);
+        int y0 = boxEdge(box[1], height);
+        int x1 = boxEdge(box[2], width);
+        int y1 = boxEdge(box[3], height);
+        if (x1 <= x0 || y1 <= y0) {
+            continue;
+        }
+
+        // The prototype cells under the box, plus one cell of margin for
+        // the bilinear filter
+        int px0 = std::max(0, static_cast<int>(std::floor(x0 * scale_x)) - 1);
+        int py0 = std::max(0, static_cast<int>(std::floor(y0 * scale_y)) - 1);
+        int px1 = std::min(proto_width, static_cast<int>(std::ceil(x1 * scale_x)) + 1);
+        int py1 = std::min(proto_height, static_cast<int>(std::ceil(y1 * scale_y)) + 1);
+        cv::Mat plane = logits.row(i).reshape(1, proto_height);
+        cv::Mat region = plane(cv::Rect(px0, py0, px1 - px0, py1 - py0));
+
+        // sigmoid(x) = 1 / (1 + exp(-x))
+        region.convertTo(probabilities, CV_32F, -1.0);
+        cv::exp(probabilities, probabilities);
+        probabilities += cv::Scalar(1.0);
+        cv::divide(1.0, probabilities, probabilities);
+
+        // Upsample just the box: each image pixel centre maps back onto the
+        // region with the same pixel-centre convention as cv::resize
+        cv::Matx23d to_region(scale_x, 0.0, (x0 + 0.5) * scale_x - 0.5 - px0,
+                              0.0, scale_y, (y0 + 0.5) * scale_y - 0.5 - py0);
+        cv::warpAffine(probabilities, upsampled, to_region, cv::Size(x1 - x0, y1 - y0),
+                       cv::INTER_LINEAR | cv::WARP_INVERSE_MAP, cv::BORDER_REPLICATE);
+
+        // Threshold straight into the box of the full mask
+        cv::Mat box_pixels = mask(cv::Rect(x0, y0, x1 - x0, y1 - y0));
+        cv::compare(upsampled, 0.5, box_pixels, cv::CMP_GT);
+    }
+
+    return masks;
+}
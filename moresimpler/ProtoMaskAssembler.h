@@ -0,0 +1,27 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#include "ProtoMasks.h"
+
+// Builds per-detection masks from a YOLOv8-seg prototype response (see
+// common/ProtoMasks.h), like the model's native-resolution post-processing:
+// one matrix multiply of all coefficients with all prototypes, a sigmoid,
+// then each mask is upsampled bilinearly to the image inside its box only
+// and thresholded at 0.5. Everything outside the box stays background.
+//
+// Scratch matrices are reused from call to call, so one assembler must not
+// be used from two threads at once.
+class ProtoMaskAssembler {
+public:
+    // One full-image CV_8UC1 mask (0/255) per instance, in response order
+    std::vector<cv::Mat> assemble(const proto_masks::ProtoSetReader& reader);
+
+private:
+    cv::Mat prototypes;     // C x (height * width) floats
+    cv::Mat coefficients;   // N x C floats
+    cv::Mat logits;         // N x (height * width), one plane per instance
+    cv::Mat probabilities;  // sigmoid of the region under one box
+    cv::Mat upsampled;      // that region at image resolution
+};
@@ -2,136 +2,202 @@
 #include <fstream>
 #include <string>
 #include <chrono>
+#include <cstring>
 #include <future>
 #include <thread>
 #include <vector>
 
-#include <cpr/cpr.h>
 #include <nlohmann/json.hpp>
 #include <opencv2/opencv.hpp>
 #include <opencv2/imgcodecs.hpp>
 
+#include "AsyncRequestEngine.h"
+#include "Base64.h"
+#include "ContentCoding.h"
+#include "InstanceShapes.h"
+#include "ProtoMaskAssembler.h"
+#include "ProtoMasks.h"
+
 using json = nlohmann::json;
 
 class YOLOSegmenterClient {
 private:
     std::string server_url;
+    
+    // Ask for prototypes + coefficients instead of finished masks
+    bool request_prototypes;
+    
+    // Ask for polygons / RLE instead of finished masks
+    bool request_shapes;
+    
+    // Builds masks from prototype responses; only used on the engine's
+    // I/O thread
+    ProtoMaskAssembler assembler;
+    
+    // Single curl-multi I/O thread driving all requests. Declared last so it
+    // is destroyed first, before the members its callbacks use.
+    AsyncRequestEngine engine;
 
 public:
-    YOLOSegmenterClient(const std::string& url) : server_url(url) {}
+    YOLOSegmenterClient(const std::string& url, size_t max_in_flight = 4)
+        : server_url(url), request_prototypes(false), request_shapes(false),
+          engine(max_in_flight, max_in_flight * 2) {}
+    
+    // Have the server send the model's mask prototypes once plus each
+    // detection's coefficients and box (see common/ProtoMasks.h), and
+    // assemble the masks here. Servers without the mode keep sending
+    // base64 PNG masks.
+    void requestPrototypes(bool enable) {
+        request_prototypes = enable;
+    }
 
-    // Function to decode base64 string to binary data
+    // Have the server send each person as a box plus simplified polygons or
+    // COCO RLE (see InstanceShapes.h) instead of PNG masks. Only used by
+    // fetchShapesAsync.
+    void requestShapes(bool enable) {
+        request_shapes = enable;
+    }
+
+    // Function to decode base64 string to binary data; empty on invalid input
     std::vector<uchar> decodeBase64(const std::string& encoded_string) {
-        static const std::string base64_chars = 
-            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-        
         std::vector<uchar> decoded;
-        int i = 0, j = 0;
-        unsigned char char_array_4[4], char_array_3[3];
-        std::string input = encoded_string;
+        if (!base64::decode(encoded_string, decoded)) {
+            std::cerr << "Error: Invalid base64 in mask" << std::endl;
+        }
+        return decoded;
+    }
+
+    // Build the upload request for an image; false if it can't be encoded
+    bool buildRequest(const cv::Mat& image, const char* accept, HttpRequest& request) {
+        // Encode the image in memory instead of going through a temp file
+        std::vector<uchar> image_buffer;
+        if (!cv::imencode(".jpg", image, image_buffer)) {
+            std::cerr << "Error: Could not encode image" << std::endl;
+            return false;
+        }
         
-        // Remove any non-base64 characters like whitespace
-        input.erase(std::remove_if(input.begin(), input.end(), [&](char c) {
-            return base64_chars.find(c) == std::string::npos && c != '=';
-        }), input.end());
+        // Prepare multipart request for the YOLO server
+        // Note: Your server expects "image" as the field name, not "file"
+        request.url = server_url;
+        request.parts.push_back({"image", "image.jpg", "image/jpeg", std::move(image_buffer)});
+        request.accept_encoding = content_coding::responseCodings();
+        if (accept) {
+            request.headers.push_back(std::string("Accept: ") + accept + ", application/json;q=0.5");
+        }
+        return true;
+    }
+
+    std::future<std::vector<cv::Mat>> fetchMasksAsync(const cv::Mat& image) {
+        auto result_promise = std::make_shared<std::promise<std::vector<cv::Mat>>>();
+        auto result_future = result_promise->get_future();
         
-        int in_len = input.size();
+        HttpRequest request;
+        if (!buildRequest(image, request_prototypes ? proto_masks::kContentType : nullptr, request)) {
+            result_promise->set_value({});
+            return result_future;
+        }
         
-        while (in_len-- && input[i] != '=') {
-            char_array_4[j++] = input[i++];
-            if (j == 4) {
-                for (j = 0; j < 4; j++)
-                    char_array_4[j] = base64_chars.find(char_array_4[j]);
-                
-                char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-                char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-                char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-                
-                for (j = 0; j < 3; j++)
-                    decoded.push_back(char_array_3[j]);
-                j = 0;
-            }
+        // Hand the request to the engine's I/O thread, no thread per request
+        std::cout << "Sending request to " << server_url << std::endl;
+        engine.submit(std::move(request), [this, result_promise](HttpResponse&& response) {
+            result_promise->set_value(parseMasks(response));
+        });
+        
+        return result_future;
+    }
+    
+    // Like fetchMasksAsync, but the persons come back as shapes that answer
+    // point queries directly and are only rasterized on demand. Servers
+    // that only send masks are wrapped into the same interface.
+    std::future<instance_shapes::InstanceShapeSet> fetchShapesAsync(const cv::Mat& image) {
+        auto result_promise = std::make_shared<std::promise<instance_shapes::InstanceShapeSet>>();
+        auto result_future = result_promise->get_future();
+        
+        HttpRequest request;
+        if (!buildRequest(image, request_shapes ? instance_shapes::kContentType : nullptr, request)) {
+            result_promise->set_value({});
+            return result_future;
         }
         
-        if (j) {
-            for (int k = j; k < 4; k++)
-                char_array_4[k] = 0;
-            
-            for (int k = 0; k < 4; k++)
-                char_array_4[k] = base64_chars.find(char_array_4[k]);
-            
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-            
-            for (int k = 0; k < j - 1; k++)
-                decoded.push_back(char_array_3[k]);
+        std::cout << "Sending request to " << server_url << std::endl;
+        cv::Size image_size = image.size();
+        engine.submit(std::move(request), [this, result_promise, image_size](HttpResponse&& response) {
+            result_promise->set_value(parseShapes(response, image_size));
+        });
+        
+        return result_future;
+    }
+    
+    // Shapes of a server response; decoded masks if the server sent those
+    instance_shapes::InstanceShapeSet parseShapes(const HttpResponse& response, cv::Size image_size) {
+        instance_shapes::InstanceShapeSet shapes;
+        if (response.status_code == 200 && response.error.empty() &&
+            response.content_type.compare(0, std::strlen(instance_shapes::kContentType),
+                                          instance_shapes::kContentType) == 0) {
+            if (!shapes.parse(response.text)) {
+                std::cerr << "Error parsing shapes response: " << shapes.error() << std::endl;
+                return shapes;
+            }
+            std::cout << "Received shapes for " << shapes.instances().size() << " detections ("
+                      << response.text.size() << " bytes)" << std::endl;
+            return shapes;
         }
         
-        return decoded;
+        shapes.assign(parseMasks(response), image_size);
+        return shapes;
     }
-
-    std::future<std::vector<cv::Mat>> fetchMasksAsync(const cv::Mat& image) {
-        return std::async(std::launch::async, [this, image]() {
-            std::vector<cv::Mat> masks;
-            
-            // Save image to temporary file
-            std::string temp_file = "temp_image.jpg";
-            cv::imwrite(temp_file, image);
-            
-            // Prepare multipart request for the YOLO server
-            // Note: Your server expects "image" as the field name, not "file"
-            cpr::Multipart multipart{
-                {"image", cpr::File{temp_file}}
-            };
-            
-            // Make asynchronous POST request
-            std::cout << "Sending request to " << server_url << std::endl;
-            auto future_response = cpr::PostAsync(
-                cpr::Url{server_url},
-                multipart
-            );
+    
+    // Decode every mask of a server response
+    std::vector<cv::Mat> parseMasks(const HttpResponse& response) {
+        std::vector<cv::Mat> masks;
+        
+        // Check if request was successful
+        if (response.status_code != 200 || !response.error.empty()) {
+            std::cerr << "Error: " << response.status_code << " - "
+                      << (response.error.empty() ? response.text : response.error) << std::endl;
+            return masks;
+        }
+        
+        // Prototype response: assemble the masks locally
+        if (response.content_type.compare(0, std::strlen(proto_masks::kContentType),
+                                          proto_masks::kContentType) == 0) {
+            proto_masks::ProtoSetReader reader;
+            if (!reader.parse(reinterpret_cast<const uint8_t*>(response.text.data()), response.text.size())) {
+                std::cerr << "Error parsing prototype response: " << reader.error() << std::endl;
+                return masks;
+            }
             
-            // Wait for response
-            auto response = future_response.get();
+            std::cout << "Received prototypes for " << reader.instanceCount() << " detections ("
+                      << response.text.size() << " bytes)" << std::endl;
+            return assembler.assemble(reader);
+        }
+        
+        // Parse JSON response
+        try {
+            auto j = json::parse(response.text);
             
-            // Clean up temporary file
-            std::remove(temp_file.c_str());
+            // Extract masks from response - your server returns an array of masks
+            auto masks_array = j["masks"].get<std::vector<std::string>>();
             
-            // Check if request was successful
-            if (response.status_code != 200) {
-                std::cerr << "Error: " << response.status_code << " - " << response.text << std::endl;
-                return masks;
-            }
+            std::cout << "Received " << masks_array.size() << " masks from server" << std::endl;
             
-            // Parse JSON response
-            try {
-                auto j = json::parse(response.text);
-                
-                // Extract masks from response - your server returns an array of masks
-                auto masks_array = j["masks"].get<std::vector<std::string>>();
+            // Process each mask
+            for (const auto& base64_mask : masks_array) {
+                // Decode base64 to binary
+                std::vector<uchar> mask_data = decodeBase64(base64_mask);
                 
-                std::cout << "Received " << masks_array.size() << " masks from server" << std::endl;
+                // Decode mask from binary data
+                cv::Mat mask = cv::imdecode(mask_data, cv::IMREAD_UNCHANGED);
                 
-                // Process each mask
-                for (const auto& base64_mask : masks_array) {
-                    // Decode base64 to binary
-                    std::vector<uchar> mask_data = decodeBase64(base64_mask);
-                    
-                    // Decode mask from binary data
-                    cv::Mat mask = cv::imdecode(mask_data, cv::IMREAD_UNCHANGED);
-                    
-                    if (!mask.empty()) {
-                        masks.push_back(mask);
-                    }
+                if (!mask.empty()) {
+                    masks.push_back(mask);
                 }
-                
-                return masks;
-            } catch (const std::exception& e) {
-                std::cerr << "Error parsing response: " << e.what() << std::endl;
-                return masks;
             }
-        });
+        } catch (const std::exception& e) {
+            std::cerr << "Error parsing response: " << e.what() << std::endl;
+        }
+        
+        return masks;
     }
     
     // Create a combined mask from multiple individual masks
@@ -217,7 +283,7 @@ cv::Mat visualizeMask(const cv::Mat& image, const cv::Mat& mask, const cv::Scala
 int main(int argc, char** argv) {
     // Check if image path is provided
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <image_path> [server_url]" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <image_path> [server_url] [json|protos|shapes]" << std::endl;
         return 1;
     }
     
@@ -239,12 +305,27 @@ int main(int argc, char** argv) {
     // Create segmenter client
     YOLOSegmenterClient client(server_url);
     
+    // "protos": assemble masks from prototypes on this side
+    if (argc > 3 && std::string(argv[3]) == "protos") {
+        client.requestPrototypes(true);
+    }
+    
+    // "shapes": polygons / RLE, queried without rasterizing
+    bool use_shapes = argc > 3 && std::string(argv[3]) == "shapes";
+    client.requestShapes(use_shapes);
+    
     // Start time measurement
     auto start_time = std::chrono::high_resolution_clock::now();
     
     // Send request asynchronously
     std::cout << "Sending request to " << server_url << "..." << std::endl;
-    auto future_masks = client.fetchMasksAsync(image);
+    std::future<std::vector<cv::Mat>> future_masks;
+    std::future<instance_shapes::InstanceShapeSet> future_shapes;
+    if (use_shapes) {
+        future_shapes = client.fetchShapesAsync(image);
+    } else {
+        future_masks = client.fetchMasksAsync(image);
+    }
     
     // Do other work while waiting for the response
     std::cout << "Request sent. Processing other tasks while waiting..." << std::endl;
@@ -255,13 +336,44 @@ int main(int argc, char** argv) {
     
     // Get the masks when ready
     std::cout << "Waiting for segmentation result..." << std::endl;
-    std::vector<cv::Mat> masks = future_masks.get();
+    std::vector<cv::Mat> masks;
+    instance_shapes::InstanceShapeSet shapes;
+    if (use_shapes) {
+        shapes = future_shapes.get();
+    } else {
+        masks = future_masks.get();
+    }
     
     // End time measurement
     auto end_time = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
     std::cout << "Request completed in " << duration << "ms" << std::endl;
     
+    if (use_shapes) {
+        // Keypoint rejection straight on the shapes: no mask is built
+        cv::Mat gray;
+        cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+        std::vector<cv::KeyPoint> keypoints;
+        cv::FAST(gray, keypoints, 20);
+        
+        auto query_start = std::chrono::high_resolution_clock::now();
+        size_t rejected = 0;
+        for (const auto& keypoint : keypoints) {
+            if (shapes.instanceAt(static_cast<int>(keypoint.pt.x), static_cast<int>(keypoint.pt.y)) >= 0) {
+                rejected++;
+            }
+        }
+        auto query_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::high_resolution_clock::now() - query_start).count();
+        std::cout << "Rejected " << rejected << " of " << keypoints.size()
+                  << " keypoints on people in " << query_us << "us" << std::endl;
+        
+        // Masks only for saving and display below
+        for (size_t i = 0; i < shapes.instances().size(); ++i) {
+            masks.push_back(shapes.rasterize(i));
+        }
+    }
+    
     // Check if masks were received
     if (masks.empty()) {
         std::cerr << "Error: No masks received from server" << std::endl;
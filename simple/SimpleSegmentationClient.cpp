@@ -1,9 +1,11 @@
 #include "SimpleSegmentationClient.h"
+#include "Base64.h"
+#include "ContentCoding.h"
 #include <iostream>
-#include <fstream>
 
-SimpleSegmentationClient::SimpleSegmentationClient(const std::string& server_url)
-    : m_serverUrl(server_url) {
+SimpleSegmentationClient::SimpleSegmentationClient(const std::string& server_url, size_t max_in_flight)
+    : m_serverUrl(server_url),
+      m_engine(max_in_flight, max_in_flight * 2) {
 }
 
 cv::Mat SimpleSegmentationClient::segmentImage(const cv::Mat& image) {
@@ -18,28 +20,20 @@ cv::Mat SimpleSegmentationClient::segmentImage(const cv::Mat& image) {
     // Encode the image to PNG
     std::vector<uchar> imageBuffer = encodeImageToPNG(processImage);
     
-    // Create a temporary file
-    std::string tempFilename = "temp_image.png";
-    std::ofstream outFile(tempFilename, std::ios::binary);
-    outFile.write(reinterpret_cast<const char*>(imageBuffer.data()), imageBuffer.size());
-    outFile.close();
-    
-    // Send the image to the server using CPR
+    // Send the image to the server using CPR, straight from memory
     cpr::Response response;
     
     try {
-        cpr::Multipart multipart{{"image", cpr::File{tempFilename}}};
-        response = cpr::Post(cpr::Url{m_serverUrl}, multipart);
+        cpr::Multipart multipart{{"image", cpr::Buffer{imageBuffer.begin(), imageBuffer.end(), "image.png"}}};
+        // Let the server compress the JSON masks; libcurl decodes them
+        response = cpr::Post(cpr::Url{m_serverUrl}, multipart,
+                             cpr::AcceptEncoding{content_coding::responseCodings()});
     }
     catch (const std::exception& e) {
         std::cerr << "HTTP Error: " << e.what() << std::endl;
-        std::remove(tempFilename.c_str());
         return cv::Mat();
     }
     
-    // Clean up temporary file
-    std::remove(tempFilename.c_str());
-    
     // Check response status
     if (response.status_code != 200) {
         std::cerr << "HTTP Error: " << response.status_code << std::endl;
@@ -62,22 +56,38 @@ std::future<cv::Mat> SimpleSegmentationClient::segmentImageAsync(const cv::Mat&
     // Get a future from the promise
     std::future<cv::Mat> resultFuture = resultPromise->get_future();
     
-    // Create a copy of the image for the async task
-    cv::Mat imageCopy = image.clone();
+    // Make sure image is in correct format
+    cv::Mat processImage;
+    if (image.channels() > 1) {
+        cv::cvtColor(image, processImage, cv::COLOR_BGR2GRAY);
+    } else {
+        processImage = image;
+    }
+    
+    // Build the upload in memory; the engine's I/O thread sends it
+    HttpRequest request;
+    request.url = m_serverUrl;
+    request.parts.push_back({"image", "image.png", "image/png", encodeImageToPNG(processImage)});
+    request.accept_encoding = content_coding::responseCodings();
     
-    // Launch the async task
-    std::thread([this, imageCopy, resultPromise]() mutable {
+    m_engine.submit(std::move(request), [this, resultPromise](HttpResponse&& response) {
         try {
-            // Process the image
-            cv::Mat result = this->segmentImage(imageCopy);
+            // Check response status
+            if (response.status_code != 200 || !response.error.empty()) {
+                std::cerr << "HTTP Error: " << response.status_code << std::endl;
+                std::cerr << "Error message: " << (response.error.empty() ? response.text : response.error) << std::endl;
+                resultPromise->set_value(cv::Mat());
+                return;
+            }
             
-            // Set the promise value with the result
-            resultPromise->set_value(result);
+            // Extract and decode the mask
+            std::string base64Mask = extractBase64MaskFromJson(response.text);
+            resultPromise->set_value(decodeBase64Mask(base64Mask));
         } catch (const std::exception& e) {
             // Set the promise exception
             resultPromise->set_exception(std::current_exception());
         }
-    }).detach();
+    });
     
     return resultFuture;
 }
@@ -140,46 +150,14 @@ cv::Mat SimpleSegmentationClient::decodeBase64Mask(const std::string& base64Mask
         return cv::Mat();
     }
     
-    // Base64 decode
-    std::string decoded;
-    decoded.resize(base64Mask.size() * 3 / 4); // Approximate size
-    
-    // Create Base64 decoding table
-    std::vector<unsigned char> decodingTable(256, -1);
-    for (int i = 0; i < 64; i++) {
-        unsigned char c = 0;
-        if (i < 26) c = 'A' + i;
-        else if (i < 52) c = 'a' + (i - 26);
-        else if (i < 62) c = '0' + (i - 52);
-        else if (i == 62) c = '+';
-        else c = '/';
-        
-        decodingTable[c] = i;
-    }
-    
-    int padding = 0;
-    if (base64Mask.length() > 0 && base64Mask[base64Mask.length() - 1] == '=') padding++;
-    if (base64Mask.length() > 1 && base64Mask[base64Mask.length() - 2] == '=') padding++;
-    
-    std::vector<uchar> data;
-    for (size_t i = 0; i < base64Mask.length(); i += 4) {
-        // Get values for each group of four characters
-        unsigned char v1 = (i+0 < base64Mask.length() && base64Mask[i+0] != '=') ? decodingTable[base64Mask[i+0]] : 0;
-        unsigned char v2 = (i+1 < base64Mask.length() && base64Mask[i+1] != '=') ? decodingTable[base64Mask[i+1]] : 0;
-        unsigned char v3 = (i+2 < base64Mask.length() && base64Mask[i+2] != '=') ? decodingTable[base64Mask[i+2]] : 0;
-        unsigned char v4 = (i+3 < base64Mask.length() && base64Mask[i+3] != '=') ? decodingTable[base64Mask[i+3]] : 0;
-        
-        // Write the first byte
-        data.push_back((v1 << 2) | (v2 >> 4));
-        
-        // Write the second byte if there is enough data
-        if (i+2 < base64Mask.length() && base64Mask[i+2] != '=')
-            data.push_back(((v2 & 0x0F) << 4) | (v3 >> 2));
-        
-        // Write the third byte if there is enough data
-        if (i+3 < base64Mask.length() && base64Mask[i+3] != '=')
-            data.push_back(((v3 & 0x03) << 6) | v4);
+    // Decode into a buffer sized up front, validating every symbol
+    std::vector<uchar> data(base64::decodedSizeBound(base64Mask.size()));
+    size_t written = 0;
+    if (!base64::decode(base64Mask.data(), base64Mask.size(), data.data(), written)) {
+        std::cerr << "Error: Invalid base64 in mask" << std::endl;
+        return cv::Mat();
     }
+    data.resize(written);
     
     // Decode the binary data to a Mat object
     return cv::imdecode(data, cv::IMREAD_UNCHANGED);
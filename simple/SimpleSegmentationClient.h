@@ -7,15 +7,17 @@
 #include <opencv2/opencv.hpp>
 #include <cpr/cpr.h>
 #include <nlohmann/json.hpp>
+#include "AsyncRequestEngine.h"
 
 class SimpleSegmentationClient {
 public:
-    SimpleSegmentationClient(const std::string& server_url);
+    // max_in_flight bounds the number of asynchronous requests on the wire
+    SimpleSegmentationClient(const std::string& server_url, size_t max_in_flight = 4);
     
     // Synchronous method
     cv::Mat segmentImage(const cv::Mat& image);
     
-    // Asynchronous method
+    // Asynchronous method (sent by a shared curl-multi I/O thread)
     std::future<cv::Mat> segmentImageAsync(const cv::Mat& image);
     
     // Extract coordinates from mask
@@ -28,6 +30,9 @@ private:
     std::vector<uchar> encodeImageToPNG(const cv::Mat& image);
     std::string extractBase64MaskFromJson(const std::string& jsonResponse);
     cv::Mat decodeBase64Mask(const std::string& base64Mask);
+    
+    // Drives all asynchronous requests; declared last so it stops first
+    AsyncRequestEngine m_engine;
 };
 
 #endif // SIMPLE_SEGMENTATION_CLIENT_H
\ No newline at end of file